@@ -0,0 +1,59 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <cmath>
+#include <fmt/format.h>
+#include <vector>
+
+#include "audio_analyzer.hpp"
+#include "bench.hpp"
+
+void BenchAudio() {
+  constexpr std::size_t kIterations = 20000;
+  constexpr unsigned kSampleRate = 44100;
+
+  // a chord over some noise, the content doesn't change the work done
+  std::vector<float> samples(AudioAnalyzer::kHopSize * 64);
+  uint32_t seed = 1;
+  for (std::size_t i = 0; i < samples.size(); ++i) {
+    seed = seed * 1664525 + 1013904223;
+    const float noise = static_cast<float>(seed >> 8) / (1 << 24) - 0.5F;
+    samples[i] = 0.3F * std::sin(2 * M_PI * 110 * i / kSampleRate) +
+                 0.2F * std::sin(2 * M_PI * 440 * i / kSampleRate) +
+                 0.1F * std::sin(2 * M_PI * 3520 * i / kSampleRate) + 0.05F * noise;
+  }
+
+  const double hop_ns = 1e9 * AudioAnalyzer::kHopSize / kSampleRate;
+  fmt::print("{:<8} {:>6} {:>12} {:>10}\n", "bands", "fft", "ns/hop", "% of hop");
+  for (std::size_t bands : {16, 32}) {
+    AudioAnalyzer analyzer;
+    AudioAnalyzer::config_t config;
+    config.bands = bands;
+    analyzer.Configure(kSampleRate, config);
+
+    std::size_t offset = 0;
+    const double ns = Bench::NsPerOp(
+        [&]() {
+          analyzer.Process(samples.data() + offset);
+          offset = (offset + AudioAnalyzer::kHopSize) % samples.size();
+          Bench::DoNotOptimize(analyzer.GetLevels()[0]);
+        },
+        kIterations);
+    fmt::print("{:<8} {:>6} {:>12.0f} {:>10.3f}\n", bands, AudioAnalyzer::kFftSize, ns,
+               100 * ns / hop_ns);
+  }
+}
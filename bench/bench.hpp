@@ -0,0 +1,54 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef BENCH_BENCH_HPP
+#define BENCH_BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+
+class Bench {
+public:
+  // Run f for the given number of iterations and return the average time in nanoseconds.
+  template <typename F> static double NsPerOp(F &&f, std::size_t iterations) {
+    // warm up caches and allocators
+    for (std::size_t i = 0; i < iterations / 10 + 1; ++i) {
+      f();
+    }
+
+    const auto &start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+      f();
+    }
+    const auto &duration = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(duration).count() / iterations;
+  }
+
+  // Keep the compiler from optimizing away results
+  template <typename T> static void DoNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+};
+
+void BenchAudio();
+void BenchCodec();
+void BenchFrames();
+void BenchLog();
+void BenchMetrics();
+void BenchShader();
+
+#endif // BENCH_BENCH_HPP
@@ -0,0 +1,105 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <fmt/format.h>
+#include <vector>
+
+#include "bench.hpp"
+#include "codec.hpp"
+
+static std::vector<std::pair<std::string, nlohmann::json>> SampleMessages() {
+  std::vector<std::pair<std::string, nlohmann::json>> messages;
+
+  messages.emplace_back("set_color", nlohmann::json{{"cmd", "set_color"},
+                                                    {"red", 255},
+                                                    {"green", 128},
+                                                    {"blue", 12}});
+
+  messages.emplace_back("get_power", nlohmann::json{{"rsp", "get_power"},
+                                                    {"light", true},
+                                                    {"animation", false},
+                                                    {"timeout_active", false}});
+
+  messages.emplace_back("get_alarm", nlohmann::json{{"rsp", "get_alarm"},
+                                                    {"name", "Wake up"},
+                                                    {"active", true},
+                                                    {"hour", 6},
+                                                    {"minute", 30},
+                                                    {"days", {1, 2, 3, 4, 5}},
+                                                    {"animation_hash",
+                                                     "C54E0D09AC7A6FF1C41B745FECD2B975"}});
+
+  std::vector<uint32_t> colors;
+  for (uint32_t i = 0; i < 32; ++i) {
+    colors.push_back(i * 0x00070503);
+  }
+  messages.emplace_back("get_predefined_colors",
+                        nlohmann::json{{"rsp", "get_predefined_colors"}, {"colors", colors}});
+
+  nlohmann::json animations = nlohmann::json::array();
+  for (int i = 0; i < 20; ++i) {
+    animations.push_back({{"name", fmt::format("animation {}", i)},
+                          {"description", "Some lengthy description of the animation"},
+                          {"hash", "C54E0D09AC7A6FF1C41B745FECD2B975"}});
+  }
+  messages.emplace_back("get_animations",
+                        nlohmann::json{{"rsp", "get_animations"}, {"animations", animations}});
+
+  std::vector<uint32_t> frame;
+  for (uint32_t i = 0; i < 300; ++i) {
+    frame.push_back(i * 0x01030507);
+  }
+  messages.emplace_back("frame (300 LEDs)", nlohmann::json{{"cmd", "frame"}, {"data", frame}});
+
+  return messages;
+}
+
+void BenchCodec() {
+  constexpr std::size_t kIterations = 20000;
+  const Codec::encoding_e encodings[] = {Codec::encoding_e::json, Codec::encoding_e::cbor,
+                                         Codec::encoding_e::msgpack};
+
+  fmt::print("{:<24} {:<8} {:>8} {:>12} {:>12}\n", "message", "encoding", "bytes", "encode ns",
+             "decode ns");
+
+  std::vector<uint8_t> buffer;
+  for (const auto &[name, msg] : SampleMessages()) {
+    for (Codec::encoding_e encoding : encodings) {
+      const double encode_ns = Bench::NsPerOp(
+          [&]() {
+            Codec::Encode(encoding, msg, buffer);
+            Bench::DoNotOptimize(buffer.data());
+          },
+          kIterations);
+
+      std::size_t offset = 0;
+      std::size_t size = 0;
+      std::size_t total = 0;
+      Codec::FindMessage(encoding, buffer.data(), buffer.size(), offset, size, total);
+
+      const double decode_ns = Bench::NsPerOp(
+          [&]() {
+            const nlohmann::json &decoded = Codec::Decode(encoding, buffer.data() + offset, size);
+            Bench::DoNotOptimize(decoded.size());
+          },
+          kIterations);
+
+      fmt::print("{:<24} {:<8} {:>8} {:>12.0f} {:>12.0f}\n", name, Codec::ToString(encoding),
+                 buffer.size(), encode_ns, decode_ns);
+    }
+  }
+}
@@ -0,0 +1,105 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <asio.hpp>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <fmt/format.h>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <time.h>
+
+#include "bench.hpp"
+#include "compositor.hpp"
+#include "log.hpp"
+#include "ws2811_control.hpp"
+
+namespace {
+double ThreadCpuSeconds() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+} // namespace
+
+void BenchFrames() {
+  constexpr auto kDuration = std::chrono::seconds(1);
+
+  FILE *null = fopen("/dev/null", "w");
+  Log::SetOutput(null);
+  Log::SetLevel(Log::kError);
+
+  // the simulated backend paces the frames like the DMA transfer of the hardware
+  const std::filesystem::path &dir =
+      std::filesystem::temp_directory_path() / fmt::format("ledcontrol_bench_{}", getpid());
+  std::filesystem::create_directories(dir);
+
+  std::mt19937 random(42);
+  fmt::print("{:>6} {:>9} {:>10} {:>14} {:>8} {:>8}\n", "LEDs", "channels", "wire ms",
+             "cpu us/frame", "fps", "max fps");
+  for (int leds : {300, 600, 1200, 2400, 4800, 9600}) {
+    for (int channels : {1, 2}) {
+      nlohmann::json cfg;
+      cfg["backend"] = "simulated";
+      cfg["channels"][0]["led_count"] = leds / channels;
+      cfg["channels"][1]["led_count"] = leds - leds / channels;
+      std::ofstream(dir / "ws2811.json") << cfg;
+
+      asio::io_context io;
+      WS2811Control ws2811_control(dir.string());
+      // two blended layers, one of them changing every frame like a running animation
+      Compositor compositor(io, ws2811_control, {"light", "animation"});
+      compositor.SetTransition(std::chrono::milliseconds(0));
+      std::vector<ws2811_led_t> light(leds, 0x20100804);
+      std::array<std::vector<ws2811_led_t>, 2> animation;
+      for (std::vector<ws2811_led_t> &frame : animation) {
+        frame.resize(leds);
+        std::generate(frame.begin(), frame.end(), std::ref(random));
+      }
+      compositor.SetFrame(0, light);
+      compositor.SetActive(0, true);
+      compositor.SetBlend(1, Compositor::blend_e::add);
+      compositor.SetOpacity(1, 128);
+      compositor.SetActive(1, true);
+      io.poll();
+
+      std::size_t frames = 0;
+      const double cpu_start = ThreadCpuSeconds();
+      const auto &start = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - start < kDuration) {
+        compositor.SetFrame(1, animation[frames % animation.size()]);
+        io.restart();
+        io.poll();
+        frames++;
+      }
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      const double cpu = ThreadCpuSeconds() - cpu_start;
+
+      const std::chrono::duration<double> frame_time = ws2811_control.GetFrameTime();
+      fmt::print("{:>6} {:>9} {:>10.2f} {:>14.1f} {:>8.1f} {:>8.1f}\n", leds, channels,
+                 frame_time.count() * 1e3, cpu / frames * 1e6, frames / elapsed.count(),
+                 1 / frame_time.count());
+    }
+  }
+
+  std::filesystem::remove_all(dir);
+  Log::Flush();
+  Log::SetOutput(stdout);
+  fclose(null);
+}
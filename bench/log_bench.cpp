@@ -0,0 +1,85 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <chrono>
+#include <fmt/chrono.h>
+#include <fstream>
+#include <iostream>
+
+#include "bench.hpp"
+#include "log.hpp"
+
+namespace {
+class Logger : public Log {
+public:
+  Logger() : Log("bench") {}
+
+  void Debug(int i) { D("SetFrame of size {} with brightness {} {:08X}", i, 255, 0x00FF00FFu); }
+  void Info(int i) { I("SetFrame of size {} with brightness {} {:08X}", i, 255, 0x00FF00FFu); }
+};
+} // namespace
+
+void BenchLog() {
+  constexpr std::size_t kIterations = 200;
+  constexpr std::size_t kRepetitions = 100;
+
+  FILE *null = fopen("/dev/null", "w");
+  Log::SetOutput(null);
+  Logger logger;
+  int i = 0;
+
+  // Measure batches below the ring capacity and let the background thread drain the ring in
+  // between. Only the time spent by the caller is of interest.
+  auto measure = [&](auto &&f) {
+    double ns = 0;
+    for (std::size_t n = 0; n < kRepetitions; ++n) {
+      ns += Bench::NsPerOp(f, kIterations);
+      Log::Flush();
+    }
+    return ns / kRepetitions;
+  };
+
+  Log::SetLevel(Log::kInfo);
+  fmt::print("{:<40} {:>8.1f} ns\n", "debug call, suppressed at runtime",
+             measure([&]() { logger.Debug(i++); }));
+
+  Log::SetLevel(Log::kDebug);
+  fmt::print("{:<40} {:>8.1f} ns\n", "debug call, emitted to ring buffer",
+             measure([&]() { logger.Debug(i++); }));
+  fmt::print("{:<40} {:>8.1f} ns\n", "info call, emitted to ring buffer",
+             measure([&]() { logger.Info(i++); }));
+
+  // the previous implementation: format in the caller and write synchronously
+  std::ofstream out("/dev/null");
+  const double sync_ns = measure([&]() {
+    const auto &now = std::chrono::system_clock::now();
+    const auto &millis =
+        std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() %
+        1000;
+    out << fmt::format("{:%H:%M:%S}.{:03} {} {}: ",
+                       std::chrono::time_point_cast<std::chrono::seconds>(now), millis, "[D]",
+                       "bench")
+        << fmt::format("SetFrame of size {} with brightness {} {:08X}", i++, 255, 0x00FF00FFu)
+        << std::endl;
+  });
+  fmt::print("{:<40} {:>8.1f} ns\n", "synchronous format and write (old)", sync_ns);
+
+  fmt::print("{:<40} {:>8}\n", "dropped messages", Log::GetDropped());
+
+  Log::SetOutput(stdout);
+  fclose(null);
+}
@@ -0,0 +1,57 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <fmt/format.h>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "bench.hpp"
+
+int main(int argc, char **argv) {
+  const std::map<std::string, std::function<void()>> benchmarks = {
+      {"audio", BenchAudio},
+      {"codec", BenchCodec},
+      {"frames", BenchFrames},
+      {"log", BenchLog},
+      {"metrics", BenchMetrics},
+      {"shader", BenchShader},
+  };
+
+  if (argc < 2) {
+    for (const auto &[name, bench] : benchmarks) {
+      fmt::print("--- {} ---\n", name);
+      bench();
+    }
+    return 0;
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    auto it = benchmarks.find(argv[i]);
+    if (it == benchmarks.end()) {
+      fmt::print("Unknown benchmark '{}'. Available:", argv[i]);
+      for (const auto &benchmark : benchmarks) {
+        fmt::print(" {}", benchmark.first);
+      }
+      fmt::print("\n");
+      return -1;
+    }
+    fmt::print("--- {} ---\n", it->first);
+    it->second();
+  }
+  return 0;
+}
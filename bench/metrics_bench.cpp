@@ -0,0 +1,59 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <fmt/format.h>
+
+#include "bench.hpp"
+#include "metrics.hpp"
+
+void BenchMetrics() {
+  constexpr std::size_t kIterations = 1000000;
+  // metrics updated per rendered frame: frame counter, frame rate, render time, animation
+  // frame counter and timer lag
+  constexpr int kUpdatesPerFrame = 5;
+  constexpr double kFrameRate = 60;
+
+  Metrics &metrics = Metrics::Instance();
+  Metrics::Counter &counter = metrics.GetCounter("bench_counter_total", "bench");
+  Metrics::Gauge &gauge = metrics.GetGauge("bench_gauge", "bench");
+  Metrics::Histogram &histogram = metrics.GetHistogram("bench_seconds", "bench");
+
+  const double counter_ns = Bench::NsPerOp([&]() { counter.Inc(); }, kIterations);
+  const double gauge_ns = Bench::NsPerOp([&]() { gauge.Set(gauge.Get() * 0.9 + 6); }, kIterations);
+  double value = 0;
+  const double histogram_ns = Bench::NsPerOp(
+      [&]() {
+        value += 0.0001;
+        histogram.Observe(value);
+      },
+      kIterations);
+  const double timer_ns =
+      Bench::NsPerOp([&]() { Metrics::ScopedTimer timer(histogram); }, kIterations);
+
+  fmt::print("{:<40} {:>8.1f} ns\n", "Counter::Inc", counter_ns);
+  fmt::print("{:<40} {:>8.1f} ns\n", "Gauge::Set", gauge_ns);
+  fmt::print("{:<40} {:>8.1f} ns\n", "Histogram::Observe", histogram_ns);
+  fmt::print("{:<40} {:>8.1f} ns\n", "ScopedTimer incl. 2x clock", timer_ns);
+
+  const double worst_ns = std::max({counter_ns, gauge_ns, histogram_ns, timer_ns});
+  const double share = worst_ns * kUpdatesPerFrame * kFrameRate / 1e9 * 100;
+  fmt::print("{:<40} {:>8.4f} %\n", "CPU share at 60 fps (worst case)", share);
+
+  const double export_ns =
+      Bench::NsPerOp([&]() { Bench::DoNotOptimize(metrics.ToPrometheus().size()); }, 1000);
+  fmt::print("{:<40} {:>8.1f} us\n", "Prometheus export", export_ns / 1000);
+}
@@ -0,0 +1,65 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <fmt/format.h>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "shader.hpp"
+
+void BenchShader() {
+  constexpr std::size_t kIterations = 2000;
+  const std::pair<const char *, const char *> programs[] = {
+      {"gradient", "r = x; b = 1 - x;"},
+      {"rainbow", "h = fract(x + t * speed);"
+                  "r = clamp(abs(h * 6 - 3) - 1, 0, 1);"
+                  "g = clamp(2 - abs(h * 6 - 2), 0, 1);"
+                  "b = clamp(2 - abs(h * 6 - 4), 0, 1);"},
+      {"sparkle", "on = rand(i + floor(t * 20)) > 0.97;"
+                  "w = on ? 1 : 0.05 * (1 + sin(t + x * 2 * pi));"},
+      {"waves", "a = sin(x * 20 - t * 3) * 0.5 + 0.5;"
+                "c = cos(x * 7 + t * speed) * 0.5 + 0.5;"
+                "r = pow(a, 2.2); g = pow(c * a, 2.2); b = smoothstep(0.3, 0.9, c);"},
+  };
+
+  fmt::print("{:<12} {:>6} {:>8} {:>12} {:>10}\n", "program", "ops", "leds", "ns/frame",
+             "ns/led");
+  for (const auto &[name, source] : programs) {
+    Shader shader;
+    std::string error;
+    if (!shader.Compile(source, {"speed"}, error)) {
+      fmt::print("{}: {}\n", name, error);
+      continue;
+    }
+    shader.SetParam("speed", 0.5F);
+
+    for (std::size_t leds : {300, 3000}) {
+      std::vector<ws2811_led_t> frame(leds);
+      float time = 0.0F;
+      const double ns = Bench::NsPerOp(
+          [&]() {
+            shader.Render(frame.data(), frame.size(), time);
+            time += 0.02F;
+            Bench::DoNotOptimize(frame[leds / 2]);
+          },
+          kIterations);
+      fmt::print("{:<12} {:>6} {:>8} {:>12.0f} {:>10.2f}\n", name,
+                 shader.GetInstructionCount(), leds, ns, ns / leds);
+    }
+  }
+}
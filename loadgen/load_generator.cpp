@@ -0,0 +1,484 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "load_generator.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <sstream>
+
+namespace {
+// upper bounds of the latency distribution in ms
+constexpr double kBuckets[] = {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000};
+
+std::chrono::steady_clock::duration Interval(double rate) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+}
+
+double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+void ReportDistribution(const std::string &name, const std::vector<double> &latency) {
+  if (latency.empty()) {
+    return;
+  }
+  std::vector<std::size_t> counts(std::size(kBuckets) + 1, 0);
+  for (double seconds : latency) {
+    const double ms = seconds * 1000;
+    counts[std::lower_bound(std::begin(kBuckets), std::end(kBuckets), ms) -
+           std::begin(kBuckets)]++;
+  }
+  const std::size_t max = *std::max_element(counts.begin(), counts.end());
+  fmt::print("\n{} latency distribution:\n", name);
+  for (std::size_t i = 0; i < counts.size(); ++i) {
+    const std::string &bound = i < std::size(kBuckets) ? fmt::format("<= {:g} ms", kBuckets[i])
+                                                      : std::string("> 1000 ms");
+    fmt::print("  {:>11} {:>9} {:5.1f}% {}\n", bound, counts[i], 100.0 * counts[i] / latency.size(),
+               std::string((counts[i] * 40 + max - 1) / max, '#'));
+  }
+}
+} // namespace
+
+LoadGenerator::LoadGenerator(const options_t &options)
+    : Log("loadgen"), options_(options), random_(options.seed) {
+  std::vector<unsigned> weights;
+  for (const command_t &command : options_.mix) {
+    weights.push_back(command.weight);
+  }
+  pick_ = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+  stats_.resize(options_.mix.size());
+}
+
+LoadGenerator::~LoadGenerator() {}
+
+bool LoadGenerator::ParseMix(const std::string &text, std::vector<command_t> &mix) {
+  mix.clear();
+  try {
+    if (std::filesystem::exists(text)) {
+      nlohmann::json cfg;
+      std::ifstream(text) >> cfg;
+      for (const nlohmann::json &item : cfg) {
+        command_t command;
+        command.msg = item.at("msg");
+        const std::string &cmd = command.msg.at("cmd");
+        command.rsp = item.value("rsp", cmd.rfind("get_", 0) == 0 ? cmd : "");
+        command.weight = item.value("weight", 1U);
+        mix.push_back(command);
+      }
+    } else {
+      std::istringstream stream(text);
+      std::string item;
+      while (std::getline(stream, item, ',')) {
+        command_t command;
+        const std::size_t colon = item.find(':');
+        const std::string &cmd = item.substr(0, colon);
+        if (colon != std::string::npos) {
+          command.weight = std::stoul(item.substr(colon + 1));
+        }
+        command.msg["cmd"] = cmd;
+        command.rsp = cmd.rfind("get_", 0) == 0 ? cmd : "";
+        mix.push_back(command);
+      }
+    }
+  } catch (const std::exception &e) {
+    fmt::print(stderr, "Parsing mix failed: {}\n", e.what());
+    return false;
+  }
+
+  unsigned total = 0;
+  for (const command_t &command : mix) {
+    total += command.weight;
+  }
+  return total != 0;
+}
+
+bool LoadGenerator::Run() {
+  asio::error_code error;
+  asio::ip::tcp::resolver resolver(io_);
+  const auto &endpoints = resolver.resolve(options_.host, std::to_string(options_.port + 1), error);
+  if (error || endpoints.empty()) {
+    E("Resolving {} failed: {}", options_.host, error.message());
+    return false;
+  }
+  const asio::ip::tcp::endpoint &endpoint = *endpoints.begin();
+
+  if (options_.udp_rate > 0) {
+    udp_endpoint_ = asio::ip::udp::endpoint(endpoint.address(), options_.port);
+    udp_socket_.open(udp_endpoint_.protocol(), error);
+    if (error) {
+      E("Opening UDP socket failed: {}", error.message());
+      return false;
+    }
+    ReadUdp();
+  }
+
+  connecting_ = options_.sessions;
+  for (std::size_t i = 0; i < options_.sessions; ++i) {
+    clients_.push_back(std::make_unique<client_t>(io_));
+    Connect(*clients_.back(), endpoint);
+  }
+  if (options_.sessions == 0) {
+    Start();
+  }
+
+  io_.run();
+  return connect_errors_ < options_.sessions || options_.sessions == 0;
+}
+
+void LoadGenerator::Connect(client_t &client, const asio::ip::tcp::endpoint &endpoint) {
+  client.socket.async_connect(endpoint, [this, &client](const asio::error_code &error) {
+    if (error) {
+      E("Connecting failed: {}", error.message());
+      connect_errors_++;
+      Done(client);
+      return;
+    }
+    client.open = true;
+    Read(client);
+
+    if (!options_.topics.empty()) {
+      Send(client, {{"cmd", "subscribe"}, {"topics", options_.topics}});
+    }
+    if (options_.encoding != Codec::encoding_e::json) {
+      // the daemon answers in JSON and switches afterwards
+      Send(client, {{"cmd", "set_encoding"}, {"encoding", Codec::ToString(options_.encoding)}});
+      client.pending["set_encoding"].push_back({clock::now(), stats_.size()});
+      return;
+    }
+    client.ready = true;
+    Done(client);
+  });
+}
+
+void LoadGenerator::Done(client_t &client) {
+  if (!client.waiting) {
+    return;
+  }
+  client.waiting = false;
+  if (--connecting_ == 0) {
+    Start();
+  }
+}
+
+void LoadGenerator::Read(client_t &client) {
+  client.socket.async_read_some(
+      asio::buffer(client.read_buffer), [this, &client](const asio::error_code &error,
+                                                        std::size_t size) {
+        if (!client.open) {
+          return;
+        }
+        if (error) {
+          E("Session closed: {}", error.message());
+          disconnects_++;
+          Close(client);
+          return;
+        }
+
+        client.received.insert(client.received.end(), client.read_buffer.begin(),
+                               client.read_buffer.begin() + size);
+        try {
+          std::size_t offset = 0;
+          std::size_t length = 0;
+          std::size_t total = 0;
+          // the encoding changes with the response to set_encoding
+          while (Codec::FindMessage(client.encoding, client.received.data(),
+                                    client.received.size(), offset, length, total)) {
+            nlohmann::json msg;
+            try {
+              msg = Codec::Decode(client.encoding, client.received.data() + offset, length);
+            } catch (const nlohmann::json::exception &e) {
+              E("Decoding message failed: {}", e.what());
+              decode_errors_++;
+            }
+            client.received.erase(client.received.begin(), client.received.begin() + total);
+            if (!msg.is_null()) {
+              OnMessage(client, msg);
+            }
+          }
+        } catch (const std::length_error &e) {
+          E("Dropping session: {}", e.what());
+          decode_errors_++;
+          Close(client);
+          return;
+        }
+        Read(client);
+      });
+}
+
+void LoadGenerator::OnMessage(client_t &client, const nlohmann::json &msg) {
+  const clock::time_point &now = clock::now();
+  if (msg.contains("evt")) {
+    events_++;
+    return;
+  }
+
+  auto it = client.pending.find(msg.value("rsp", ""));
+  if (it == client.pending.end() || it->second.empty()) {
+    unsolicited_++;
+    return;
+  }
+  const pending_t pending = it->second.front();
+  it->second.pop_front();
+
+  if (pending.command == stats_.size()) {
+    Codec::FromString(msg.value("encoding", "json"), client.encoding);
+    client.ready = true;
+    Done(client);
+    return;
+  }
+  stats_[pending.command].latency.push_back(
+      std::chrono::duration<double>(now - pending.due).count());
+}
+
+void LoadGenerator::Send(client_t &client, const nlohmann::json &msg) {
+  std::vector<uint8_t> buffer;
+  Codec::Encode(client.encoding, msg, buffer);
+  client.queued.insert(client.queued.end(), buffer.begin(), buffer.end());
+  if (client.sending.empty()) {
+    Write(client);
+  }
+}
+
+void LoadGenerator::Write(client_t &client) {
+  client.sending.swap(client.queued);
+  asio::async_write(client.socket, asio::buffer(client.sending),
+                    [this, &client](const asio::error_code &error, std::size_t) {
+                      client.sending.clear();
+                      if (!client.open) {
+                        return;
+                      }
+                      if (error) {
+                        E("Sending failed: {}", error.message());
+                        disconnects_++;
+                        Close(client);
+                        return;
+                      }
+                      if (!client.queued.empty()) {
+                        Write(client);
+                      }
+                    });
+}
+
+void LoadGenerator::Close(client_t &client) {
+  if (client.open) {
+    client.open = false;
+    client.ready = false;
+    asio::error_code error;
+    client.socket.close(error);
+  }
+  Done(client);
+}
+
+void LoadGenerator::ReadUdp() {
+  udp_socket_.async_receive_from(
+      asio::buffer(udp_buffer_), udp_sender_,
+      [this](const asio::error_code &error, std::size_t size) {
+        if (error == asio::error::operation_aborted) {
+          return;
+        }
+        if (error) {
+          E("Receiving UDP failed: {}", error.message());
+        } else {
+          const clock::time_point &now = clock::now();
+          try {
+            const nlohmann::json &msg =
+                nlohmann::json::parse(udp_buffer_.begin(), udp_buffer_.begin() + size);
+            if (msg.value("rsp", "") != "identify" || udp_pending_.empty()) {
+              unsolicited_++;
+            } else {
+              udp_stats_.latency.push_back(
+                  std::chrono::duration<double>(now - udp_pending_.front()).count());
+              udp_pending_.pop_front();
+            }
+          } catch (const nlohmann::json::exception &e) {
+            E("Decoding UDP message failed: {}", e.what());
+            decode_errors_++;
+          }
+        }
+        ReadUdp();
+      });
+}
+
+void LoadGenerator::Start() {
+  start_ = clock::now();
+  end_ = start_ + options_.duration;
+  next_command_ = options_.rate > 0 && !options_.mix.empty() ? start_ : clock::time_point::max();
+  next_identify_ = options_.udp_rate > 0 ? start_ : clock::time_point::max();
+  I("Start with {} sessions", options_.sessions - connect_errors_);
+  OnTick();
+}
+
+void LoadGenerator::OnTick() {
+  const clock::time_point &now = clock::now();
+
+  if (!draining_) {
+    while (next_command_ <= now && next_command_ < end_) {
+      SendCommand(next_command_);
+      next_command_ += Interval(options_.rate);
+    }
+    while (next_identify_ <= now && next_identify_ < end_) {
+      SendIdentify(next_identify_);
+      next_identify_ += Interval(options_.udp_rate);
+    }
+    if (now >= end_) {
+      draining_ = true;
+      elapsed_ = now - start_;
+    }
+  }
+
+  ExpirePending(now);
+
+  if (draining_ && GetPendingCount() == 0) {
+    for (auto &client : clients_) {
+      Close(*client);
+    }
+    asio::error_code error;
+    udp_socket_.close(error);
+    return;
+  }
+
+  // wake up for the next request, and often enough to expire lost ones in time
+  clock::time_point next = now + std::chrono::milliseconds(10);
+  if (!draining_) {
+    next = std::min({next, next_command_, next_identify_, end_});
+  }
+  timer_.expires_at(next);
+  timer_.async_wait([this](const asio::error_code &error) {
+    if (!error) {
+      OnTick();
+    }
+  });
+}
+
+void LoadGenerator::SendCommand(clock::time_point due) {
+  const std::size_t index = pick_(random_);
+  stats_t &stats = stats_[index];
+  stats.sent++;
+
+  // round robin over the sessions still open
+  for (std::size_t i = 0; i < clients_.size(); ++i) {
+    client_t &client = *clients_[next_client_];
+    next_client_ = (next_client_ + 1) % clients_.size();
+    if (client.ready) {
+      const command_t &command = options_.mix[index];
+      Send(client, command.msg);
+      if (!command.rsp.empty()) {
+        client.pending[command.rsp].push_back({due, index});
+      }
+      return;
+    }
+  }
+  stats.lost++;
+}
+
+void LoadGenerator::SendIdentify(clock::time_point due) {
+  static const std::string kIdentify = R"({"cmd":"identify"})";
+  udp_stats_.sent++;
+  asio::error_code error;
+  udp_socket_.send_to(asio::buffer(kIdentify), udp_endpoint_, 0, error);
+  if (error) {
+    E("Sending UDP failed: {}", error.message());
+    udp_stats_.lost++;
+    return;
+  }
+  udp_pending_.push_back(due);
+}
+
+void LoadGenerator::ExpirePending(clock::time_point now) {
+  const clock::time_point &expired = now - options_.timeout;
+  for (auto &client : clients_) {
+    for (auto &[rsp, queue] : client->pending) {
+      while (!queue.empty() && (queue.front().due < expired || !client->open)) {
+        if (queue.front().command < stats_.size()) {
+          stats_[queue.front().command].lost++;
+        }
+        queue.pop_front();
+      }
+    }
+  }
+  while (!udp_pending_.empty() && udp_pending_.front() < expired) {
+    udp_stats_.lost++;
+    udp_pending_.pop_front();
+  }
+}
+
+std::size_t LoadGenerator::GetPendingCount() const {
+  std::size_t count = udp_pending_.size();
+  for (const auto &client : clients_) {
+    for (const auto &[rsp, queue] : client->pending) {
+      count += queue.size();
+    }
+  }
+  return count;
+}
+
+void LoadGenerator::ReportLatency(const std::string &name, const stats_t &stats) {
+  std::vector<double> sorted = stats.latency;
+  std::sort(sorted.begin(), sorted.end());
+  fmt::print("{:<24} {:>9} {:>9} {:>7} {:>8.3f} {:>8.3f} {:>8.3f} {:>8.3f} {:>8.3f}\n", name,
+             stats.sent, sorted.size(), stats.lost, Percentile(sorted, 0.5) * 1000,
+             Percentile(sorted, 0.9) * 1000, Percentile(sorted, 0.99) * 1000,
+             Percentile(sorted, 0.999) * 1000, sorted.empty() ? 0.0 : sorted.back() * 1000);
+}
+
+void LoadGenerator::Report() const {
+  uint64_t sent = 0;
+  stats_t all;
+  for (const stats_t &stats : stats_) {
+    sent += stats.sent;
+    all.sent += stats.sent;
+    all.lost += stats.lost;
+    all.latency.insert(all.latency.end(), stats.latency.begin(), stats.latency.end());
+  }
+  const double seconds = elapsed_.count();
+  fmt::print("{} sessions, {} commands and {} identify requests in {:.1f} s: {:.0f}/s and "
+             "{:.0f}/s\n\n",
+             options_.sessions - connect_errors_, sent, udp_stats_.sent, seconds,
+             seconds > 0 ? sent / seconds : 0.0, seconds > 0 ? udp_stats_.sent / seconds : 0.0);
+
+  fmt::print("{:<24} {:>9} {:>9} {:>7} {:>8} {:>8} {:>8} {:>8} {:>8}\n", "latency [ms]", "sent",
+             "answered", "lost", "p50", "p90", "p99", "p99.9", "max");
+  for (std::size_t i = 0; i < stats_.size(); ++i) {
+    const command_t &command = options_.mix[i];
+    // commands without response have no latency
+    if (!command.rsp.empty()) {
+      ReportLatency(command.msg.value("cmd", "?"), stats_[i]);
+    } else {
+      fmt::print("{:<24} {:>9}\n", command.msg.value("cmd", "?"), stats_[i].sent);
+    }
+  }
+  if (udp_stats_.sent != 0) {
+    ReportLatency("identify (udp)", udp_stats_);
+  }
+
+  fmt::print("\nerrors: {} connect, {} disconnect, {} decode, {} lost, {} unsolicited\n",
+             connect_errors_, disconnects_, decode_errors_, all.lost + udp_stats_.lost,
+             unsolicited_);
+  if (events_ != 0) {
+    fmt::print("events: {}\n", events_);
+  }
+
+  ReportDistribution("command", all.latency);
+  ReportDistribution("identify", udp_stats_.latency);
+}
@@ -0,0 +1,173 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef LOADGEN_LOAD_GENERATOR_HPP
+#define LOADGEN_LOAD_GENERATOR_HPP
+
+#include <array>
+#include <asio.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+#include "log.hpp"
+
+/**
+ * @brief Load the daemon with many sessions and identify requests
+ *
+ * The commands are sent at a fixed rate, spread round robin over all sessions, independent of
+ * the responses. The latency is taken from the time a command was due, not from the time it was
+ * sent, so a stalled daemon shows up in the latency instead of slowing down the load. Responses
+ * carry no request id, they are matched to the oldest pending request of the same name.
+ */
+class LoadGenerator : public Log {
+public:
+  struct command_t {
+    nlohmann::json msg;
+    // name of the response answering the command, empty if the daemon sends none
+    std::string rsp;
+    unsigned weight{1};
+  };
+
+  struct options_t {
+    std::string host{"127.0.0.1"};
+    // UDP port of the daemon, TCP uses the next one
+    uint16_t port{7755};
+    std::size_t sessions{4};
+    // commands per second over all sessions
+    double rate{100};
+    // identify requests per second, 0 for none
+    double udp_rate{0};
+    std::chrono::seconds duration{10};
+    // a response later than that counts as lost
+    std::chrono::milliseconds timeout{1000};
+    Codec::encoding_e encoding{Codec::encoding_e::json};
+    // topics the sessions subscribe to, none keeps them legacy clients
+    std::vector<std::string> topics;
+    std::vector<command_t> mix;
+    unsigned seed{1};
+  };
+
+  struct stats_t {
+    uint64_t sent{0};
+    uint64_t lost{0};
+    // latency of each answered request in seconds
+    std::vector<double> latency;
+  };
+
+  explicit LoadGenerator(const options_t &options);
+  virtual ~LoadGenerator();
+
+  /**
+   * @brief Parse the command mix
+   *
+   * Either a file with a JSON array of {"msg": {...}, "rsp": "...", "weight": n} or a comma
+   * separated list of command names with optional weight, e.g. "get_power:10,get_color". The
+   * response defaults to the command name for get_* commands and to none otherwise.
+   */
+  static bool ParseMix(const std::string &text, std::vector<command_t> &mix);
+
+  bool Run();
+  void Report() const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct pending_t {
+    clock::time_point due;
+    // index into the mix, stats_.size() for set_encoding and subscribe
+    std::size_t command;
+  };
+
+  struct client_t {
+    explicit client_t(asio::io_context &io) : socket(io) {}
+
+    asio::ip::tcp::socket socket;
+    Codec::encoding_e encoding{Codec::encoding_e::json};
+    bool open{false};
+    // counted until connected and ready or failed
+    bool waiting{true};
+    // requests are sent after the session switched the encoding
+    bool ready{false};
+    std::array<uint8_t, 4096> read_buffer;
+    std::vector<uint8_t> received;
+    // a single write is in flight, the next ones are collected meanwhile
+    std::vector<uint8_t> sending;
+    std::vector<uint8_t> queued;
+    std::map<std::string, std::deque<pending_t>> pending;
+  };
+
+  void Connect(client_t &client, const asio::ip::tcp::endpoint &endpoint);
+  void Done(client_t &client);
+  void Read(client_t &client);
+  void OnMessage(client_t &client, const nlohmann::json &msg);
+  void Send(client_t &client, const nlohmann::json &msg);
+  void Write(client_t &client);
+  void Close(client_t &client);
+  void ReadUdp();
+
+  void Start();
+  void OnTick();
+  void SendCommand(clock::time_point due);
+  void SendIdentify(clock::time_point due);
+  void ExpirePending(clock::time_point now);
+  std::size_t GetPendingCount() const;
+
+  static void ReportLatency(const std::string &name, const stats_t &stats);
+
+  const options_t options_;
+  asio::io_context io_;
+  asio::steady_timer timer_{io_};
+  asio::ip::udp::socket udp_socket_{io_};
+  asio::ip::udp::endpoint udp_endpoint_;
+  asio::ip::udp::endpoint udp_sender_;
+  std::array<char, 1024> udp_buffer_;
+
+  std::vector<std::unique_ptr<client_t>> clients_;
+  std::size_t connecting_{0};
+  std::size_t next_client_{0};
+
+  std::mt19937 random_;
+  std::discrete_distribution<std::size_t> pick_;
+
+  clock::time_point start_;
+  clock::time_point end_;
+  clock::time_point next_command_;
+  clock::time_point next_identify_;
+  bool draining_{false};
+  std::chrono::duration<double> elapsed_{0};
+
+  // per command of the mix
+  std::vector<stats_t> stats_;
+  stats_t udp_stats_;
+  std::deque<clock::time_point> udp_pending_;
+
+  uint64_t connect_errors_{0};
+  uint64_t disconnects_{0};
+  uint64_t decode_errors_{0};
+  // responses without a pending request, e.g. the power status pushed to legacy clients
+  uint64_t unsolicited_{0};
+  uint64_t events_{0};
+};
+
+#endif // LOADGEN_LOAD_GENERATOR_HPP
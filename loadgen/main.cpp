@@ -0,0 +1,118 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <cstdlib>
+#include <fmt/format.h>
+#include <sstream>
+#include <unistd.h>
+
+#include "load_generator.hpp"
+
+namespace {
+constexpr const char *kDefaultMix = "get_power:10,get_color:5,get_layers:2,get_system_config:1";
+
+void Usage(const char *name) {
+  fmt::print(stderr,
+             "Usage: {} [options]\n"
+             "  -h host      daemon to load (default 127.0.0.1)\n"
+             "  -p port      UDP port of the daemon, TCP uses the next one (default 7755)\n"
+             "  -n sessions  TCP sessions (default 4)\n"
+             "  -r rate      commands per second over all sessions (default 100)\n"
+             "  -u rate      UDP identify requests per second (default 0)\n"
+             "  -d seconds   duration (default 10)\n"
+             "  -w ms        timeout of a response (default 1000)\n"
+             "  -e encoding  encoding of the sessions: json, cbor, msgpack\n"
+             "  -m mix       command mix, file or list like \"{}\"\n"
+             "  -t topics    comma separated topics the sessions subscribe to\n"
+             "  -s seed      seed of the command selection (default 1)\n"
+             "  -v           log debug messages\n",
+             name, kDefaultMix);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  LoadGenerator::options_t options;
+  std::string mix = kDefaultMix;
+  Log::SetLevel(Log::kError);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "h:p:n:r:u:d:w:e:m:t:s:v")) != -1) {
+    switch (opt) {
+    case 'h':
+      options.host = optarg;
+      break;
+    case 'p':
+      options.port = std::atoi(optarg);
+      break;
+    case 'n':
+      options.sessions = std::atoi(optarg);
+      break;
+    case 'r':
+      options.rate = std::atof(optarg);
+      break;
+    case 'u':
+      options.udp_rate = std::atof(optarg);
+      break;
+    case 'd':
+      options.duration = std::chrono::seconds(std::atoi(optarg));
+      break;
+    case 'w':
+      options.timeout = std::chrono::milliseconds(std::atoi(optarg));
+      break;
+    case 'e':
+      if (!Codec::FromString(optarg, options.encoding)) {
+        fmt::print(stderr, "Invalid encoding {}\n", optarg);
+        return -1;
+      }
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    case 't': {
+      std::istringstream stream(optarg);
+      std::string topic;
+      while (std::getline(stream, topic, ',')) {
+        options.topics.push_back(topic);
+      }
+      break;
+    }
+    case 's':
+      options.seed = std::atoi(optarg);
+      break;
+    case 'v':
+      Log::SetLevel(Log::kDebug);
+      break;
+    default:
+      Usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind != argc || !LoadGenerator::ParseMix(mix, options.mix)) {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  LoadGenerator generator(options);
+  const bool ok = generator.Run();
+  Log::Flush();
+  if (!ok) {
+    fmt::print(stderr, "Connecting to {} failed\n", options.host);
+    return -1;
+  }
+  generator.Report();
+  return 0;
+}
@@ -0,0 +1,146 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "frame_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+// PNG is big endian
+void PutU32(std::vector<uint8_t> &out, uint32_t value) {
+  out.insert(out.end(), {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8),
+                         uint8_t(value)});
+}
+} // namespace
+
+std::unique_ptr<FrameWriter> FrameWriter::Create(const std::string &filename,
+                                                 std::chrono::milliseconds interval) {
+  FILE *file = fopen(filename.c_str(), "wb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  const std::string &png = ".png";
+  if (filename.size() >= png.size() &&
+      filename.compare(filename.size() - png.size(), png.size(), png) == 0) {
+    return std::make_unique<PngWriter>(file, interval);
+  }
+  return std::make_unique<RawWriter>(file);
+}
+
+RawWriter::~RawWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+void RawWriter::Write(std::chrono::nanoseconds time, const ws2811_led_t *leds,
+                      std::size_t count) {
+  const int64_t ns = time.count();
+  const uint32_t n = count;
+  fwrite(&ns, sizeof(ns), 1, file_);
+  fwrite(&n, sizeof(n), 1, file_);
+  fwrite(leds, sizeof(ws2811_led_t), count, file_);
+}
+
+bool RawWriter::Close(std::chrono::nanoseconds end) {
+  const bool ok = ferror(file_) == 0;
+  fclose(file_);
+  file_ = nullptr;
+  return ok;
+}
+
+PngWriter::~PngWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+void PngWriter::Write(std::chrono::nanoseconds time, const ws2811_led_t *leds,
+                      std::size_t count) {
+  AddRows(time);
+
+  // the first frame sets the width of the image
+  if (width_ == 0) {
+    width_ = count;
+    shown_.assign(width_ * 3, 0);
+  }
+  const std::size_t n = std::min(count, width_);
+  for (std::size_t i = 0; i < n; ++i) {
+    const uint32_t w = leds[i] >> 24;
+    shown_[i * 3 + 0] = std::min<uint32_t>(((leds[i] >> 16) & 0xFF) + w, 255);
+    shown_[i * 3 + 1] = std::min<uint32_t>(((leds[i] >> 8) & 0xFF) + w, 255);
+    shown_[i * 3 + 2] = std::min<uint32_t>((leds[i] & 0xFF) + w, 255);
+  }
+  std::fill(shown_.begin() + n * 3, shown_.end(), 0);
+}
+
+void PngWriter::AddRows(std::chrono::nanoseconds until) {
+  while (width_ != 0 && next_row_ <= until) {
+    // filter type 0 (none)
+    rows_.push_back(0);
+    rows_.insert(rows_.end(), shown_.begin(), shown_.end());
+    height_++;
+    next_row_ += interval_;
+  }
+}
+
+void PngWriter::WriteChunk(const char *type, const std::vector<uint8_t> &data) {
+  // length, type, data and the CRC of type and data
+  std::vector<uint8_t> chunk;
+  PutU32(chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  PutU32(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+  fwrite(chunk.data(), 1, chunk.size(), file_);
+}
+
+bool PngWriter::Close(std::chrono::nanoseconds end) {
+  AddRows(end);
+  if (height_ == 0) {
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+
+  static constexpr uint8_t kSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fwrite(kSignature, 1, sizeof(kSignature), file_);
+
+  // 8 bit RGB, no interlace
+  std::vector<uint8_t> header;
+  PutU32(header, width_);
+  PutU32(header, height_);
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+  WriteChunk("IHDR", header);
+
+  uLongf size = compressBound(rows_.size());
+  std::vector<uint8_t> data(size);
+  if (compress2(data.data(), &size, rows_.data(), rows_.size(), Z_BEST_COMPRESSION) != Z_OK) {
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  data.resize(size);
+  WriteChunk("IDAT", data);
+  WriteChunk("IEND", {});
+
+  const bool ok = ferror(file_) == 0;
+  fclose(file_);
+  file_ = nullptr;
+  return ok;
+}
@@ -0,0 +1,85 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef RENDER_FRAME_WRITER_HPP
+#define RENDER_FRAME_WRITER_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+/**
+ * @brief Output of the rendered frames to a file
+ *
+ * `.png` files get an image of the strip over time: one row per sample interval showing the
+ * frame at that time, white added to red, green and blue. Any other file gets all frames raw,
+ * each as int64 time in ns since start, uint32 LED count and the LEDs as uint32 0xWWRRGGBB, all
+ * in host byte order.
+ */
+class FrameWriter {
+public:
+  virtual ~FrameWriter() = default;
+
+  /** @brief Create the writer for the file's type, nullptr on failure */
+  static std::unique_ptr<FrameWriter> Create(const std::string &filename,
+                                             std::chrono::milliseconds interval);
+
+  virtual void Write(std::chrono::nanoseconds time, const ws2811_led_t *leds,
+                     std::size_t count) = 0;
+  /** @brief Finish the file at the end time */
+  virtual bool Close(std::chrono::nanoseconds end) = 0;
+};
+
+class RawWriter : public FrameWriter {
+public:
+  explicit RawWriter(FILE *file) : file_(file) {}
+  ~RawWriter() override;
+
+  void Write(std::chrono::nanoseconds time, const ws2811_led_t *leds, std::size_t count) override;
+  bool Close(std::chrono::nanoseconds end) override;
+
+private:
+  FILE *file_;
+};
+
+class PngWriter : public FrameWriter {
+public:
+  PngWriter(FILE *file, std::chrono::milliseconds interval) : file_(file), interval_(interval) {}
+  ~PngWriter() override;
+
+  void Write(std::chrono::nanoseconds time, const ws2811_led_t *leds, std::size_t count) override;
+  bool Close(std::chrono::nanoseconds end) override;
+
+private:
+  void AddRows(std::chrono::nanoseconds until);
+  void WriteChunk(const char *type, const std::vector<uint8_t> &data);
+
+  FILE *file_;
+  const std::chrono::milliseconds interval_;
+  std::chrono::nanoseconds next_row_{0};
+  // the frame shown since the last write, as RGB
+  std::vector<uint8_t> shown_;
+  std::size_t width_{0};
+  // rows with their filter byte, as the image data before compression
+  std::vector<uint8_t> rows_;
+  std::size_t height_{0};
+};
+
+#endif // RENDER_FRAME_WRITER_HPP
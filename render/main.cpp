@@ -0,0 +1,142 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include <chrono>
+#include <ctime>
+#include <fmt/format.h>
+#include <unistd.h>
+
+#include "frame_writer.hpp"
+#include "log.hpp"
+#include "renderer.hpp"
+
+namespace {
+void Usage(const char *name) {
+  fmt::print(stderr,
+             "Usage: {} [options] output.png|output.raw\n"
+             "  -c dir       configuration to start from\n"
+             "  -t time      local time at the start, \"YYYY-MM-DD HH:MM:SS\"\n"
+             "  -d seconds   duration (default 60)\n"
+             "  -n count     LED count\n"
+             "  -a name      play the animation with that name or hash\n"
+             "  -A dir       directory of the animations (default /home/pi)\n"
+             "  -l r,g,b     switch on the light with that color\n"
+             "  -T minutes   switch off by the timeout after that time\n"
+             "  -f seconds   fade out time of the timeout (default 100)\n"
+             "  -e easing    easing of the fade: linear, exponential, perceptual\n"
+             "  -i ms        time per row of a PNG (default 100)\n"
+             "  -s us        step of the virtual time (default 1000)\n"
+             "  -v           log debug messages\n",
+             name);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  Renderer::options_t options;
+  std::chrono::milliseconds interval{100};
+  Log::SetLevel(Log::kError);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:t:d:n:a:A:l:T:f:e:i:s:v")) != -1) {
+    switch (opt) {
+    case 'c':
+      options.config_path = optarg;
+      break;
+    case 't': {
+      tm local{};
+      local.tm_isdst = -1;
+      if (strptime(optarg, "%Y-%m-%d %H:%M:%S", &local) == nullptr) {
+        fmt::print(stderr, "Invalid time {}\n", optarg);
+        return -1;
+      }
+      options.start = std::chrono::system_clock::from_time_t(mktime(&local));
+      break;
+    }
+    case 'd':
+      options.duration = std::chrono::seconds(std::atoi(optarg));
+      break;
+    case 'n':
+      options.led_count = std::atoi(optarg);
+      break;
+    case 'a':
+      options.animation = optarg;
+      break;
+    case 'A':
+      options.animation_path = optarg;
+      break;
+    case 'l': {
+      int red = 0;
+      int green = 0;
+      int blue = 0;
+      if (sscanf(optarg, "%d,%d,%d", &red, &green, &blue) != 3) {
+        fmt::print(stderr, "Invalid color {}\n", optarg);
+        return -1;
+      }
+      options.color = {uint8_t(red), uint8_t(green), uint8_t(blue)};
+      break;
+    }
+    case 'T':
+      options.timeout = std::chrono::minutes(std::atoi(optarg));
+      break;
+    case 'f':
+      options.fade = std::chrono::seconds(std::atoi(optarg));
+      break;
+    case 'e':
+      if (!fade_t::FromString(optarg, options.easing)) {
+        fmt::print(stderr, "Invalid easing {}\n", optarg);
+        return -1;
+      }
+      break;
+    case 'i':
+      interval = std::chrono::milliseconds(std::atoi(optarg));
+      break;
+    case 's':
+      options.step = std::chrono::microseconds(std::atoi(optarg));
+      break;
+    case 'v':
+      Log::SetLevel(Log::kDebug);
+      break;
+    default:
+      Usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind != argc - 1 || interval.count() <= 0 || options.step.count() <= 0) {
+    Usage(argv[0]);
+    return -1;
+  }
+
+  const std::unique_ptr<FrameWriter> &writer = FrameWriter::Create(argv[optind], interval);
+  if (!writer) {
+    fmt::print(stderr, "Can't open {}\n", argv[optind]);
+    return -1;
+  }
+
+  Renderer renderer(options, *writer);
+  const bool ok = renderer.Run();
+  Log::Flush();
+  if (!ok) {
+    fmt::print(stderr, "Rendering failed\n");
+    return -1;
+  }
+
+  const double seconds = renderer.GetElapsed().count();
+  fmt::print("{} frames of {} s in {:.2f} s: {:.0f} fps, {:.0f}x real time\n",
+             renderer.GetFrames(), options.duration.count(), seconds,
+             renderer.GetFrames() / seconds, options.duration.count() / seconds);
+  return 0;
+}
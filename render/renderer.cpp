@@ -0,0 +1,151 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "renderer.hpp"
+
+#include <asio.hpp>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <unistd.h>
+
+#include "alarm.hpp"
+#include "animation.hpp"
+#include "clock.hpp"
+#include "fadeout.hpp"
+#include "frame_writer.hpp"
+#include "light.hpp"
+#include "power.hpp"
+#include "ws2811_control.hpp"
+
+Renderer::Renderer(const options_t &options, FrameWriter &writer)
+    : Log("render"), options_(options), writer_(writer) {}
+
+Renderer::~Renderer() {}
+
+bool Renderer::Run() {
+  // the modules write their state, they get a copy of the configuration
+  const std::filesystem::path &dir =
+      std::filesystem::temp_directory_path() / fmt::format("ledcontrol_render_{}", getpid());
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  if (!options_.config_path.empty()) {
+    std::filesystem::copy(options_.config_path, dir, std::filesystem::copy_options::recursive);
+  }
+
+  nlohmann::json cfg = nlohmann::json::object();
+  if (std::filesystem::exists(dir / "ws2811.json")) {
+    std::ifstream(dir / "ws2811.json") >> cfg;
+  }
+  cfg["backend"] = "simulated";
+  if (options_.led_count > 0) {
+    cfg.erase("led_count");
+    cfg["channels"] = {{{"led_count", options_.led_count}}};
+  }
+  std::ofstream(dir / "ws2811.json") << cfg;
+
+  const bool ok = Render(dir.string() + "/");
+  std::filesystem::remove_all(dir);
+  return ok;
+}
+
+bool Renderer::Render(const std::string &config_path) {
+  // before any module is created, so all of them see the virtual time only
+  Clock::StartVirtual(options_.start);
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + options_.duration;
+
+  asio::io_context io;
+  auto work = asio::make_work_guard(io);
+  WS2811Control ws2811_control(config_path);
+  Power power(config_path, io, ws2811_control);
+  Fadeout fadeout(config_path, io, power);
+  Light light(config_path, power);
+  Animation animation(io, power, options_.animation_path);
+  Alarm alarm(config_path, io, power, animation);
+
+  // the driver scales by the brightness, the file shows what the LEDs show
+  std::vector<ws2811_led_t> shown;
+  ws2811_control.SigRendered.connect([&](const frame_t &frame, uint8_t brightness) {
+    const std::size_t count = ws2811_control.GetLedCount();
+    const uint32_t scale = brightness + 1;
+    shown.assign(count, 0);
+    for (std::size_t i = 0; i < std::min(frame.size, count); ++i) {
+      const uint32_t led = frame.data[i];
+      shown[i] = ((((led >> 24) & 0xFF) * scale) >> 8) << 24 |
+                 ((((led >> 16) & 0xFF) * scale) >> 8) << 16 |
+                 ((((led >> 8) & 0xFF) * scale) >> 8) << 8 | (((led & 0xFF) * scale) >> 8);
+    }
+    writer_.Write(Clock::now() - start, shown.data(), count);
+    frames_++;
+  });
+
+  Power::channel_e channel = Power::kNone;
+  if (!options_.animation.empty()) {
+    std::string hash;
+    for (const nlohmann::json &info : animation.GetAnimationInfo()) {
+      if (info["name"] == options_.animation || info["hash"] == options_.animation) {
+        hash = info["hash"];
+      }
+    }
+    if (hash.empty()) {
+      E("Unknown animation {}", options_.animation);
+      return false;
+    }
+    animation.SetAnimation(hash);
+    channel = Power::kAnimation;
+  }
+  if (options_.color) {
+    const auto &[red, green, blue] = *options_.color;
+    light.SetColor(red, green, blue);
+    channel = Power::kLight;
+  }
+  if (channel != Power::kNone) {
+    power.SetChannelState(channel, true);
+  }
+  if (options_.timeout && channel != Power::kNone) {
+    if (!fadeout.SetFade(options_.fade, options_.easing)) {
+      return false;
+    }
+    fadeout.SetTimeout(Power::GetChannelName(channel), *options_.timeout);
+  }
+
+  const auto &real_start = std::chrono::steady_clock::now();
+  while (true) {
+    while (io.poll() != 0) {
+    }
+    // the virtual time waits for decoding, e.g. of an alarm's animation
+    if (animation.GetLoadPending()) {
+      io.run_one();
+      continue;
+    }
+    if (Clock::now() >= end) {
+      break;
+    }
+    Clock::Advance(options_.step);
+  }
+  elapsed_ = std::chrono::steady_clock::now() - real_start;
+
+  alarm.Stop();
+  animation.Stop();
+  fadeout.Stop();
+  work.reset();
+  io.poll();
+
+  return writer_.Close(end - start);
+}
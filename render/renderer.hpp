@@ -0,0 +1,80 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef RENDER_RENDERER_HPP
+#define RENDER_RENDERER_HPP
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include "animation.hpp"
+#include "fade.hpp"
+#include "log.hpp"
+
+class FrameWriter;
+
+/**
+ * @brief Run the output pipeline headless in virtual time
+ *
+ * Power, Light, Animation, Alarm and Fadeout run on the simulated driver with the virtual time
+ * of Clock. The time is advanced in fixed steps as fast as the CPU allows, each step runs all
+ * handlers due. Decoding an animation takes real time, the virtual time stands still meanwhile,
+ * so the output depends on the options and the configuration only.
+ */
+class Renderer : public Log {
+public:
+  struct options_t {
+    // configuration to start from, it is copied and not changed
+    std::string config_path;
+    // local wall time at the start, e.g. some minutes before an alarm
+    std::chrono::system_clock::time_point start{std::chrono::system_clock::now()};
+    std::chrono::seconds duration{60};
+    std::chrono::microseconds step{1000};
+    // 0 keeps the LED count of the configuration
+    int led_count{0};
+    // name or hash of an animation to play
+    std::string animation;
+    std::string animation_path{Animation::kAnimationPath};
+    // switch the light on with that color
+    std::optional<std::array<uint8_t, 3>> color;
+    // fade out the channel switched on after that time
+    std::optional<std::chrono::minutes> timeout;
+    std::chrono::seconds fade{100};
+    fade_t::easing_e easing{fade_t::easing_e::perceptual};
+  };
+
+  Renderer(const options_t &options, FrameWriter &writer);
+  virtual ~Renderer();
+
+  bool Run();
+
+  std::size_t GetFrames() const { return frames_; }
+  /** @brief Real time the rendering took */
+  std::chrono::duration<double> GetElapsed() const { return elapsed_; }
+
+private:
+  bool Render(const std::string &config_path);
+
+  const options_t options_;
+  FrameWriter &writer_;
+  std::size_t frames_{0};
+  std::chrono::duration<double> elapsed_{0};
+};
+
+#endif // RENDER_RENDERER_HPP
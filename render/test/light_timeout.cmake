@@ -0,0 +1,31 @@
+# Render the light switched off by the timeout in virtual time and compare the raw output with
+# the reference hash. Called by ctest, -DUPDATE=ON writes the hash of the current output instead.
+#
+#   cmake -DRENDER=ledcontrol_render -DWORK_DIR=dir -DREFERENCE=hash_file -P light_timeout.cmake
+
+file(REMOVE_RECURSE ${WORK_DIR})
+# no animations, the result must not depend on the files of the host
+file(MAKE_DIRECTORY ${WORK_DIR}/animations)
+set(OUTPUT ${WORK_DIR}/light_timeout.raw)
+
+# light on, timeout after 1 minute with a 30 s fade, 10 s beyond it
+execute_process(
+    COMMAND ${RENDER} -n 16 -A ${WORK_DIR}/animations -t "2024-01-01 12:00:00"
+            -l 255,128,0 -T 1 -f 30 -d 70 -s 10000 ${OUTPUT}
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "ledcontrol_render failed: ${result}")
+endif()
+
+file(SHA256 ${OUTPUT} hash)
+if(UPDATE)
+    file(WRITE ${REFERENCE} "${hash}\n")
+    return()
+endif()
+
+file(STRINGS ${REFERENCE} reference LIMIT_COUNT 1)
+if(NOT hash STREQUAL reference)
+    message(FATAL_ERROR "Output ${OUTPUT} differs from the reference\n"
+                        "  expected ${reference}\n  got      ${hash}")
+endif()
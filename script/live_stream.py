@@ -0,0 +1,41 @@
+#!/usr/bin/python3
+# Send a moving rainbow to the live stream port of ledcontrol.
+#
+#   ./live_stream.py [host] [fps] [led count]
+#
+# Switch on the live channel first with {"cmd":"set_power_live","power":true}.
+import colorsys
+import socket
+import struct
+import sys
+import time
+
+host = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+fps = float(sys.argv[2]) if len(sys.argv) > 2 else 60.0
+leds = int(sys.argv[3]) if len(sys.argv) > 3 else 300
+port = 7757
+
+VERSION1 = 0x40
+PUSH = 0x01
+RGB = 0
+PIXELS_PER_PACKET = 480
+
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+seq = 0
+start = time.monotonic()
+while True:
+    t = time.monotonic() - start
+    frame = bytearray()
+    for i in range(leds):
+        r, g, b = colorsys.hsv_to_rgb((i / leds + t / 5) % 1.0, 1.0, 0.5)
+        frame += bytes((int(r * 255), int(g * 255), int(b * 255)))
+
+    seq = (seq + 1) & 0xFFFF
+    for offset in range(0, leds, PIXELS_PER_PACKET):
+        payload = frame[offset * 3:(offset + PIXELS_PER_PACKET) * 3]
+        last = offset + PIXELS_PER_PACKET >= leds
+        header = struct.pack(">BBHIH", VERSION1 | (PUSH if last else 0), RGB, seq, offset, len(payload))
+        sock.sendto(header + payload, (host, port))
+
+    time.sleep(1.0 / fps)
@@ -0,0 +1,43 @@
+#!/usr/bin/python3
+# Write a moving dot into the shared framebuffer of ledcontrol.
+#
+#   ./shm_producer.py [fps] [name]
+#
+# name is the segment of a daemon on another port, e.g. ledcontrol-7765.
+#
+# Switch on the channel first with {"cmd":"set_power_shm","power":true}.
+# The layout is documented in src/shared_frame.hpp.
+import mmap
+import struct
+import sys
+import time
+
+fps = float(sys.argv[1]) if len(sys.argv) > 1 else 60.0
+name = sys.argv[2] if len(sys.argv) > 2 else "ledcontrol"
+
+with open("/dev/shm/" + name, "r+b") as fid:
+    shm = mmap.mmap(fid.fileno(), 0)
+
+magic, version, buffer_count, led_count, header_size = struct.unpack_from("<IHHII", shm, 0)
+if magic != 0x4C454446 or version != 1:
+    sys.exit("shared framebuffer not initialized")
+
+OFFSET_LATEST = 16
+OFFSET_READING = 20
+frame_size = led_count * 4
+
+counter = struct.unpack_from("<I", shm, OFFSET_LATEST)[0] >> 2
+while True:
+    latest = struct.unpack_from("<I", shm, OFFSET_LATEST)[0] & 0x03
+    reading = struct.unpack_from("<I", shm, OFFSET_READING)[0] & 0x03
+    # write into a buffer neither published nor in use by the daemon
+    index = next(i for i in range(buffer_count) if i != latest and i != reading)
+
+    counter += 1
+    frame = [0] * led_count
+    frame[counter % led_count] = 0x00FF0000
+    struct.pack_into("<%dI" % led_count, shm, header_size + index * frame_size, *frame)
+
+    # publish
+    struct.pack_into("<I", shm, OFFSET_LATEST, (counter << 2 | index) & 0xFFFFFFFF)
+    time.sleep(1.0 / fps)
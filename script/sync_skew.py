@@ -0,0 +1,137 @@
+#!/usr/bin/python3
+# Measure the playback skew of two daemons synchronized over loopback.
+#
+#   ./sync_skew.py path/to/ledcontrol [animation] [seconds]
+#
+# Starts a leader and a follower with the simulated backend and their own
+# configuration, plays the animation (default Example) on the leader and polls
+# get_frame of both daemons. Each frame change seen on both sides is matched by
+# its contents, the skew is the difference of the times the daemons sent it to
+# the strip. Both run on the same host, so the times are of the same clock.
+import json
+import os
+import shutil
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+binary = sys.argv[1] if len(sys.argv) > 1 else "./ledcontrol"
+animation = sys.argv[2] if len(sys.argv) > 2 else "Example"
+seconds = float(sys.argv[3]) if len(sys.argv) > 3 else 10.0
+# away from the default ports of a daemon running on the device
+LEADER_PORT = 7775
+FOLLOWER_PORT = 7785
+WARMUP = 5.0
+# contents repeated within the animation don't pair with the same frame farther apart
+MAX_PAIR_NS = 1e9
+
+
+class Client:
+    def __init__(self, port):
+        deadline = time.monotonic() + 5
+        while True:
+            try:
+                self.sock = socket.create_connection(("127.0.0.1", port + 1))
+                break
+            except ConnectionRefusedError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.1)
+        self.buffer = b""
+
+    def send(self, msg):
+        self.sock.sendall((json.dumps(msg) + "\n").encode())
+
+    def request(self, msg, rsp):
+        self.send(msg)
+        while True:
+            while b"\n" not in self.buffer:
+                self.buffer += self.sock.recv(1 << 20)
+            line, self.buffer = self.buffer.split(b"\n", 1)
+            answer = json.loads(line)
+            if answer.get("rsp") == rsp:
+                return answer
+
+
+def start(directory, port):
+    os.makedirs(directory)
+    with open(os.path.join(directory, "ws2811.json"), "w") as file:
+        json.dump({"backend": "simulated"}, file)
+    return subprocess.Popen([binary, "-c", directory + "/", "-p", str(port)],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def sample(client, changes, stop):
+    # only a frame seen right after its predecessor is known to be sent first at its time
+    last = None
+    while not stop.is_set():
+        msg = client.request({"cmd": "get_frame"}, "get_frame")
+        leds = tuple(msg["leds"])
+        if last is not None and msg["frame"] == last[0] + 1 and leds != last[1]:
+            changes.setdefault(leds, []).append(msg["time_ns"])
+        last = (msg["frame"], leds)
+
+
+def main():
+    root = tempfile.mkdtemp(prefix="sync_skew_")
+    daemons = [start(os.path.join(root, "leader"), LEADER_PORT),
+               start(os.path.join(root, "follower"), FOLLOWER_PORT)]
+    try:
+        leader = Client(LEADER_PORT)
+        follower = Client(FOLLOWER_PORT)
+
+        hashes = [a["hash"] for a in leader.request({"cmd": "get_animations"}, "get_animations")
+                  ["animations"] if a["name"] == animation or a["hash"] == animation]
+        if not hashes:
+            sys.exit(f"animation {animation} not found")
+        leader.request({"cmd": "set_sync", "role": "leader"}, "get_sync")
+        follower.request({"cmd": "set_sync", "role": "follower",
+                          "leader": f"127.0.0.1:{LEADER_PORT}"}, "get_sync")
+        leader.send({"cmd": "set_animation", "hash": hashes[0]})
+        leader.send({"cmd": "set_power_animation", "power": True})
+        time.sleep(WARMUP)
+
+        changes = ({}, {})
+        stop = threading.Event()
+        threads = [threading.Thread(target=sample, args=(client, side, stop))
+                   for client, side in zip((leader, follower), changes)]
+        for thread in threads:
+            thread.start()
+        time.sleep(seconds)
+        stop.set()
+        for thread in threads:
+            thread.join()
+
+        # a frame repeats with each loop, pair it with the closest change of the other side
+        skews = []
+        for leds, times in changes[0].items():
+            for t in times:
+                others = changes[1].get(leds, [])
+                if others:
+                    skew = min(others, key=lambda o: abs(o - t)) - t
+                    if abs(skew) < MAX_PAIR_NS:
+                        skews.append(skew)
+        if not skews:
+            sys.exit("no frame seen on both daemons, is the animation playing?")
+
+        skews_ms = sorted(s / 1e6 for s in skews)
+        absolute = sorted(abs(s) for s in skews_ms)
+        estimate = follower.request({"cmd": "get_sync"}, "get_sync").get("skew_ns", 0) / 1e6
+        print(f"frames matched   {len(skews_ms)}")
+        # positive if the follower is late
+        print(f"skew median      {statistics.median(skews_ms):+.3f} ms")
+        print(f"|skew| p95       {absolute[int(0.95 * (len(absolute) - 1))]:.3f} ms")
+        print(f"|skew| max       {absolute[-1]:.3f} ms")
+        print(f"follower's estimate {estimate:+.3f} ms")
+    finally:
+        for daemon in daemons:
+            daemon.terminate()
+            daemon.wait()
+        shutil.rmtree(root)
+
+
+main()
@@ -18,92 +18,401 @@
 #include "alarm.hpp"
 
 #include <fmt/format.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "animation.hpp"
 #include "power.hpp"
+#include "trace.hpp"
+
+void to_json(nlohmann::json &json, const Alarm::alarm_t &alarm) {
+  json["id"] = alarm.id;
+  json["name"] = alarm.name;
+  json["active"] = alarm.active;
+  json["hour"] = alarm.hour;
+  json["minute"] = alarm.minute;
+  json["days"] = alarm.days;
+  json["animation_hash"] = alarm.animation_hash;
+  json["fade_in"] = alarm.fade_in.count();
+  json["next"] = alarm.next;
+}
+
+void from_json(const nlohmann::json &json, Alarm::alarm_t &alarm) {
+  alarm.id = json.value("id", Alarm::kDefaultId);
+  alarm.name = json.value("name", "");
+  alarm.active = json.value("active", false);
+  alarm.hour = json.value("hour", -1);
+  alarm.minute = json.value("minute", -1);
+  alarm.days = json.value<std::set<int>>("days", std::set<int>());
+  alarm.animation_hash = json.value("animation_hash", "");
+  alarm.fade_in = std::chrono::seconds(json.value("fade_in", 0));
+  alarm.next = 0;
+}
 
 Alarm::Alarm(const std::string &config_path, asio::io_context &io, Power &power,
              Animation &animation)
-    : Log("alarm"), config_path_(config_path), timer_(io, std::chrono::seconds(1)), power_(power),
+    : Log("alarm"), config_path_(config_path), timer_(io), clock_watch_(io), power_(power),
       animation_(animation) {
-  timer_.async_wait([this](const asio::error_code &error) { OnTimeout(error); });
-
   restore_state_active_ = true;
   try {
     const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
-    alarm_.name = cfg.value("name", "");
-    alarm_.active = cfg.value("active", false);
-    alarm_.hour = cfg.value("hour", -1);
-    alarm_.minute = cfg.value("minute", -1);
-    alarm_.days = cfg.value<std::set<int>>("days", std::set<int>());
-    alarm_.animation_hash = cfg.value("animation_hash", "");
-
-    I("Restored alarm");
+    if (cfg.contains("alarms")) {
+      for (const auto &item : cfg["alarms"]) {
+        const alarm_t &alarm = item.get<alarm_t>();
+        alarms_[alarm.id].alarm = alarm;
+      }
+      next_id_ = cfg.value("next_id", next_id_);
+      preload_lead_ = std::chrono::seconds(cfg.value("preload_seconds", kDefaultPreloadSeconds));
+    } else if (!cfg.empty()) {
+      // config of the single alarm of former versions
+      alarm_t alarm = cfg.get<alarm_t>();
+      alarm.id = kDefaultId;
+      alarms_[kDefaultId].alarm = alarm;
+    }
+    if (!alarms_.empty()) {
+      next_id_ = std::max(next_id_, alarms_.rbegin()->first + 1);
+    }
+
+    I("Restored {} alarms", alarms_.size());
   } catch (const nlohmann::json::exception &e) {
-    E(fmt::format("Parsing config failed: {}", e.what()));
+    E("Parsing config failed: {}", e.what());
   }
   restore_state_active_ = false;
+
+  if (!WatchClock()) {
+    E("Watching the clock failed, steps of the wall clock are not noticed");
+  }
+  Reschedule();
 }
 Alarm::~Alarm() {}
 
 void Alarm::Stop() {
   is_alive_.store(false);
   timer_.cancel();
+  clock_watch_.close();
 }
 
 void Alarm::SaveState() {
-  nlohmann::json alarm;
-  alarm["name"] = alarm_.name;
-  alarm["active"] = alarm_.active;
-  alarm["hour"] = alarm_.hour;
-  alarm["minute"] = alarm_.minute;
-  alarm["days"] = alarm_.days;
-  alarm["animation_hash"] = alarm_.animation_hash;
+  nlohmann::json cfg;
+  cfg["next_id"] = next_id_;
+  cfg["preload_seconds"] = preload_lead_.count();
+  cfg["alarms"] = nlohmann::json::array();
+  for (const auto &[id, entry] : alarms_) {
+    nlohmann::json alarm = entry.alarm;
+    alarm.erase("next");
+    cfg["alarms"].push_back(alarm);
+  }
 
-  IModule::SaveState(config_path_, kConfigFile, alarm);
+  IModule::SaveState(config_path_, kConfigFile, cfg);
 }
 
 void Alarm::SetAlarm(const alarm_t &alarm) {
-  alarm_ = alarm;
+  entry_t &entry = alarms_[kDefaultId];
+  entry.alarm = alarm;
+  entry.alarm.id = kDefaultId;
+  Schedule(entry, clock::now());
+  Rearm();
   SaveState();
+  SigAlarmChanged();
+}
+
+Alarm::alarm_t Alarm::GetAlarm() const {
+  auto it = alarms_.find(kDefaultId);
+  return it == alarms_.end() ? alarm_t() : it->second.alarm;
+}
+
+uint32_t Alarm::AddAlarm(const alarm_t &alarm) {
+  const uint32_t id = next_id_++;
+  entry_t &entry = alarms_[id];
+  entry.alarm = alarm;
+  entry.alarm.id = id;
+  Schedule(entry, clock::now());
+  Rearm();
+  SaveState();
+  SigAlarmChanged();
+  return id;
+}
+
+bool Alarm::RemoveAlarm(uint32_t id) {
+  // queued occurrences are dropped when they show up without an entry
+  auto it = alarms_.find(id);
+  if (it == alarms_.end()) {
+    return false;
+  }
+  Unpin(it->second);
+  alarms_.erase(it);
+  Rearm();
+  SaveState();
+  SigAlarmChanged();
+  return true;
+}
+
+std::vector<Alarm::alarm_t> Alarm::GetAlarms() const {
+  std::vector<alarm_t> alarms;
+  alarms.reserve(alarms_.size());
+  for (const auto &[id, entry] : alarms_) {
+    alarms.push_back(entry.alarm);
+  }
+  return alarms;
+}
+
+std::optional<Alarm::clock::time_point> Alarm::GetNextOccurrence(const alarm_t &alarm,
+                                                                  clock::time_point after) {
+  if (alarm.hour < 0 || alarm.hour > 23 || alarm.minute < 0 || alarm.minute > 59 ||
+      alarm.days.empty()) {
+    return std::nullopt;
+  }
+
+  const time_t tt_after = clock::to_time_t(after);
+  tm local_tm_after;
+  localtime_r(&tt_after, &local_tm_after);
+
+  // today and the next 7 days cover all weekdays and a today's time that has passed already
+  for (int day = 0; day <= 7; day++) {
+    tm local_tm = local_tm_after;
+    local_tm.tm_mday += day;
+    local_tm.tm_hour = alarm.hour;
+    local_tm.tm_min = alarm.minute;
+    local_tm.tm_sec = 0;
+    // let mktime() find out if DST applies on that day, it normalizes the date and the weekday
+    local_tm.tm_isdst = -1;
+    const time_t tt = mktime(&local_tm);
+    if (tt == -1) {
+      continue;
+    }
+
+    const clock::time_point &time = clock::from_time_t(tt);
+    if (time > after && alarm.days.count(local_tm.tm_wday)) {
+      return time;
+    }
+  }
+  return std::nullopt;
+}
+
+long Alarm::GetUtcOffset(clock::time_point time) {
+  const time_t tt = clock::to_time_t(time);
+  tm local_tm;
+  localtime_r(&tt, &local_tm);
+  return local_tm.tm_gmtoff;
+}
+
+std::optional<Alarm::clock::time_point> Alarm::GetUtcOffsetChange(clock::time_point after) {
+  // offsets change at most a few times a year, find the day and bisect it to the second
+  const long offset = GetUtcOffset(after);
+  clock::time_point lower = after;
+  clock::time_point upper = after;
+  while (GetUtcOffset(upper) == offset) {
+    lower = upper;
+    upper += std::chrono::hours(24);
+    if (upper - after > kUtcOffsetSearch) {
+      return std::nullopt;
+    }
+  }
+  while (upper - lower > std::chrono::seconds(1)) {
+    const clock::time_point &middle = lower + (upper - lower) / 2;
+    if (GetUtcOffset(middle) == offset) {
+      lower = middle;
+    } else {
+      upper = middle;
+    }
+  }
+  return upper;
+}
+
+void Alarm::Unpin(entry_t &entry) {
+  if (!entry.preloaded.empty()) {
+    animation_.Release(entry.preloaded);
+    entry.preloaded.clear();
+  }
+}
+
+void Alarm::Schedule(entry_t &entry, clock::time_point after) {
+  Unpin(entry);
+  entry.generation++;
+  entry.alarm.next = 0;
+  if (!entry.alarm.active) {
+    return;
+  }
+
+  const std::optional<clock::time_point> &next = GetNextOccurrence(entry.alarm, after);
+  if (!next) {
+    return;
+  }
+  entry.alarm.next = clock::to_time_t(*next);
+  if (preload_lead_.count() > 0 && !entry.alarm.animation_hash.empty()) {
+    queue_.push({*next - preload_lead_, entry.alarm.id, entry.generation, true});
+  }
+  queue_.push({*next, entry.alarm.id, entry.generation, false});
+}
+
+void Alarm::Reschedule() {
+  // pick up changes of /etc/localtime or TZ
+  tzset();
+
+  const clock::time_point &now = clock::now();
+  utc_offset_ = GetUtcOffset(now);
+  utc_offset_change_ = GetUtcOffsetChange(now);
+  queue_ = decltype(queue_)();
+  for (auto &[id, entry] : alarms_) {
+    Schedule(entry, now);
+  }
+  Rearm();
+}
+
+void Alarm::Rearm() {
+  // drop stale occurrences from the top, so the timer is armed for a valid one
+  while (!queue_.empty()) {
+    const occurrence_t &top = queue_.top();
+    auto it = alarms_.find(top.id);
+    if (it != alarms_.end() && it->second.generation == top.generation) {
+      break;
+    }
+    queue_.pop();
+  }
+
+  // stale occurrences deeper in the queue pile up if alarms are changed a lot
+  if (queue_.size() > 4 * alarms_.size() + 16) {
+    std::vector<occurrence_t> valid;
+    while (!queue_.empty()) {
+      const occurrence_t &occurrence = queue_.top();
+      auto it = alarms_.find(occurrence.id);
+      if (it != alarms_.end() && it->second.generation == occurrence.generation) {
+        valid.push_back(occurrence);
+      }
+      queue_.pop();
+    }
+    queue_ = decltype(queue_)(std::greater<occurrence_t>(), std::move(valid));
+  }
+
+  scheduled_gauge_.Set(queue_.size());
+
+  if (!is_alive_.load()) {
+    return;
+  }
+
+  // without anything to wait for the timer stays idle
+  timer_.cancel();
+  std::optional<clock::time_point> wakeup = utc_offset_change_;
+  if (!queue_.empty()) {
+    wakeup = wakeup ? std::min(queue_.top().time, *wakeup) : queue_.top().time;
+  }
+  if (!wakeup) {
+    return;
+  }
+  timer_.expires_at(*wakeup);
+  timer_.async_wait(
+      Trace::Wrap("Alarm::OnTimeout", [this](const asio::error_code &error) { OnTimeout(error); }));
+}
+
+bool Alarm::WatchClock() {
+  const int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    E("timerfd_create failed: {}", strerror(errno));
+    return false;
+  }
+  clock_watch_.assign(fd);
+
+  // reads fail with ECANCELED once the clock is set, the expiry a year ahead just re-arms it
+  itimerspec spec{};
+  spec.it_value.tv_sec = std::time(nullptr) + 365 * 24 * 3600;
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr) != 0) {
+    E("timerfd_settime failed: {}", strerror(errno));
+    clock_watch_.close();
+    return false;
+  }
+
+  clock_watch_.async_wait(asio::posix::stream_descriptor::wait_read,
+                          Trace::Wrap("Alarm::OnClockChanged",
+                                      [this](const asio::error_code &error) {
+                                        OnClockChanged(error);
+                                      }));
+  return true;
+}
+
+void Alarm::OnClockChanged(const asio::error_code &error) {
+  if (error || !is_alive_.load()) {
+    return;
+  }
+
+  uint64_t expirations = 0;
+  if (read(clock_watch_.native_handle(), &expirations, sizeof(expirations)) < 0 &&
+      errno == ECANCELED) {
+    I("Wall clock was set, reschedule alarms");
+    Reschedule();
+  }
+
+  // the cancellation is sticky until the timer is set again
+  clock_watch_.close();
+  if (!WatchClock()) {
+    E("Watching the clock failed, steps of the wall clock are not noticed");
+  }
+}
+
+void Alarm::Trigger(const alarm_t &alarm) {
+  I("Trigger alarm {} \"{}\"", alarm.id, alarm.name);
+  triggered_total_.Inc();
+  Metrics::ScopedTimer timer(trigger_seconds_);
+  animation_.SetAnimation(alarm.animation_hash);
+  power_.SetChannelState(Power::kAnimation, true);
+  if (alarm.fade_in.count() != 0) {
+    fade_t fade;
+    fade.from = 0.0F;
+    fade.to = 1.0F;
+    fade.duration = alarm.fade_in;
+    power_.GetCompositor().StartFade(fade);
+  }
 }
 
 void Alarm::OnTimeout(const asio::error_code &error) {
   if (error) {
-    E(fmt::format("Timer failed with {}", error.message()));
+    // re-arming the timer cancels the pending wait
+    if (error != asio::error::operation_aborted) {
+      E("Timer failed with {}", error.message());
+    }
+    return;
   }
 
   if (!is_alive_.load()) {
     return;
   }
 
-  using namespace std::chrono;
-
-  // system clock as now
-  const time_point<system_clock> &now = system_clock::now();
-  // now as seconds since epoche
-  const time_t &tt_now = system_clock::to_time_t(now);
-  // now as good old time structure
-  const tm &local_tm_now = *localtime(&tt_now);
+  const clock::time_point &now = clock::now();
+  if (GetUtcOffset(now) != utc_offset_) {
+    I("UTC offset changed, reschedule alarms");
+    Reschedule();
+  }
 
-  // truncate to past round 5 minutes
-  tm local_tm_past = local_tm_now;
-  local_tm_past.tm_min = (local_tm_now.tm_min / 5) * 5;
-  local_tm_past.tm_sec = 0;
+  bool changed = false;
+  while (!queue_.empty() && queue_.top().time <= now) {
+    const occurrence_t occurrence = queue_.top();
+    queue_.pop();
 
-  // get seconds since epoche for the next round five minutes in the future
-  time_t tt_next = mktime(&local_tm_past) + 300;
+    auto it = alarms_.find(occurrence.id);
+    if (it == alarms_.end() || it->second.generation != occurrence.generation) {
+      continue;
+    }
 
-  // set new expiry time relative to timer expiry
-  timer_.expires_at(timer_.expiry() + seconds(tt_next - tt_now));
-  timer_.async_wait([this](const asio::error_code &error) { OnTimeout(error); });
+    entry_t &entry = it->second;
+    if (occurrence.preload) {
+      // a late preload still saves time at the trigger, no need to check for a clock step
+      entry.preloaded = entry.alarm.animation_hash;
+      animation_.Preload(entry.preloaded);
+      continue;
+    }
 
-  if (alarm_.active) {
-    if (alarm_.hour == local_tm_now.tm_hour && alarm_.minute == local_tm_now.tm_min &&
-        alarm_.days.count(local_tm_now.tm_wday)) {
-      I("Trigger alarm");
-      animation_.SetAnimation(alarm_.animation_hash);
-      power_.SetChannelState(Power::kAnimation, true);
+    if (now - occurrence.time <= kMissedLimit) {
+      lateness_seconds_.Observe(now - occurrence.time);
+      Trigger(entry.alarm);
+    } else {
+      I("Skip missed alarm {} \"{}\"", entry.alarm.id, entry.alarm.name);
+      missed_total_.Inc();
     }
+    Schedule(entry, now);
+    changed = true;
+  }
+
+  Rearm();
+  if (changed) {
+    SigAlarmChanged();
   }
 }
@@ -19,47 +19,143 @@
 #define SRC_ALARM_HPP
 
 #include <asio.hpp>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <queue>
 #include <set>
+#include <sigslot/signal.hpp>
+#include <vector>
 
+#include "clock.hpp"
 #include "i_module.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 
 class Power;
 class Animation;
 
+/**
+ * @brief Scheduler for any number of alarms
+ *
+ * The next occurrence of each active alarm is computed once in local time (DST aware) and
+ * queued. A single system timer is armed for the earliest entry or the next change of the UTC
+ * offset (DST). Steps of the wall clock are notified by a timerfd, so the scheduler does not
+ * wake up in between. The alarm's animation is preloaded a lead time ahead, so triggering does
+ * not wait for the file to be decoded. The alarm set by the legacy `set_alarm` command is the one
+ * with id kDefaultId.
+ */
 class Alarm : public Log, public IModule {
 public:
   Alarm(const std::string &config_path, asio::io_context &io, Power &power, Animation &animation);
   virtual ~Alarm();
 
+  static constexpr uint32_t kDefaultId = 0;
+
   struct alarm_t {
+    uint32_t id{kDefaultId};
     std::string name;
     bool active{false};
     int32_t hour{-1};
     int32_t minute{-1};
     std::set<int> days;
     std::string animation_hash;
+    // fade the brightness in from off when triggered, 0 to switch on at once
+    std::chrono::seconds fade_in{0};
+    // next occurrence in seconds since epoch, 0 if there is none
+    std::time_t next{0};
   };
 
+  /** @brief Replace the alarm with id kDefaultId */
   void SetAlarm(const alarm_t &alarm);
+  /** @brief Get the alarm with id kDefaultId */
+  alarm_t GetAlarm() const;
 
-  alarm_t GetAlarm() const { return alarm_; }
+  /** @brief Add an alarm and return its new id */
+  uint32_t AddAlarm(const alarm_t &alarm);
+  /** @brief Remove an alarm, returns false if there is none with that id */
+  bool RemoveAlarm(uint32_t id);
+  /** @brief Get all alarms ordered by id */
+  std::vector<alarm_t> GetAlarms() const;
 
   void Stop();
 
+  sigslot::signal_st<> SigAlarmChanged;
+
 private:
+  using clock = SystemClock;
+
   static constexpr const char *kConfigFile = "alarm.json";
+  // range searched for the next change of the UTC offset
+  static constexpr auto kUtcOffsetSearch = std::chrono::hours(24 * 400);
+  // occurrences more late than that are skipped instead of triggered
+  static constexpr auto kMissedLimit = std::chrono::minutes(1);
+  static constexpr int kDefaultPreloadSeconds = 120;
+
+  struct entry_t {
+    alarm_t alarm;
+    // bumped on every change, queued occurrences of older generations are stale
+    uint32_t generation{0};
+    // hash of the animation preloaded for the next occurrence
+    std::string preloaded;
+  };
+
+  struct occurrence_t {
+    clock::time_point time;
+    uint32_t id;
+    uint32_t generation;
+    bool preload;
+    bool operator>(const occurrence_t &other) const { return time > other.time; }
+  };
+
+  static std::optional<clock::time_point> GetNextOccurrence(const alarm_t &alarm,
+                                                            clock::time_point after);
+  static long GetUtcOffset(clock::time_point time);
+  static std::optional<clock::time_point> GetUtcOffsetChange(clock::time_point after);
+
   void SaveState() override;
+  void Schedule(entry_t &entry, clock::time_point after);
+  void Unpin(entry_t &entry);
+  void Reschedule();
+  void Rearm();
+  void Trigger(const alarm_t &alarm);
   void OnTimeout(const asio::error_code &error);
+  bool WatchClock();
+  void OnClockChanged(const asio::error_code &error);
 
   const std::string config_path_;
-  asio::steady_timer timer_;
+  SystemTimer timer_;
+  // timerfd which is canceled when the wall clock is set (e.g. NTP sync after boot)
+  asio::posix::stream_descriptor clock_watch_;
   Power &power_;
   Animation &animation_;
 
-  alarm_t alarm_;
+  std::map<uint32_t, entry_t> alarms_;
+  std::priority_queue<occurrence_t, std::vector<occurrence_t>, std::greater<occurrence_t>> queue_;
+  uint32_t next_id_{kDefaultId + 1};
+  std::chrono::seconds preload_lead_{kDefaultPreloadSeconds};
+  // UTC offset the queue was computed with, a change (e.g. new timezone) needs a reschedule
+  long utc_offset_{0};
+  std::optional<clock::time_point> utc_offset_change_;
+
+  Metrics::Counter &triggered_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_alarm_triggered_total", "Alarms triggered")};
+  Metrics::Counter &missed_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_alarm_missed_total", "Alarm occurrences skipped because of a clock step")};
+  Metrics::Histogram &lateness_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_alarm_lateness_seconds", "Delay of the alarm trigger behind the alarm time")};
+  Metrics::Histogram &trigger_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_alarm_trigger_seconds", "Time to switch to the alarm animation")};
+  Metrics::Gauge &scheduled_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_alarm_scheduled", "Queued alarm occurrences")};
 
   std::atomic_bool is_alive_{true};
 };
 
+void to_json(nlohmann::json &json, const Alarm::alarm_t &alarm);
+void from_json(const nlohmann::json &json, Alarm::alarm_t &alarm);
+
 #endif // SRC_ALARM_HPP
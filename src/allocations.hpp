@@ -0,0 +1,34 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_ALLOCATIONS_HPP
+#define SRC_ALLOCATIONS_HPP
+
+#include <cstdint>
+
+/**
+ * @brief Count of heap allocations
+ *
+ * The global operator new is replaced to count all allocations of the process. The counter is
+ * meant to verify that steady state paths like frame rendering do not allocate.
+ */
+class Allocations {
+public:
+  static uint64_t GetCount();
+};
+
+#endif // SRC_ALLOCATIONS_HPP
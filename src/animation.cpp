@@ -20,58 +20,206 @@
 #include <fmt/format.h>
 #include <fstream>
 #include <openssl/md5.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 #include "power.hpp"
+#include "trace.hpp"
 
-Animation::Animation(asio::io_context &io, Power &power)
-    : Log("animation"), timer_(io), power_(power) {
+Animation::Animation(asio::io_context &io, Power &power, const std::string &path)
+    : Log("animation"), path_(path), io_(io), timer_(io), power_(power), watch_(io) {
 
   power_.SigPowerStatusChanged.connect(&Animation::OnPowerStatusChanged, this);
 
-  for (const auto &p : std::filesystem::directory_iterator(kAnimationPath)) {
-    const std::filesystem::path &path = p.path();
+  std::error_code error;
+  for (const auto &p : std::filesystem::directory_iterator(path_, error)) {
+    if (p.path().extension() == ".json") {
+      UpdateFile(p.path(), ReadInfo(p.path()));
+    }
+  }
+  if (error) {
+    E("Reading animations from {} failed: {}", path_.string(), error.message());
+  }
+
+  StartWatch();
+}
+
+Animation::~Animation() {
+  worker_.stop();
+  worker_.join();
+}
+
+void Animation::Stop() {
+  Play(false);
+  asio::error_code error;
+  watch_.close(error);
+}
+
+Animation::catalog_entry_t Animation::ReadInfo(const std::filesystem::path &path) const {
+  try {
+    std::ifstream file(path);
+    nlohmann::json animation;
+    file >> animation;
 
+    const std::string &name = animation["name"];
+    const std::string &description = animation["description"];
+    const std::string &content = name + description;
+
+    mode_e mode = mode_e::single;
+    const std::string &m = animation.value("mode", "single");
+    if (m == "single") {
+      mode = mode_e::single;
+    } else if (m == "cyclic") {
+      mode = mode_e::cyclic;
+    }
+
+    unsigned char buffer[MD5_DIGEST_LENGTH];
+    MD5((unsigned char *)content.c_str(), content.size(), buffer);
+
+    std::string hash;
+    for (std::size_t i = 0; i < MD5_DIGEST_LENGTH; ++i) {
+      hash += "0123456789ABCDEF"[buffer[i] / 16];
+      hash += "0123456789ABCDEF"[buffer[i] % 16];
+    }
+
+    D("Found animation '{} {} {}'.", name, hash, m);
+    return std::make_pair(hash, info_t{mode, name, description, path});
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing animation {} failed: {}", path.c_str(), e.what());
+  }
+  return std::nullopt;
+}
+
+void Animation::StartWatch() {
+  const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    E("inotify_init1() failed: {}", strerror(errno));
+    return;
+  }
+  // files are complete when closed after writing or moved into the directory
+  if (inotify_add_watch(fd, path_.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+    E("inotify_add_watch() failed: {}", strerror(errno));
+    close(fd);
+    return;
+  }
+
+  watch_.assign(fd);
+  watch_.async_read_some(asio::buffer(watch_buffer_),
+                         Trace::Wrap("Animation::OnWatch",
+                                     [this](const asio::error_code &error, std::size_t size) {
+                                       OnWatch(error, size);
+                                     }));
+}
+
+void Animation::OnWatch(const asio::error_code &error, std::size_t size) {
+  if (error) {
+    if (error != asio::error::operation_aborted) {
+      E("Watching {} failed: {}", path_.string(), error.message());
+    }
+    return;
+  }
+
+  for (std::size_t offset = 0; offset + sizeof(inotify_event) <= size;) {
+    const inotify_event *event = reinterpret_cast<const inotify_event *>(&watch_buffer_[offset]);
+    offset += sizeof(inotify_event) + event->len;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      E("Lost file events, rescan {}", path_.string());
+      for (const auto &[path, hash] : std::map(files_)) {
+        if (!std::filesystem::exists(path)) {
+          RemoveFile(path);
+        }
+      }
+      std::error_code error;
+      for (const auto &p : std::filesystem::directory_iterator(path_, error)) {
+        if (p.path().extension() == ".json") {
+          ScanFile(p.path());
+        }
+      }
+      continue;
+    }
+
+    if (event->len == 0) {
+      continue;
+    }
+    const std::filesystem::path &path = path_ / event->name;
     if (path.extension() != ".json") {
       continue;
     }
 
-    try {
-      std::ifstream file(path);
-      nlohmann::json animation;
-      file >> animation;
-
-      const std::string &name = animation["name"];
-      const std::string &description = animation["description"];
-      const std::string &content = name + description;
-
-      mode_e mode = mode_e::single;
-      const std::string &m = animation.value("mode", "single");
-      if (m == "single") {
-        mode = mode_e::single;
-      } else if (m == "cyclic") {
-        mode = mode_e::cyclic;
-      }
+    if (event->mask & (IN_MOVED_FROM | IN_DELETE)) {
+      RemoveFile(path);
+    } else {
+      ScanFile(path);
+    }
+  }
+
+  watch_.async_read_some(asio::buffer(watch_buffer_),
+                         Trace::Wrap("Animation::OnWatch",
+                                     [this](const asio::error_code &error, std::size_t size) {
+                                       OnWatch(error, size);
+                                     }));
+}
 
-      unsigned char buffer[MD5_DIGEST_LENGTH];
-      MD5((unsigned char *)content.c_str(), content.size(), buffer);
+void Animation::ScanFile(const std::filesystem::path &path) {
+  // reading the info means parsing the whole file, keep that off the io thread
+  asio::post(worker_, [this, path]() {
+    const catalog_entry_t &entry = ReadInfo(path);
+    asio::post(io_, [this, path, entry]() { UpdateFile(path, entry); });
+  });
+}
 
-      std::string hash;
-      for (std::size_t i = 0; i < MD5_DIGEST_LENGTH; ++i) {
-        hash += "0123456789ABCDEF"[buffer[i] / 16];
-        hash += "0123456789ABCDEF"[buffer[i] % 16];
-      }
+void Animation::UpdateFile(const std::filesystem::path &path, const catalog_entry_t &entry) {
+  auto file = files_.find(path);
+  if (file != files_.end()) {
+    // a changed name or description changes the hash
+    if (!entry || entry->first != file->second) {
+      animations_.erase(file->second);
+      CacheErase(file->second);
+    }
+    if (entry && hash_ == file->second) {
+      // playback continues with the old data, the new hash replaces the old one right away
+      hash_ = entry->first;
+    }
+    files_.erase(file);
+  }
 
-      animations_[hash] = {mode, name, description, path};
+  if (!entry) {
+    SigCatalogChanged();
+    return;
+  }
 
-      D(fmt::format("Found animation '{} {} {}'.", animation["name"], hash,
-                    animation.value("mode", "single")));
-    } catch (const nlohmann::json::exception &e) {
-      E(fmt::format("Parsing animation {} failed: {}", path.c_str(), e.what()));
+  const auto &[hash, info] = *entry;
+  D("Update animation {} {}", hash, path.c_str());
+  animations_[hash] = info;
+  files_[path] = hash;
+  CacheErase(hash);
+
+  // reload in the background what is in use, the current animation continues meanwhile
+  if (hash == hash_ || pinned_.count(hash)) {
+    if (hash == hash_) {
+      reloading_ = true;
     }
+    StartLoad(hash, true);
   }
+
+  SigCatalogChanged();
 }
 
-Animation::~Animation() {}
+void Animation::RemoveFile(const std::filesystem::path &path) {
+  auto file = files_.find(path);
+  if (file == files_.end()) {
+    return;
+  }
+
+  // a playing animation continues until another one is set
+  I("Remove animation {} {}", file->second, path.c_str());
+  animations_.erase(file->second);
+  CacheErase(file->second);
+  files_.erase(file);
+  SigCatalogChanged();
+}
 
 void Animation::OnPowerStatusChanged() {
   I("OnPowerStatusChanged");
@@ -83,20 +231,70 @@ void Animation::OnPowerStatusChanged() {
 
 void Animation::Play(bool on) {
   if (on) {
-    if (animation_.empty()) {
-      E("animation is empty");
+    if (!animation_ || animation_->empty()) {
+      if (loading_.empty()) {
+        E("animation is empty");
+      } else {
+        D("Play once animation {} is loaded", loading_);
+      }
       return;
     }
     active_ = true;
-    index_ = 0;
-    timer_.expires_at(std::chrono::steady_clock::now() + std::chrono::milliseconds(100));
-    timer_.async_wait([this](const asio::error_code &error) { OnAnimate(error); });
+    if (!synced_) {
+      epoch_ = clock::now() + kStartDelay;
+      SigPlaybackChanged();
+    }
+    Align();
 
   } else {
+    active_ = false;
     timer_.cancel();
   }
 }
 
+void Animation::SetEpoch(std::optional<clock::time_point> epoch) {
+  if (!epoch) {
+    synced_ = false;
+    return;
+  }
+
+  const bool moved = !synced_ || *epoch - epoch_ > kEpochTolerance ||
+                     epoch_ - *epoch > kEpochTolerance;
+  synced_ = true;
+  if (!moved) {
+    return;
+  }
+  epoch_ = *epoch;
+  if (active_ && animation_ && !animation_->empty()) {
+    Align();
+  }
+}
+
+void Animation::Align() {
+  // seek to the frame due now, or wait for the epoch
+  const clock::time_point &now = clock::now();
+  loop_start_ = epoch_;
+  index_ = 0;
+  position_ = 0;
+  if (now > epoch_ && duration_ > 0) {
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - epoch_).count();
+    if (mode_ == mode_e::cyclic) {
+      const int64_t loops = elapsed / duration_;
+      loop_start_ += std::chrono::milliseconds(loops * duration_);
+      elapsed -= loops * duration_;
+    }
+    while (index_ < int(animation_->size()) &&
+           position_ + std::get<0>((*animation_)[index_]) <= elapsed) {
+      position_ += std::get<0>((*animation_)[index_++]);
+    }
+  }
+
+  timer_.expires_at(loop_start_ + std::chrono::milliseconds(position_));
+  timer_.async_wait(Trace::Wrap(
+      "Animation::OnAnimate", [this](const asio::error_code &error) { OnAnimate(error); },
+      timer_.expiry()));
+}
+
 nlohmann::json Animation::GetAnimationInfo() const {
   std::vector<nlohmann::json> infos;
 
@@ -116,44 +314,293 @@ nlohmann::json Animation::GetAnimationInfo() const {
 void Animation::SetAnimation(const std::string &hash) {
   if (animations_.count(hash) == 0) {
     hash_.clear();
-    animation_.clear();
+    loading_.clear();
+    reloading_ = false;
+    animation_.reset();
     index_ = -1;
+    SigAnimationChanged();
+    return;
+  }
+  if (hash_ == hash) {
+    // switching back drops a pending switch, a reload of the current one continues
+    if (!loading_.empty()) {
+      loading_.clear();
+      SigAnimationChanged();
+    }
+    return;
+  }
+
+  loading_ = hash;
+  loading_since_ = std::chrono::steady_clock::now();
+  auto pinned = pinned_.find(hash);
+  if (pinned != pinned_.end() && pinned->second.animation) {
+    OnLoaded(hash, pinned->second.animation);
     return;
   }
-  if (hash_ != hash) {
-    hash_ = hash;
-    mode_ = animations_[hash].mode;
-    LoadAnimation(animations_[hash].path.c_str());
+  const std::shared_ptr<const animation_t> &cached = CacheGet(hash);
+  if (cached) {
+    OnLoaded(hash, cached);
+    return;
   }
+  StartLoad(hash);
+  SigAnimationChanged();
 }
 
-void Animation::LoadAnimation(const std::string &filename) {
-  I(fmt::format("Load animation {}", filename));
+void Animation::Preload(const std::string &hash) {
+  if (animations_.count(hash) == 0) {
+    E("Can't preload unknown animation {}", hash);
+    return;
+  }
+
+  pinned_t &pinned = pinned_[hash];
+  if (pinned.count++ == 0) {
+    D("Preload animation {}", hash);
+    pinned.animation = hash == hash_ ? animation_ : CacheGet(hash);
+    if (!pinned.animation) {
+      StartLoad(hash);
+    }
+  }
+  pinned_gauge_.Set(pinned_.size());
+}
+
+void Animation::Release(const std::string &hash) {
+  auto pinned = pinned_.find(hash);
+  if (pinned != pinned_.end() && --pinned->second.count == 0) {
+    D("Release animation {}", hash);
+    pinned_.erase(pinned);
+  }
+  pinned_gauge_.Set(pinned_.size());
+}
+
+void Animation::StartLoad(const std::string &hash, bool reload) {
+  int &in_flight = in_flight_[hash];
+  if (in_flight && !reload) {
+    return;
+  }
+  in_flight++;
+
+  const std::string &filename = animations_[hash].path;
+  asio::post(worker_, [this, hash, filename]() {
+    std::shared_ptr<const animation_t> animation;
+    try {
+      animation = LoadAnimation(filename);
+    } catch (const std::exception &e) {
+      E("Loading animation {} failed: {}", filename, e.what());
+    }
+    asio::post(io_, Trace::Wrap(
+                        "Animation::OnLoaded",
+                        [this, hash, animation]() {
+                          // the last load of a changed file is the one that counts
+                          auto it = in_flight_.find(hash);
+                          if (--it->second > 0) {
+                            return;
+                          }
+                          in_flight_.erase(it);
+                          OnLoaded(hash, animation);
+                        },
+                        Trace::clock::now()));
+  });
+}
+
+std::shared_ptr<const Animation::animation_t>
+Animation::LoadAnimation(const std::string &filename) {
+  I("Load animation {}", filename);
+  Trace::Span span("Animation::LoadAnimation");
+  Metrics::ScopedTimer timer(load_seconds_);
+
   std::ifstream ifs(filename);
-  const nlohmann::json &json_ = nlohmann::json::parse(ifs);
-  animation_ = json_["data"].get<animation_t>();
-  index_ = 0;
+  const std::uintmax_t size = std::filesystem::file_size(filename);
+  progress_.store(0, std::memory_order_relaxed);
+
+  // the parser callback runs for every token, sample the file position every now and then
+  std::size_t tokens = 0;
+  int reported = 0;
+  auto callback = [&](int, nlohmann::json::parse_event_t, nlohmann::json &) {
+    if ((++tokens % 4096) == 0) {
+      const std::streamoff pos = ifs.tellg();
+      const int progress = pos < 0 || size == 0 ? 0 : pos * 100 / size;
+      progress_.store(progress, std::memory_order_relaxed);
+      if (progress >= reported + kProgressStep) {
+        reported = progress;
+        asio::post(io_, [this]() { SigAnimationChanged(); });
+      }
+    }
+    return true;
+  };
+
+  const nlohmann::json &json_ = nlohmann::json::parse(ifs, callback);
+  auto animation = std::make_shared<const animation_t>(json_["data"].get<animation_t>());
+  progress_.store(100, std::memory_order_relaxed);
+  return animation;
+}
+
+void Animation::OnLoaded(const std::string &hash,
+                         const std::shared_ptr<const animation_t> &animation) {
+  CachePut(hash, animation);
+
+  auto pinned = pinned_.find(hash);
+  if (pinned != pinned_.end()) {
+    pinned->second.animation = animation;
+  }
+
+  // a reloaded current animation is swapped in even while a switch is pending
+  if (hash == hash_ && reloading_) {
+    reloading_ = false;
+    if (animation) {
+      Swap(hash, animation);
+    }
+    return;
+  }
+
+  if (loading_ != hash) {
+    return;
+  }
+  loading_.clear();
+  if (!animation) {
+    SigAnimationChanged();
+    return;
+  }
+
+  switch_seconds_.Observe(std::chrono::steady_clock::now() - loading_since_);
+  Swap(hash, animation);
+}
+
+void Animation::Swap(const std::string &hash,
+                     const std::shared_ptr<const animation_t> &animation) {
+  const bool switched = hash != hash_;
+  if (switched) {
+    // a reload of the previous animation is of no use anymore
+    reloading_ = false;
+  }
+  hash_ = hash;
+  mode_ = animations_[hash].mode;
+  animation_ = animation;
+  duration_ = 0;
+  for (const auto &[time, frame] : *animation_) {
+    duration_ += time;
+  }
+  SigAnimationChanged();
+
+  // another animation starts with the next frame due, a reloaded one keeps its timeline
+  if (active_ && !animation_->empty()) {
+    if (switched && !synced_) {
+      epoch_ = std::max(timer_.expiry(), clock::now());
+      SigPlaybackChanged();
+    }
+    Align();
+  }
+
+  // the channel might have been switched on while the animation was loading
+  if (!active_ && power_.GetChannelState(Power::kAnimation)) {
+    Play(true);
+  }
+}
+
+void Animation::SetCacheBudget(std::size_t bytes) {
+  cache_budget_ = bytes;
+  CacheEvict();
+}
+
+std::shared_ptr<const Animation::animation_t> Animation::CacheGet(const std::string &hash) {
+  auto it = cache_.find(hash);
+  if (it == cache_.end()) {
+    cache_misses_total_.Inc();
+    return nullptr;
+  }
+  cache_hits_total_.Inc();
+  lru_.splice(lru_.begin(), lru_, it->second.lru);
+  return it->second.animation;
+}
+
+void Animation::CachePut(const std::string &hash,
+                         const std::shared_ptr<const animation_t> &animation) {
+  if (!animation) {
+    return;
+  }
+  CacheErase(hash);
+
+  const std::size_t size = GetSize(*animation);
+  if (size > cache_budget_) {
+    D("Animation {} with {} bytes exceeds the cache", hash, size);
+    return;
+  }
+
+  lru_.push_front(hash);
+  cache_[hash] = {animation, size, lru_.begin()};
+  cache_size_ += size;
+  CacheEvict();
+}
+
+void Animation::CacheErase(const std::string &hash) {
+  auto it = cache_.find(hash);
+  if (it != cache_.end()) {
+    cache_size_ -= it->second.size;
+    lru_.erase(it->second.lru);
+    cache_.erase(it);
+    cache_bytes_gauge_.Set(cache_size_);
+    cache_entries_gauge_.Set(cache_.size());
+  }
+}
+
+void Animation::CacheEvict() {
+  while (cache_size_ > cache_budget_ && !lru_.empty()) {
+    auto it = cache_.find(lru_.back());
+    D("Evict animation {} from cache", it->first);
+    cache_size_ -= it->second.size;
+    cache_.erase(it);
+    lru_.pop_back();
+  }
+  cache_bytes_gauge_.Set(cache_size_);
+  cache_entries_gauge_.Set(cache_.size());
+}
+
+std::size_t Animation::GetSize(const animation_t &animation) {
+  std::size_t size = sizeof(animation) + animation.capacity() * sizeof(animation_step_t);
+  for (const auto &[time, frame] : animation) {
+    size += frame.capacity() * sizeof(ws2811_led_t);
+  }
+  return size;
 }
 
 void Animation::OnAnimate(const asio::error_code &error) {
   if (error) {
-    E(fmt::format("Cyclic loop failed: {}", error.message()));
+    // re-arming the timer to align the playback cancels the pending wait
+    if (error != asio::error::operation_aborted) {
+      E("Cyclic loop failed: {}", error.message());
+      active_ = false;
+      power_.SetChannelState(Power::kAnimation, false);
+    }
+    return;
+  }
+
+  const clock::duration &lag = clock::now() - timer_.expiry();
+  timer_lag_seconds_.Observe(lag);
+  lateness_ += (lag - lateness_) / 8;
+
+  if (!animation_) {
     active_ = false;
     power_.SetChannelState(Power::kAnimation, false);
     return;
   }
 
-  if (index_ == animation_.size()) {
+  if (index_ == animation_->size()) {
     if (mode_ == mode_e::cyclic) {
       index_ = 0;
+      loop_start_ += std::chrono::milliseconds(duration_);
+      position_ = 0;
     } else {
       active_ = false;
       power_.SetChannelState(Power::kAnimation, false);
       return;
     }
   }
-  const auto &[time, frame] = animation_[index_++];
-  power_.SetChannelFrame(Power::kAnimation, frame);
-  timer_.expires_at(timer_.expiry() + std::chrono::milliseconds(time));
-  timer_.async_wait([this](const asio::error_code &error) { OnAnimate(error); });
+  const auto &[time, frame] = (*animation_)[index_++];
+  frames_total_.Inc();
+  // the frame keeps the animation alive even if another one is set meanwhile
+  power_.SetChannelFrame(Power::kAnimation, {frame, animation_});
+  position_ += time;
+  timer_.expires_at(loop_start_ + std::chrono::milliseconds(position_));
+  timer_.async_wait(Trace::Wrap(
+      "Animation::OnAnimate", [this](const asio::error_code &error) { OnAnimate(error); },
+      timer_.expiry()));
 }
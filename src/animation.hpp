@@ -18,55 +18,201 @@
 #ifndef SRC_ANIMATION_HPP
 #define SRC_ANIMATION_HPP
 
+#include <array>
 #include <asio.hpp>
+#include <atomic>
 #include <filesystem>
+#include <list>
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <sigslot/signal.hpp>
+#include <sys/inotify.h>
 #include <tuple>
+#include <unordered_map>
 #include <ws2811/ws2811.h>
 
+#include "clock.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 
 class Power;
 
+/**
+ * @brief Play animations from json files in a directory, kAnimationPath by default
+ *
+ * Animations are decoded by a worker thread. The current animation keeps playing until the
+ * new one is ready and swapped in by the io thread. Decoded animations are kept in a LRU cache
+ * limited by its size in bytes. The catalog follows changes of the directory via inotify.
+ */
 class Animation : public Log {
 public:
-  Animation(asio::io_context &io, Power &power);
+  static constexpr const char *kAnimationPath = "/home/pi";
+
+  Animation(asio::io_context &io, Power &power, const std::string &path = kAnimationPath);
   virtual ~Animation();
 
   nlohmann::json GetAnimationInfo() const;
 
   void SetAnimation(const std::string &hash);
   std::string GetAnimation() const { return hash_; }
+  /** @brief Hash of the animation that will replace the current one once loaded */
+  std::string GetLoading() const { return loading_; }
+  /** @brief Loads are queued or running */
+  bool GetLoadPending() const { return !in_flight_.empty(); }
+  /** @brief Progress of the running load in percent */
+  int GetLoadProgress() const { return progress_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Decode an animation ahead of time
+   *
+   * The animation stays resident until the matching Release(). Setting a preloaded animation
+   * does not touch the file system anymore.
+   */
+  void Preload(const std::string &hash);
+  void Release(const std::string &hash);
+
+  /** @brief Limit the memory used by cached animations, 0 disables the cache */
+  void SetCacheBudget(std::size_t bytes);
+  std::size_t GetCacheBudget() const { return cache_budget_; }
 
   void Play(bool on);
+  void Stop();
+
+  /**
+   * @brief Align the playback to a timeline
+   *
+   * Frame 0 of the first loop is due at `epoch`, the following frames by their durations.
+   * Without an epoch the playback starts shortly after Play() or switching the animation.
+   */
+  void SetEpoch(std::optional<std::chrono::steady_clock::time_point> epoch);
+  std::chrono::steady_clock::time_point GetEpoch() const { return epoch_; }
+  /** @brief Smoothed delay of the shown frames behind their due time */
+  std::chrono::nanoseconds GetLateness() const { return lateness_; }
+
+  sigslot::signal_st<> SigAnimationChanged;
+  /** @brief The epoch changed, e.g. playback started */
+  sigslot::signal_st<> SigPlaybackChanged;
+  sigslot::signal_st<> SigCatalogChanged;
 
 private:
-  void LoadAnimation(const std::string &filename);
-  void OnAnimate(const asio::error_code &error);
-  void OnPowerStatusChanged();
+  using animation_step_t = std::tuple<int, std::vector<ws2811_led_t>>;
+  using animation_t = std::vector<animation_step_t>;
 
   enum class mode_e { single, cyclic };
-  static constexpr const char *kAnimationPath = "/home/pi";
 
-  asio::steady_timer timer_;
+  struct info_t {
+    mode_e mode{mode_e::single};
+    std::string name;
+    std::string desc;
+    std::filesystem::path path;
+  };
+  using catalog_entry_t = std::optional<std::pair<std::string, info_t>>;
+
+  using clock = Clock;
+
+  static constexpr auto kStartDelay = std::chrono::milliseconds(100);
+  // a new epoch closer than that to the current one is ignored, it would only re-arm the timer
+  static constexpr auto kEpochTolerance = std::chrono::microseconds(500);
+  // report progress to subscribers in steps of that many percent
+  static constexpr int kProgressStep = 10;
+  static constexpr std::size_t kDefaultCacheBudget = 32 * 1024 * 1024;
+
+  void StartLoad(const std::string &hash, bool reload = false);
+  // called by the worker thread
+  std::shared_ptr<const animation_t> LoadAnimation(const std::string &filename);
+  void OnLoaded(const std::string &hash, const std::shared_ptr<const animation_t> &animation);
+  void Swap(const std::string &hash, const std::shared_ptr<const animation_t> &animation);
+  std::shared_ptr<const animation_t> CacheGet(const std::string &hash);
+  void CachePut(const std::string &hash, const std::shared_ptr<const animation_t> &animation);
+  void CacheEvict();
+  static std::size_t GetSize(const animation_t &animation);
+  void OnAnimate(const asio::error_code &error);
+  void Align();
+  // called by the worker thread at runtime
+  catalog_entry_t ReadInfo(const std::filesystem::path &path) const;
+  void StartWatch();
+  void OnWatch(const asio::error_code &error, std::size_t size);
+  void ScanFile(const std::filesystem::path &path);
+  void UpdateFile(const std::filesystem::path &path, const catalog_entry_t &entry);
+  void RemoveFile(const std::filesystem::path &path);
+  void CacheErase(const std::string &hash);
+  void OnPowerStatusChanged();
+
+  const std::filesystem::path path_;
+  asio::io_context &io_;
+  SteadyTimer timer_;
   Power &power_;
+  asio::thread_pool worker_{1};
 
   std::string hash_;
-  using animation_step_t = std::tuple<int, std::vector<ws2811_led_t>>;
-  using animation_t = std::vector<animation_step_t>;
-  animation_t animation_;
+  std::shared_ptr<const animation_t> animation_;
+  // a pending switch to another animation
+  std::string loading_;
+  std::chrono::steady_clock::time_point loading_since_;
+  // the file of the current animation changed and is reloaded, independent of a switch
+  bool reloading_{false};
+  // number of loads queued or running for a hash
+  std::map<std::string, int> in_flight_;
+  std::atomic<int> progress_{100};
   int index_{0};
   mode_e mode_{mode_e::single};
   bool active_{false};
 
-  struct info_t {
-    mode_e mode{mode_e::single};
-    std::string name;
-    std::string desc;
-    std::filesystem::path path;
-  };
+  // the timeline: index_ is due position_ ms after the start of the current loop
+  clock::time_point epoch_;
+  bool synced_{false};
+  clock::time_point loop_start_;
+  int64_t position_{0};
+  int64_t duration_{0};
+  std::chrono::nanoseconds lateness_{0};
 
   std::map<std::string, info_t> animations_;
+  // hash of the catalog entry for each file
+  std::map<std::filesystem::path, std::string> files_;
+  asio::posix::stream_descriptor watch_;
+  // read as a sequence of inotify_event, see inotify(7)
+  alignas(inotify_event) std::array<char, 4096> watch_buffer_;
+
+  struct pinned_t {
+    std::shared_ptr<const animation_t> animation;
+    int count{0};
+  };
+  std::map<std::string, pinned_t> pinned_;
+
+  struct cached_t {
+    std::shared_ptr<const animation_t> animation;
+    std::size_t size;
+    std::list<std::string>::iterator lru;
+  };
+  std::unordered_map<std::string, cached_t> cache_;
+  // most recently used hash first
+  std::list<std::string> lru_;
+  std::size_t cache_size_{0};
+  std::size_t cache_budget_{kDefaultCacheBudget};
+
+  Metrics::Counter &frames_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_animation_frames_total", "Animation frames played")};
+  Metrics::Histogram &load_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_animation_load_seconds", "Time to load and decode an animation",
+      {0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30})};
+  Metrics::Histogram &timer_lag_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_animation_timer_lag_seconds",
+      "Delay of the animation timer behind its expiry, i.e. the io loop lag")};
+  Metrics::Histogram &switch_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_animation_switch_seconds",
+      "Time from requesting another animation until it is the current one",
+      {0.0001, 0.001, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30})};
+  Metrics::Counter &cache_hits_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_animation_cache_hits_total", "Animations taken from the cache")};
+  Metrics::Counter &cache_misses_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_animation_cache_misses_total", "Animations not in the cache")};
+  Metrics::Gauge &cache_bytes_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_animation_cache_bytes", "Estimated memory of the cached animations")};
+  Metrics::Gauge &cache_entries_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_animation_cache_entries", "Animations in the cache")};
+  Metrics::Gauge &pinned_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_animation_pinned", "Preloaded animations kept resident")};
 };
 
 #endif // SRC_ANIMATION_HPP
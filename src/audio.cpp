@@ -0,0 +1,410 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "audio.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "power.hpp"
+#include "trace.hpp"
+#include "ws2811_control.hpp"
+
+Audio::Audio(const std::string &config_path, asio::io_context &io, Power &power,
+             WS2811Control &ws2811_control)
+    : Log("audio"), config_path_(config_path),
+      audio_path_(std::filesystem::path(config_path) / kAudioDir), power_(power), event_(io) {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    E("eventfd failed: {}", strerror(errno));
+  } else {
+    event_.assign(event_fd_);
+  }
+
+  power_.SigPowerStatusChanged.connect(&Audio::OnPowerStatusChanged, this);
+  ws2811_control.SigRendered.connect([this](const frame_t &, uint8_t) { OnRendered(); });
+
+  std::error_code error;
+  std::filesystem::create_directories(audio_path_, error);
+  if (error) {
+    E("Creating {} failed: {}", audio_path_.string(), error.message());
+  }
+
+  restore_state_active_ = true;
+  try {
+    const config_t &config = LoadState(config_path_, kConfigFile).get<config_t>();
+    std::string reason;
+    if (CheckConfig(config, reason)) {
+      config_ = config;
+    } else {
+      E("Invalid config: {}", reason);
+    }
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing config failed: {}", e.what());
+  }
+  restore_state_active_ = false;
+
+  // the channel might have been restored as active already
+  OnPowerStatusChanged();
+}
+
+Audio::~Audio() { StopCapture(); }
+
+void Audio::SaveState() { IModule::SaveState(config_path_, kConfigFile, config_); }
+
+void Audio::Stop() {
+  active_ = false;
+  StopCapture();
+  event_.cancel();
+}
+
+bool Audio::CheckConfig(const config_t &config, std::string &error) {
+  const AudioSource::config_t &source = config.source;
+  if (source.sample_rate < kMinSampleRate || source.sample_rate > kMaxSampleRate) {
+    error = fmt::format("sample_rate {} out of {}..{}", source.sample_rate, kMinSampleRate,
+                       kMaxSampleRate);
+    return false;
+  }
+  if (source.channels < 1 || source.channels > kMaxChannels) {
+    error = fmt::format("channels {} out of 1..{}", source.channels, kMaxChannels);
+    return false;
+  }
+  // the device comes from any client, it must not name a path outside of kAudioDir
+  const bool file = source.type != AudioSource::type_e::alsa;
+  if (source.device.empty() || source.device.find('/') != std::string::npos ||
+      (file && (source.device == "." || source.device == ".."))) {
+    error = fmt::format("invalid device {}", source.device);
+    return false;
+  }
+  const AudioAnalyzer::config_t &analyzer = config.analyzer;
+  if (!(analyzer.min_frequency > 0) || !(analyzer.max_frequency > analyzer.min_frequency)) {
+    error = fmt::format("invalid frequency range {}..{}", analyzer.min_frequency,
+                        analyzer.max_frequency);
+    return false;
+  }
+  return true;
+}
+
+bool Audio::SetConfig(const config_t &config, std::string &error) {
+  if (!CheckConfig(config, error)) {
+    E("Invalid config: {}", error);
+    return false;
+  }
+  StopCapture();
+  config_ = config;
+  if (active_) {
+    StartCapture();
+  }
+  SaveState();
+  SigAudioChanged();
+  return true;
+}
+
+void Audio::OnPowerStatusChanged() {
+  const bool active = power_.GetChannelState(Power::kAudio);
+  if (active == active_) {
+    return;
+  }
+
+  active_ = active;
+  if (active_) {
+    StartCapture();
+  } else {
+    StopCapture();
+  }
+}
+
+void Audio::StartCapture() {
+  if (event_fd_ < 0) {
+    return;
+  }
+  write_ = 0;
+  middle_ = 1;
+  read_ = 2;
+  pending_ = false;
+  running_ = true;
+  // the thread works on a copy, the configuration may change while it runs
+  AudioSource::config_t source = config_.source;
+  if (source.type != AudioSource::type_e::alsa) {
+    source.device = (audio_path_ / source.device).string();
+  }
+  thread_ = std::thread(&Audio::Run, this, source, config_.analyzer);
+  Wait();
+}
+
+void Audio::StopCapture() {
+  running_ = false;
+  // the thread returns within AudioSource::kReadTimeout
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  event_.cancel();
+}
+
+void Audio::Run(AudioSource::config_t source_config, AudioAnalyzer::config_t analyzer_config) {
+  sched_param param{};
+  param.sched_priority = kPriority;
+  const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (err != 0) {
+    D("No real-time priority: {}", strerror(err));
+  }
+
+  std::unique_ptr<AudioSource> source = AudioSource::Create(source_config);
+  if (!source) {
+    E("Opening {} source {} failed", AudioSource::ToString(source_config.type),
+      source_config.device);
+    return;
+  }
+
+  // all buffers are allocated before the first sample is read
+  const unsigned channels = source->GetChannels();
+  const unsigned sample_rate = source->GetSampleRate();
+  std::vector<int16_t> pcm(AudioAnalyzer::kHopSize * channels);
+  std::array<float, AudioAnalyzer::kHopSize> mono;
+  AudioAnalyzer analyzer;
+  analyzer.Configure(sample_rate, analyzer_config);
+
+  capturing_ = true;
+  std::size_t done = 0;
+  while (running_) {
+    const int result = source->Read(pcm.data(), AudioAnalyzer::kHopSize, done);
+    if (result < 0) {
+      break;
+    }
+    if (result == 0) {
+      continue;
+    }
+    // the last frame read is as old as the frames still waiting in the source
+    const std::chrono::duration<double> delay(static_cast<double>(source->GetDelay()) /
+                                              sample_rate);
+    const clock::time_point sample_time =
+        clock::now() - std::chrono::duration_cast<clock::duration>(delay);
+    done = 0;
+
+    {
+      Metrics::ScopedTimer timer(analyze_seconds_);
+      constexpr float kScale = 1.0F / 32768.0F;
+      for (std::size_t i = 0; i < AudioAnalyzer::kHopSize; ++i) {
+        int32_t sum = 0;
+        for (unsigned channel = 0; channel < channels; ++channel) {
+          sum += pcm[i * channels + channel];
+        }
+        mono[i] = sum * kScale / channels;
+      }
+      analyzer.Process(mono.data());
+    }
+    hops_total_.Inc();
+
+    levels_t &levels = slots_[write_];
+    levels.levels = analyzer.GetLevels();
+    levels.bands = analyzer.GetBandCount();
+    levels.sample_time = sample_time;
+    Publish(levels);
+  }
+  capturing_ = false;
+}
+
+void Audio::Publish(const levels_t &levels) {
+  // swap the written slot with the middle one, the io thread takes it from there
+  const uint8_t previous =
+      middle_.exchange(static_cast<uint8_t>(write_) | kDirty, std::memory_order_acq_rel);
+  write_ = previous & ~kDirty;
+  if (previous & kDirty) {
+    skipped_total_.Inc();
+    return;
+  }
+  const uint64_t one = 1;
+  if (write(event_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    E("Signaling levels failed: {}", strerror(errno));
+  }
+}
+
+void Audio::Wait() {
+  event_.async_wait(asio::posix::stream_descriptor::wait_read,
+                    Trace::Wrap("Audio::OnLevels",
+                                [this](const asio::error_code &error) { OnLevels(error); }));
+}
+
+void Audio::OnLevels(const asio::error_code &error) {
+  if (error || !active_) {
+    return;
+  }
+
+  uint64_t count = 0;
+  if (read(event_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    E("Reading eventfd failed: {}", strerror(errno));
+  }
+  if (middle_.load(std::memory_order_acquire) & kDirty) {
+    read_ = middle_.exchange(static_cast<uint8_t>(read_), std::memory_order_acq_rel) & ~kDirty;
+    Render(slots_[read_]);
+  }
+  Wait();
+}
+
+void Audio::Render(const levels_t &levels) {
+  frame_index_ = (frame_index_ + 1) % frames_.size();
+  std::vector<ws2811_led_t> &frame = frames_[frame_index_];
+  frame.assign(power_.GetLedCount(), 0);
+
+  for (const mapping_t &mapping : config_.mappings) {
+    if (mapping.offset >= frame.size() || levels.bands == 0) {
+      continue;
+    }
+    const std::size_t length = mapping.length == 0
+                                   ? frame.size() - mapping.offset
+                                   : std::min(mapping.length, frame.size() - mapping.offset);
+    const std::size_t first = std::min(mapping.first_band, levels.bands - 1);
+    const std::size_t last = std::min(std::max(mapping.last_band, first), levels.bands - 1);
+    const float *band = levels.levels.data() + first;
+    const std::size_t bands = last - first + 1;
+
+    float mean = 0.0F;
+    float peak = 0.0F;
+    for (std::size_t i = 0; i < bands; ++i) {
+      mean += band[i];
+      peak = std::max(peak, band[i]);
+    }
+    mean /= bands;
+
+    ws2811_led_t *pixel = frame.data() + mapping.offset;
+    for (std::size_t i = 0; i < length; ++i) {
+      float level = 0.0F;
+      switch (mapping.type) {
+      case mapping_e::spectrum: {
+        // interpolate between the band centers
+        const float position = std::max((i + 0.5F) * bands / length - 0.5F, 0.0F);
+        const std::size_t lower = std::min(static_cast<std::size_t>(position), bands - 1);
+        const std::size_t upper = std::min(lower + 1, bands - 1);
+        const float t = position - lower;
+        level = band[lower] + (band[upper] - band[lower]) * t;
+        break;
+      }
+      case mapping_e::meter:
+        level = std::min(std::max(mean * length - i, 0.0F), 1.0F);
+        break;
+      case mapping_e::pulse:
+        level = peak;
+        break;
+      }
+
+      // mappings overlapping each other add up
+      ws2811_led_t &led = pixel[mapping.reverse ? length - 1 - i : i];
+      ws2811_led_t mixed = 0;
+      for (int shift = 0; shift <= 16; shift += 8) {
+        const uint32_t add = (mapping.color >> shift & 0xFF) * level + 0.5F;
+        const uint32_t value = (led >> shift & 0xFF) + add;
+        mixed |= std::min<uint32_t>(value, 0xFF) << shift;
+      }
+      led = mixed;
+    }
+  }
+
+  power_.SetChannelFrame(Power::kAudio, frame);
+  pending_ = true;
+  pending_sample_time_ = levels.sample_time;
+}
+
+void Audio::OnRendered() {
+  // the first frame rendered after the levels were set contains them
+  if (!pending_) {
+    return;
+  }
+  pending_ = false;
+  latency_ = clock::now() - pending_sample_time_;
+  latency_seconds_.Observe(latency_);
+}
+
+bool Audio::FromString(const std::string &name, mapping_e &type) {
+  if (name == "spectrum") {
+    type = mapping_e::spectrum;
+  } else if (name == "meter") {
+    type = mapping_e::meter;
+  } else if (name == "pulse") {
+    type = mapping_e::pulse;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *Audio::ToString(mapping_e type) {
+  switch (type) {
+  case mapping_e::spectrum:
+    return "spectrum";
+  case mapping_e::meter:
+    return "meter";
+  case mapping_e::pulse:
+    return "pulse";
+  }
+  return "";
+}
+
+void to_json(nlohmann::json &json, const Audio::config_t &config) {
+  json["source"] = AudioSource::ToString(config.source.type);
+  json["device"] = config.source.device;
+  json["sample_rate"] = config.source.sample_rate;
+  json["channels"] = config.source.channels;
+  json["bands"] = config.analyzer.bands;
+  json["min_frequency"] = config.analyzer.min_frequency;
+  json["max_frequency"] = config.analyzer.max_frequency;
+  json["release_ms"] = config.analyzer.release.count();
+  json["mappings"] = nlohmann::json::array();
+  for (const Audio::mapping_t &mapping : config.mappings) {
+    json["mappings"].push_back({{"type", Audio::ToString(mapping.type)},
+                                {"offset", mapping.offset},
+                                {"length", mapping.length},
+                                {"first_band", mapping.first_band},
+                                {"last_band", mapping.last_band},
+                                {"color", mapping.color},
+                                {"reverse", mapping.reverse}});
+  }
+}
+
+void from_json(const nlohmann::json &json, Audio::config_t &config) {
+  const Audio::config_t defaults;
+  if (!AudioSource::FromString(json.value("source", "alsa"), config.source.type)) {
+    config.source.type = defaults.source.type;
+  }
+  config.source.device = json.value("device", defaults.source.device);
+  config.source.sample_rate = json.value("sample_rate", defaults.source.sample_rate);
+  config.source.channels = json.value("channels", defaults.source.channels);
+  config.analyzer.bands = json.value("bands", defaults.analyzer.bands);
+  config.analyzer.min_frequency = json.value("min_frequency", defaults.analyzer.min_frequency);
+  config.analyzer.max_frequency = json.value("max_frequency", defaults.analyzer.max_frequency);
+  config.analyzer.release =
+      std::chrono::milliseconds(json.value("release_ms", defaults.analyzer.release.count()));
+  if (json.contains("mappings")) {
+    config.mappings.clear();
+    for (const nlohmann::json &item : json.at("mappings")) {
+      Audio::mapping_t mapping;
+      Audio::FromString(item.value("type", "spectrum"), mapping.type);
+      mapping.offset = item.value("offset", mapping.offset);
+      mapping.length = item.value("length", mapping.length);
+      mapping.first_band = item.value("first_band", mapping.first_band);
+      mapping.last_band = item.value("last_band", mapping.last_band);
+      mapping.color = item.value("color", mapping.color);
+      mapping.reverse = item.value("reverse", mapping.reverse);
+      config.mappings.push_back(mapping);
+    }
+  } else {
+    config.mappings = defaults.mappings;
+  }
+}
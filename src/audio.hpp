@@ -0,0 +1,170 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_AUDIO_HPP
+#define SRC_AUDIO_HPP
+
+#include <array>
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <nlohmann/json.hpp>
+#include <sigslot/signal.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+#include "audio_analyzer.hpp"
+#include "audio_source.hpp"
+#include "frame.hpp"
+#include "i_module.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+class Power;
+class WS2811Control;
+
+/**
+ * @brief Frame source following the band levels of a PCM stream
+ *
+ * While the channel is on a thread with real-time priority reads the source and analyzes each
+ * hop of AudioAnalyzer::kHopSize frames. The levels are handed to the io thread by a triple
+ * buffer and an eventfd, neither side allocates or waits for the other. The io thread
+ * renders the newest levels by the mappings, each one drawing a range of bands onto a range of
+ * the strip.
+ *
+ * The levels carry the time their last sample was captured. The time from there to the driver
+ * rendering the frame is the end-to-end latency, see GetLatency().
+ */
+class Audio : public Log, public IModule {
+public:
+  enum class mapping_e { spectrum, meter, pulse };
+
+  struct mapping_t {
+    // spectrum: a band per pixel, meter: a bar by the mean level, pulse: all pixels by the peak
+    mapping_e type{mapping_e::spectrum};
+    std::size_t offset{0};
+    // 0 for all pixels to the end of the strip
+    std::size_t length{0};
+    std::size_t first_band{0};
+    // beyond the band count for the last band
+    std::size_t last_band{AudioAnalyzer::kMaxBands};
+    uint32_t color{0xFFFFFF};
+    bool reverse{false};
+  };
+
+  struct config_t {
+    AudioSource::config_t source;
+    AudioAnalyzer::config_t analyzer;
+    std::vector<mapping_t> mappings{mapping_t()};
+  };
+
+  Audio(const std::string &config_path, asio::io_context &io, Power &power,
+        WS2811Control &ws2811_control);
+  virtual ~Audio();
+
+  void Stop();
+
+  static constexpr unsigned kMinSampleRate = 8000;
+  static constexpr unsigned kMaxSampleRate = 192000;
+  static constexpr unsigned kMaxChannels = 8;
+  // FIFOs and WAV files are taken from there, `device` is a file name within
+  static constexpr const char *kAudioDir = "audio";
+
+  /**
+   * @brief Apply a new configuration, a running capture is restarted
+   *
+   * @return false with the reason in `error` if the configuration is invalid, it is not applied
+   */
+  bool SetConfig(const config_t &config, std::string &error);
+  static bool CheckConfig(const config_t &config, std::string &error);
+  const config_t &GetConfig() const { return config_; }
+  /** @brief True while the source is open and read */
+  bool GetCapturing() const { return capturing_; }
+  /** @brief The end-to-end latency of the last frame rendered */
+  std::chrono::duration<double> GetLatency() const { return latency_; }
+
+  static bool FromString(const std::string &name, mapping_e &type);
+  static const char *ToString(mapping_e type);
+
+  sigslot::signal_st<> SigAudioChanged;
+
+private:
+  using clock = std::chrono::steady_clock;
+  static constexpr const char *kConfigFile = "audio.json";
+  static constexpr int kPriority = 50;
+  static constexpr uint8_t kDirty = 0x80;
+
+  struct levels_t {
+    std::array<float, AudioAnalyzer::kMaxBands> levels{};
+    std::size_t bands{0};
+    clock::time_point sample_time;
+  };
+
+  void SaveState() override;
+  void OnPowerStatusChanged();
+  void StartCapture();
+  void StopCapture();
+  void Run(AudioSource::config_t source_config, AudioAnalyzer::config_t analyzer_config);
+  void Publish(const levels_t &levels);
+  void Wait();
+  void OnLevels(const asio::error_code &error);
+  void Render(const levels_t &levels);
+  void OnRendered();
+
+  const std::string config_path_;
+  const std::filesystem::path audio_path_;
+  Power &power_;
+  config_t config_;
+  bool active_{false};
+
+  // capture thread
+  std::thread thread_;
+  std::atomic_bool running_{false};
+  std::atomic_bool capturing_{false};
+  std::size_t write_{0};
+
+  // shared by both threads, the index of the levels published last and if they are new
+  std::array<levels_t, 3> slots_;
+  std::atomic<uint8_t> middle_{1};
+  int event_fd_{-1};
+  asio::posix::stream_descriptor event_;
+
+  // io thread
+  std::size_t read_{2};
+  std::array<std::vector<ws2811_led_t>, 2> frames_;
+  std::size_t frame_index_{0};
+  bool pending_{false};
+  clock::time_point pending_sample_time_;
+  std::chrono::duration<double> latency_{0};
+
+  Metrics::Histogram &latency_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_audio_latency_seconds", "Time from capturing a sample to rendering its frame")};
+  Metrics::Histogram &analyze_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_audio_analyze_seconds", "Time to analyze a hop of samples")};
+  Metrics::Counter &hops_total_{
+      Metrics::Instance().GetCounter("ledcontrol_audio_hops_total", "Hops of samples analyzed")};
+  Metrics::Counter &skipped_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_audio_skipped_total", "Levels replaced by newer ones before being rendered")};
+};
+
+void to_json(nlohmann::json &json, const Audio::config_t &config);
+void from_json(const nlohmann::json &json, Audio::config_t &config);
+
+#endif // SRC_AUDIO_HPP
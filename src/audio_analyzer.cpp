@@ -0,0 +1,128 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "audio_analyzer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void AudioAnalyzer::Configure(unsigned sample_rate, const config_t &config) {
+  band_count_ = std::min(std::max<std::size_t>(config.bands, 1), kMaxBands);
+  history_.assign(kFftSize, 0.0F);
+  real_.assign(kFftSize, 0.0F);
+  imag_.assign(kFftSize, 0.0F);
+  levels_.fill(0.0F);
+  peak_ = kNoiseFloor;
+
+  window_.resize(kFftSize);
+  for (std::size_t i = 0; i < kFftSize; ++i) {
+    window_[i] = 0.5F - 0.5F * std::cos(2.0F * static_cast<float>(M_PI) * i / kFftSize);
+  }
+  cos_.resize(kFftSize / 2);
+  sin_.resize(kFftSize / 2);
+  for (std::size_t i = 0; i < kFftSize / 2; ++i) {
+    cos_[i] = std::cos(2.0 * M_PI * i / kFftSize);
+    sin_[i] = -std::sin(2.0 * M_PI * i / kFftSize);
+  }
+  std::size_t bits = 0;
+  while ((std::size_t(1) << bits) < kFftSize) {
+    bits++;
+  }
+  reversed_.resize(kFftSize);
+  for (std::size_t i = 0; i < kFftSize; ++i) {
+    std::size_t reversed = 0;
+    for (std::size_t bit = 0; bit < bits; ++bit) {
+      reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+    }
+    reversed_[i] = reversed;
+  }
+
+  // logarithmic band edges, each band gets at least one bin of its own
+  const float max_frequency = std::min(config.max_frequency, sample_rate / 2.0F);
+  const float min_frequency = std::max(std::min(config.min_frequency, max_frequency / 2), 1.0F);
+  const float bin_width = static_cast<float>(sample_rate) / kFftSize;
+  std::size_t next = 1;
+  for (std::size_t band = 0; band < band_count_; ++band) {
+    const float upper =
+        min_frequency * std::pow(max_frequency / min_frequency, (band + 1.0F) / band_count_);
+    first_bin_[band] = std::min(next, kFftSize / 2 - 1);
+    last_bin_[band] = std::min(std::max(static_cast<std::size_t>(upper / bin_width),
+                                        first_bin_[band]),
+                               kFftSize / 2 - 1);
+    next = last_bin_[band] + 1;
+  }
+
+  const float hop_seconds = static_cast<float>(kHopSize) / sample_rate;
+  peak_decay_ = kGainDecay * hop_seconds;
+  release_ = config.release.count() > 0
+                 ? std::exp(-hop_seconds * 1000.0F / config.release.count())
+                 : 0.0F;
+  // a full scale sine has the amplitude N/4 in its bin with the Hann window
+  scale_ = 1.0F / (kFftSize / 4.0F * kFftSize / 4.0F);
+}
+
+void AudioAnalyzer::Process(const float *samples) {
+  std::copy(history_.begin() + kHopSize, history_.end(), history_.begin());
+  std::copy(samples, samples + kHopSize, history_.end() - kHopSize);
+
+  for (std::size_t i = 0; i < kFftSize; ++i) {
+    real_[reversed_[i]] = history_[i] * window_[i];
+    imag_[reversed_[i]] = 0.0F;
+  }
+  Transform();
+
+  std::array<float, kMaxBands> db;
+  float loudest = kNoiseFloor;
+  for (std::size_t band = 0; band < band_count_; ++band) {
+    float power = 0.0F;
+    for (std::size_t bin = first_bin_[band]; bin <= last_bin_[band]; ++bin) {
+      power += real_[bin] * real_[bin] + imag_[bin] * imag_[bin];
+    }
+    db[band] = 10.0F * std::log10(power * scale_ + 1e-12F);
+    loudest = std::max(loudest, db[band]);
+  }
+
+  // attack at once, follow quieter passages slowly
+  peak_ = std::max(loudest, peak_ - peak_decay_);
+  for (std::size_t band = 0; band < band_count_; ++band) {
+    const float level =
+        std::min(std::max((db[band] - peak_ + kDynamicRange) / kDynamicRange, 0.0F), 1.0F);
+    levels_[band] = std::max(level, levels_[band] * release_);
+  }
+}
+
+void AudioAnalyzer::Transform() {
+  // iterative radix-2 decimation in time, the input is in bit reversed order
+  for (std::size_t size = 2; size <= kFftSize; size *= 2) {
+    const std::size_t half = size / 2;
+    const std::size_t step = kFftSize / size;
+    for (std::size_t start = 0; start < kFftSize; start += size) {
+      for (std::size_t k = 0; k < half; ++k) {
+        const float wr = cos_[k * step];
+        const float wi = sin_[k * step];
+        const std::size_t even = start + k;
+        const std::size_t odd = even + half;
+        const float tr = real_[odd] * wr - imag_[odd] * wi;
+        const float ti = real_[odd] * wi + imag_[odd] * wr;
+        real_[odd] = real_[even] - tr;
+        imag_[odd] = imag_[even] - ti;
+        real_[even] += tr;
+        imag_[even] += ti;
+      }
+    }
+  }
+}
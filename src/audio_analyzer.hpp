@@ -0,0 +1,84 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_AUDIO_ANALYZER_HPP
+#define SRC_AUDIO_ANALYZER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Band levels of a PCM stream
+ *
+ * Mono samples are added in hops of kHopSize. With each hop the last kFftSize samples are
+ * windowed (Hann), transformed by a radix-2 FFT and the power of the bins is summed into
+ * logarithmically spaced bands. The levels in dB are normalized to 0..1 by an automatic gain
+ * following the loudest band, and fall back by the release time.
+ *
+ * All buffers are allocated by Configure(), Process() doesn't allocate and takes constant time.
+ */
+class AudioAnalyzer {
+public:
+  static constexpr std::size_t kFftSize = 1024;
+  static constexpr std::size_t kHopSize = 256;
+  static constexpr std::size_t kMaxBands = 32;
+  // range in dB from silence to full level below the loudest band
+  static constexpr float kDynamicRange = 40.0F;
+  // the gain follows the loudest band down by that many dB per second
+  static constexpr float kGainDecay = 6.0F;
+  // the gain doesn't go below that level in dB of a full scale sine
+  static constexpr float kNoiseFloor = -50.0F;
+
+  struct config_t {
+    std::size_t bands{16};
+    float min_frequency{40.0F};
+    float max_frequency{16000.0F};
+    std::chrono::milliseconds release{200};
+  };
+
+  void Configure(unsigned sample_rate, const config_t &config);
+  /** @brief Add kHopSize samples in the range -1..1 and update the levels */
+  void Process(const float *samples);
+
+  std::size_t GetBandCount() const { return band_count_; }
+  const std::array<float, kMaxBands> &GetLevels() const { return levels_; }
+
+private:
+  void Transform();
+
+  std::size_t band_count_{0};
+  // samples of the last window, the oldest first
+  std::vector<float> history_;
+  std::vector<float> window_;
+  std::vector<float> real_;
+  std::vector<float> imag_;
+  std::vector<float> cos_;
+  std::vector<float> sin_;
+  std::vector<uint16_t> reversed_;
+  // first and last FFT bin of each band
+  std::array<std::size_t, kMaxBands> first_bin_{};
+  std::array<std::size_t, kMaxBands> last_bin_{};
+  std::array<float, kMaxBands> levels_{};
+  float peak_{kNoiseFloor};
+  float peak_decay_{0.0F};
+  float release_{0.0F};
+  float scale_{1.0F};
+};
+
+#endif // SRC_AUDIO_ANALYZER_HPP
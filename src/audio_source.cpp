@@ -0,0 +1,332 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "audio_source.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+namespace {
+
+/**
+ * @brief PCM data of a WAV file, paced by the sample rate and looped at the end
+ *
+ * The whole file is loaded at open, it is meant for tests without an audio device.
+ */
+class WavSource : public AudioSource {
+public:
+  WavSource() : AudioSource("wav") {}
+
+  bool Open(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      E("Opening {} failed: {}", path, strerror(errno));
+      return false;
+    }
+
+    char riff[12];
+    if (!file.read(riff, sizeof(riff)) || std::string(riff, 4) != "RIFF" ||
+        std::string(riff + 8, 4) != "WAVE") {
+      E("{} is not a WAV file", path);
+      return false;
+    }
+
+    bool format = false;
+    char chunk[8];
+    while (file.read(chunk, sizeof(chunk))) {
+      const std::string id(chunk, 4);
+      const uint32_t size = Le32(chunk + 4);
+      if (id == "fmt ") {
+        std::vector<char> fmt(size);
+        if (size < 16 || !file.read(fmt.data(), size)) {
+          break;
+        }
+        const uint16_t tag = Le16(fmt.data());
+        channels_ = Le16(fmt.data() + 2);
+        sample_rate_ = Le32(fmt.data() + 4);
+        const uint16_t bits = Le16(fmt.data() + 14);
+        if (tag != 1 || bits != 16 || channels_ == 0 || sample_rate_ == 0) {
+          E("{} is not 16 bit PCM", path);
+          return false;
+        }
+        format = true;
+      } else if (id == "data" && format) {
+        // the data is little endian, as is the host
+        data_.resize(size / sizeof(int16_t) / channels_ * channels_);
+        file.read(reinterpret_cast<char *>(data_.data()), data_.size() * sizeof(int16_t));
+        data_.resize(file.gcount() / sizeof(int16_t) / channels_ * channels_);
+        break;
+      } else {
+        file.seekg(size + (size & 1), std::ios::cur);
+      }
+    }
+
+    if (data_.empty()) {
+      E("{} has no PCM data", path);
+      return false;
+    }
+    I("{}: {} Hz, {} channels, {:.1f} s", path, sample_rate_, channels_,
+      static_cast<float>(data_.size() / channels_) / sample_rate_);
+    next_ = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  int Read(int16_t *samples, std::size_t count, std::size_t &done) override {
+    // a frame is available at the time it would have been captured
+    next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(count) / sample_rate_));
+    std::this_thread::sleep_until(next_);
+
+    while (done < count) {
+      const std::size_t n = std::min(count - done, data_.size() / channels_ - position_);
+      std::copy_n(data_.begin() + position_ * channels_, n * channels_, samples + done * channels_);
+      done += n;
+      position_ = (position_ + n) % (data_.size() / channels_);
+    }
+    return 1;
+  }
+
+private:
+  static uint16_t Le16(const char *p) {
+    return static_cast<uint8_t>(p[0]) | static_cast<uint8_t>(p[1]) << 8;
+  }
+  static uint32_t Le32(const char *p) { return Le16(p) | static_cast<uint32_t>(Le16(p + 2)) << 16; }
+
+  std::vector<int16_t> data_;
+  std::size_t position_{0};
+  std::chrono::steady_clock::time_point next_;
+};
+
+/**
+ * @brief Raw PCM written to a named pipe, e.g. by a music player's FIFO output
+ *
+ * The pipe is created if it doesn't exist. A writer of our own keeps it open while no player
+ * is connected, a read times out then instead of failing.
+ */
+class FifoSource : public AudioSource {
+public:
+  FifoSource() : AudioSource("fifo") {}
+  ~FifoSource() override {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    if (keep_open_ >= 0) {
+      close(keep_open_);
+    }
+  }
+
+  bool Open(const std::string &path, unsigned sample_rate, unsigned channels) {
+    if (mkfifo(path.c_str(), 0666) != 0 && errno != EEXIST) {
+      E("mkfifo {} failed: {}", path, strerror(errno));
+      return false;
+    }
+    fd_ = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (fd_ < 0) {
+      E("Opening {} failed: {}", path, strerror(errno));
+      return false;
+    }
+    keep_open_ = open(path.c_str(), O_WRONLY | O_NONBLOCK);
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    I("{}: {} Hz, {} channels", path, sample_rate_, channels_);
+    return true;
+  }
+
+  int Read(int16_t *samples, std::size_t count, std::size_t &done) override {
+    const std::size_t frame_size = channels_ * sizeof(int16_t);
+    uint8_t *data = reinterpret_cast<uint8_t *>(samples);
+    while (done < count) {
+      const ssize_t size = read(fd_, data + done * frame_size + partial_,
+                                (count - done) * frame_size - partial_);
+      if (size > 0) {
+        partial_ += size;
+        done += partial_ / frame_size;
+        partial_ %= frame_size;
+        continue;
+      }
+      if (size < 0 && errno != EAGAIN && errno != EINTR) {
+        E("Reading failed: {}", strerror(errno));
+        return -1;
+      }
+
+      pollfd fd{fd_, POLLIN, 0};
+      const int ready = poll(&fd, 1, kReadTimeout.count());
+      if (ready < 0 && errno != EINTR) {
+        E("poll failed: {}", strerror(errno));
+        return -1;
+      }
+      if (ready == 0) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  std::size_t GetDelay() const override {
+    int available = 0;
+    if (ioctl(fd_, FIONREAD, &available) != 0) {
+      return 0;
+    }
+    return available / (channels_ * sizeof(int16_t));
+  }
+
+private:
+  int fd_{-1};
+  int keep_open_{-1};
+  // bytes of an incomplete frame at the end of the last read
+  std::size_t partial_{0};
+};
+
+#ifdef HAVE_ALSA
+/**
+ * @brief Capture from an ALSA device
+ */
+class AlsaSource : public AudioSource {
+public:
+  AlsaSource() : AudioSource("alsa") {}
+  ~AlsaSource() override {
+    if (pcm_ != nullptr) {
+      snd_pcm_close(pcm_);
+    }
+  }
+
+  bool Open(const std::string &device, unsigned sample_rate, unsigned channels) {
+    int err = snd_pcm_open(&pcm_, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+    if (err < 0) {
+      E("Opening {} failed: {}", device, snd_strerror(err));
+      pcm_ = nullptr;
+      return false;
+    }
+    // a small buffer keeps the latency low, overruns are recovered
+    err = snd_pcm_set_params(pcm_, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+                             channels, sample_rate, 1, 50000);
+    if (err < 0) {
+      E("Setting parameters of {} failed: {}", device, snd_strerror(err));
+      return false;
+    }
+    sample_rate_ = sample_rate;
+    channels_ = channels;
+    I("{}: {} Hz, {} channels", device, sample_rate_, channels_);
+    return true;
+  }
+
+  int Read(int16_t *samples, std::size_t count, std::size_t &done) override {
+    while (done < count) {
+      const int ready = snd_pcm_wait(pcm_, kReadTimeout.count());
+      if (ready == 0) {
+        return 0;
+      }
+      snd_pcm_sframes_t frames =
+          ready < 0 ? ready : snd_pcm_readi(pcm_, samples + done * channels_, count - done);
+      if (frames == -EAGAIN) {
+        continue;
+      }
+      if (frames < 0) {
+        E("Capture failed: {}", snd_strerror(frames));
+        frames = snd_pcm_recover(pcm_, frames, 1);
+        if (frames < 0) {
+          E("Recovering failed: {}", snd_strerror(frames));
+          return -1;
+        }
+        continue;
+      }
+      done += frames;
+    }
+    return 1;
+  }
+
+  std::size_t GetDelay() const override {
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm_, &delay) != 0 || delay < 0) {
+      return 0;
+    }
+    return delay;
+  }
+
+private:
+  snd_pcm_t *pcm_{nullptr};
+};
+#endif
+
+} // namespace
+
+std::unique_ptr<AudioSource> AudioSource::Create(const config_t &config) {
+  switch (config.type) {
+  case type_e::wav: {
+    auto source = std::make_unique<WavSource>();
+    return source->Open(config.device) ? std::move(source) : nullptr;
+  }
+  case type_e::fifo: {
+    auto source = std::make_unique<FifoSource>();
+    return source->Open(config.device, config.sample_rate, config.channels) ? std::move(source)
+                                                                             : nullptr;
+  }
+  case type_e::alsa:
+#ifdef HAVE_ALSA
+  {
+    auto source = std::make_unique<AlsaSource>();
+    return source->Open(config.device, config.sample_rate, config.channels) ? std::move(source)
+                                                                             : nullptr;
+  }
+#else
+    // not compiled in, see GetAvailableTypes()
+    return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+std::vector<AudioSource::type_e> AudioSource::GetAvailableTypes() {
+#ifdef HAVE_ALSA
+  return {type_e::alsa, type_e::fifo, type_e::wav};
+#else
+  return {type_e::fifo, type_e::wav};
+#endif
+}
+
+bool AudioSource::FromString(const std::string &name, type_e &type) {
+  for (type_e t : {type_e::alsa, type_e::fifo, type_e::wav}) {
+    if (name == ToString(t)) {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *AudioSource::ToString(type_e type) {
+  switch (type) {
+  case type_e::alsa:
+    return "alsa";
+  case type_e::fifo:
+    return "fifo";
+  case type_e::wav:
+    return "wav";
+  }
+  return "";
+}
@@ -0,0 +1,78 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_AUDIO_SOURCE_HPP
+#define SRC_AUDIO_SOURCE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log.hpp"
+
+/**
+ * @brief Blocking reader of interleaved 16 bit PCM frames
+ *
+ * Sources are read by the audio thread only. A read returns after at most kReadTimeout to let
+ * the thread check for a stop request.
+ */
+class AudioSource : public Log {
+public:
+  enum class type_e { alsa, fifo, wav };
+
+  static constexpr auto kReadTimeout = std::chrono::milliseconds(50);
+
+  struct config_t {
+    type_e type{type_e::alsa};
+    // ALSA device name, path of the FIFO or WAV file
+    std::string device{"default"};
+    unsigned sample_rate{44100};
+    unsigned channels{1};
+  };
+
+  /** @brief Open a source, nullptr if that failed */
+  static std::unique_ptr<AudioSource> Create(const config_t &config);
+  static bool FromString(const std::string &name, type_e &type);
+  static const char *ToString(type_e type);
+  /** @brief The source types compiled in */
+  static std::vector<type_e> GetAvailableTypes();
+
+  virtual ~AudioSource() = default;
+
+  /**
+   * @brief Read `count` frames into samples
+   *
+   * @return 1 if all frames are read, 0 on timeout with the frames read so far kept in
+   *         `done`, -1 on an error
+   */
+  virtual int Read(int16_t *samples, std::size_t count, std::size_t &done) = 0;
+  /** @brief Frames captured but not read yet, the age of the next frame read */
+  virtual std::size_t GetDelay() const { return 0; }
+
+  unsigned GetSampleRate() const { return sample_rate_; }
+  unsigned GetChannels() const { return channels_; }
+
+protected:
+  explicit AudioSource(const char *name) : Log(name) {}
+
+  unsigned sample_rate_{0};
+  unsigned channels_{0};
+};
+
+#endif // SRC_AUDIO_SOURCE_HPP
@@ -0,0 +1,73 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "clock.hpp"
+
+std::atomic_bool Clock::virtual_{false};
+std::atomic<Clock::rep> Clock::now_{0};
+std::atomic<std::chrono::system_clock::rep> Clock::wall_offset_{0};
+
+Clock::time_point Clock::now() noexcept {
+  if (!IsVirtual()) {
+    return std::chrono::steady_clock::now();
+  }
+  return time_point(duration(now_.load(std::memory_order_relaxed)));
+}
+
+void Clock::StartVirtual(std::chrono::system_clock::time_point wall_time) {
+  // keep the current steady time, timers armed so far stay valid
+  const time_point &now = std::chrono::steady_clock::now();
+  now_.store(now.time_since_epoch().count());
+  wall_offset_.store(
+      (wall_time.time_since_epoch() -
+       std::chrono::duration_cast<std::chrono::system_clock::duration>(now.time_since_epoch()))
+          .count());
+  virtual_.store(true);
+}
+
+void Clock::Advance(duration step) { now_.fetch_add(step.count()); }
+
+Clock::duration Clock::wait_traits::to_wait_duration(const duration &d) {
+  return IsVirtual() ? duration::zero() : d;
+}
+
+Clock::duration Clock::wait_traits::to_wait_duration(const time_point &t) {
+  if (IsVirtual()) {
+    return duration::zero();
+  }
+  return t - now();
+}
+
+SystemClock::time_point SystemClock::now() noexcept {
+  if (!Clock::IsVirtual()) {
+    return std::chrono::system_clock::now();
+  }
+  return time_point(
+      std::chrono::duration_cast<duration>(Clock::now().time_since_epoch()) +
+      duration(Clock::wall_offset_.load(std::memory_order_relaxed)));
+}
+
+SystemClock::duration SystemClock::wait_traits::to_wait_duration(const duration &d) {
+  return Clock::IsVirtual() ? duration::zero() : d;
+}
+
+SystemClock::duration SystemClock::wait_traits::to_wait_duration(const time_point &t) {
+  if (Clock::IsVirtual()) {
+    return duration::zero();
+  }
+  return t - now();
+}
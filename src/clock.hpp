@@ -0,0 +1,91 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_CLOCK_HPP
+#define SRC_CLOCK_HPP
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+
+/**
+ * @brief Clocks of the timers that drive the output, real time unless a virtual time is set
+ *
+ * Clock follows std::chrono::steady_clock and SystemClock the wall clock. Their time points are
+ * those of the std clocks, so the modules keep their types and just read the time from here.
+ *
+ * The headless renderer switches both to a virtual time which it advances itself. Timers then
+ * never wait in real time, the io loop runs the handlers of all timers due at the virtual time.
+ */
+class Clock {
+public:
+  using rep = std::chrono::steady_clock::rep;
+  using period = std::chrono::steady_clock::period;
+  using duration = std::chrono::steady_clock::duration;
+  using time_point = std::chrono::steady_clock::time_point;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept;
+
+  /** @brief Switch to a virtual time starting at the current time and `wall_time` */
+  static void StartVirtual(std::chrono::system_clock::time_point wall_time);
+  static bool IsVirtual() { return virtual_.load(std::memory_order_relaxed); }
+  /** @brief Advance the virtual time */
+  static void Advance(duration step);
+
+  /** @brief Wait traits of the timers, no timer waits in virtual time */
+  struct wait_traits {
+    static duration to_wait_duration(const duration &d);
+    static duration to_wait_duration(const time_point &t);
+  };
+
+private:
+  friend class SystemClock;
+
+  static std::atomic_bool virtual_;
+  static std::atomic<rep> now_;
+  static std::atomic<std::chrono::system_clock::rep> wall_offset_;
+};
+
+/** @brief Wall clock that follows the virtual time of Clock */
+class SystemClock {
+public:
+  using rep = std::chrono::system_clock::rep;
+  using period = std::chrono::system_clock::period;
+  using duration = std::chrono::system_clock::duration;
+  using time_point = std::chrono::system_clock::time_point;
+  static constexpr bool is_steady = false;
+
+  static time_point now() noexcept;
+  static std::time_t to_time_t(const time_point &t) {
+    return std::chrono::system_clock::to_time_t(t);
+  }
+  static time_point from_time_t(std::time_t t) {
+    return std::chrono::system_clock::from_time_t(t);
+  }
+
+  struct wait_traits {
+    static duration to_wait_duration(const duration &d);
+    static duration to_wait_duration(const time_point &t);
+  };
+};
+
+using SteadyTimer = asio::basic_waitable_timer<Clock, Clock::wait_traits>;
+using SystemTimer = asio::basic_waitable_timer<SystemClock, SystemClock::wait_traits>;
+
+#endif // SRC_CLOCK_HPP
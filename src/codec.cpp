@@ -0,0 +1,113 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "codec.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+bool Codec::FromString(const std::string &name, encoding_e &encoding) {
+  if (name == "json") {
+    encoding = encoding_e::json;
+  } else if (name == "cbor") {
+    encoding = encoding_e::cbor;
+  } else if (name == "msgpack") {
+    encoding = encoding_e::msgpack;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *Codec::ToString(encoding_e encoding) {
+  switch (encoding) {
+  case encoding_e::json:
+    return "json";
+  case encoding_e::cbor:
+    return "cbor";
+  case encoding_e::msgpack:
+    return "msgpack";
+  }
+  return "unknown";
+}
+
+void Codec::Encode(encoding_e encoding, const nlohmann::json &msg, std::vector<uint8_t> &out) {
+  out.clear();
+  switch (encoding) {
+  case encoding_e::json: {
+    const std::string &str = msg.dump();
+    out.reserve(str.size() + 1);
+    out.assign(str.begin(), str.end());
+    out.push_back('\n');
+    return;
+  }
+  case encoding_e::cbor:
+    out.resize(kHeaderSize);
+    nlohmann::json::to_cbor(msg, nlohmann::detail::output_adapter<uint8_t>(out));
+    break;
+  case encoding_e::msgpack:
+    out.resize(kHeaderSize);
+    nlohmann::json::to_msgpack(msg, nlohmann::detail::output_adapter<uint8_t>(out));
+    break;
+  }
+
+  const uint32_t size = out.size() - kHeaderSize;
+  out[0] = size >> 24 & 0x0FF;
+  out[1] = size >> 16 & 0x0FF;
+  out[2] = size >> 8 & 0x0FF;
+  out[3] = size & 0x0FF;
+}
+
+nlohmann::json Codec::Decode(encoding_e encoding, const uint8_t *data, std::size_t size) {
+  switch (encoding) {
+  case encoding_e::json:
+    return nlohmann::json::parse(data, data + size);
+  case encoding_e::cbor:
+    return nlohmann::json::from_cbor(data, data + size);
+  case encoding_e::msgpack:
+    return nlohmann::json::from_msgpack(data, data + size);
+  }
+  throw std::invalid_argument("unknown encoding");
+}
+
+bool Codec::FindMessage(encoding_e encoding, const uint8_t *data, std::size_t available,
+                        std::size_t &offset, std::size_t &size, std::size_t &total) {
+  if (encoding == encoding_e::json) {
+    const uint8_t *end = std::find(data, data + available, '\n');
+    if (end == data + available) {
+      if (available > kMaxMessageSize) {
+        throw std::length_error("message exceeds maximum size");
+      }
+      return false;
+    }
+    offset = 0;
+    size = end - data;
+    total = size + 1;
+    return true;
+  }
+
+  if (available < kHeaderSize) {
+    return false;
+  }
+  size = uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | data[3];
+  if (size > kMaxMessageSize) {
+    throw std::length_error("message exceeds maximum size");
+  }
+  offset = kHeaderSize;
+  total = kHeaderSize + size;
+  return available >= total;
+}
@@ -0,0 +1,56 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_CODEC_HPP
+#define SRC_CODEC_HPP
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+class Codec {
+public:
+  enum class encoding_e { json, cbor, msgpack };
+
+  static constexpr std::size_t kHeaderSize = 4;
+  static constexpr std::size_t kMaxMessageSize = 4 * 1024 * 1024;
+
+  static bool FromString(const std::string &name, encoding_e &encoding);
+  static const char *ToString(encoding_e encoding);
+  static std::vector<std::string> GetAvailableEncodings() { return {"json", "cbor", "msgpack"}; }
+
+  // Serialize a message including framing. JSON is terminated by a newline, the binary
+  // encodings are prefixed by their payload size as 32 bit big endian integer.
+  static void Encode(encoding_e encoding, const nlohmann::json &msg, std::vector<uint8_t> &out);
+  // Deserialize the payload of a single message without framing.
+  static nlohmann::json Decode(encoding_e encoding, const uint8_t *data, std::size_t size);
+
+  // Get the size of the first complete message in data. Returns false if the message is
+  // incomplete. offset and size describe the payload without framing.
+  static bool FindMessage(encoding_e encoding, const uint8_t *data, std::size_t available,
+                          std::size_t &offset, std::size_t &size, std::size_t &total);
+};
+
+// Allow to pass messages to the log functions. They are only serialized if the level is enabled.
+template <> struct fmt::formatter<nlohmann::json> : fmt::formatter<std::string> {
+  template <typename FormatContext> auto format(const nlohmann::json &json, FormatContext &ctx) {
+    return fmt::formatter<std::string>::format(json.dump(), ctx);
+  }
+};
+
+#endif // SRC_CODEC_HPP
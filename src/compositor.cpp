@@ -0,0 +1,502 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "compositor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+
+#include "trace.hpp"
+#include "ws2811_control.hpp"
+
+// The blend functions work on two 8 bit channels at once: masked with 0x00FF00FF a 32 bit
+// word holds two channels with 8 bit of head room each, enough for a product with a weight
+// of 0..256.
+static constexpr uint32_t kLaneMask = 0x00FF00FF;
+
+static inline uint32_t Weight(uint8_t opacity) { return opacity + (opacity >> 7); }
+
+static inline uint32_t Scale(uint32_t s, uint32_t w) {
+  return ((((s & kLaneMask) * w) >> 8) & kLaneMask) | ((((s >> 8) & kLaneMask) * w) & ~kLaneMask);
+}
+
+static inline uint32_t Lerp(uint32_t d, uint32_t s, uint32_t w) {
+  const uint32_t rb = (((s & kLaneMask) * w + (d & kLaneMask) * (256 - w)) >> 8) & kLaneMask;
+  const uint32_t wg = (((s >> 8) & kLaneMask) * w + ((d >> 8) & kLaneMask) * (256 - w));
+  return rb | (wg & ~kLaneMask);
+}
+
+static inline uint32_t Saturate(uint32_t lanes) {
+  // a carry into bit 8 of a lane sets the lane to 0xFF
+  const uint32_t carry = lanes & 0x01000100;
+  return (lanes | (carry - (carry >> 8))) & kLaneMask;
+}
+
+static inline uint32_t AddSaturated(uint32_t a, uint32_t b) {
+  const uint32_t rb = (a & kLaneMask) + (b & kLaneMask);
+  const uint32_t wg = ((a >> 8) & kLaneMask) + ((b >> 8) & kLaneMask);
+  return Saturate(rb) | (Saturate(wg) << 8);
+}
+
+namespace {
+// 8 bit gamma encoded values to 16 bit linear light and back via a 12 bit index
+struct gamma_t {
+  static constexpr double kGamma = 2.2;
+  std::array<uint16_t, 256> to_linear;
+  std::array<uint8_t, 4096> to_gamma;
+
+  gamma_t() {
+    for (std::size_t i = 0; i < to_linear.size(); ++i) {
+      to_linear[i] = std::round(65535 * std::pow(i / 255.0, kGamma));
+    }
+    for (std::size_t i = 0; i < to_gamma.size(); ++i) {
+      to_gamma[i] = std::round(255 * std::pow(i / 4095.0, 1 / kGamma));
+    }
+  }
+};
+const gamma_t kGammaTable;
+} // namespace
+
+static inline uint32_t Mul8(uint32_t a, uint32_t b) {
+  // a * b / 255 rounded, without a division
+  const uint32_t x = a * b + 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+Compositor::Compositor(asio::io_context &io, WS2811Control &ws2811_control,
+                       const std::vector<std::string> &names)
+    : Log("compositor"), io_(io), ws2811_control_(ws2811_control), layers_(names.size()),
+      tick_(io) {
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    layers_[i].blend_seconds = &Metrics::Instance().GetHistogram(
+        fmt::format("ledcontrol_layer_{}_blend_seconds", names[i]),
+        fmt::format("Time to blend the {} layer", names[i]));
+  }
+}
+
+Compositor::~Compositor() {}
+
+bool Compositor::FromString(const std::string &name, blend_e &blend) {
+  if (name == "normal") {
+    blend = blend_e::normal;
+  } else if (name == "add") {
+    blend = blend_e::add;
+  } else if (name == "multiply") {
+    blend = blend_e::multiply;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *Compositor::ToString(blend_e blend) {
+  switch (blend) {
+  case blend_e::normal:
+    return "normal";
+  case blend_e::add:
+    return "add";
+  case blend_e::multiply:
+    return "multiply";
+  }
+  return "";
+}
+
+void Compositor::SetFrame(std::size_t layer, const frame_t &frame, bool fade) {
+  if (fade && layers_[layer].active) {
+    StartTransition();
+  }
+  layers_[layer].frame = frame;
+  if (layers_[layer].active) {
+    Schedule();
+  }
+}
+
+void Compositor::SetActive(std::size_t layer, bool active) {
+  if (layers_[layer].active != active) {
+    StartTransition();
+  }
+  layers_[layer].active = active;
+  Schedule();
+}
+
+void Compositor::SetOpacity(std::size_t layer, uint8_t opacity) {
+  if (layers_[layer].active && layers_[layer].opacity != opacity) {
+    StartTransition();
+  }
+  layers_[layer].opacity = opacity;
+  Schedule();
+}
+
+void Compositor::SetBlend(std::size_t layer, blend_e blend) {
+  if (layers_[layer].active && layers_[layer].blend != blend) {
+    StartTransition();
+  }
+  layers_[layer].blend = blend;
+  Schedule();
+}
+
+void Compositor::SetSegments(const std::vector<segment_t> &segments) {
+  segments_.clear();
+  for (const segment_t &segment : segments) {
+    if (segment.layer >= layers_.size() || segment.length == 0) {
+      E("Skip invalid segment at {} of length {}", segment.offset, segment.length);
+      continue;
+    }
+    segments_.push_back(segment);
+  }
+  StartTransition();
+  Schedule();
+}
+
+void Compositor::StartTransition() {
+  if (transition_.count() == 0) {
+    return;
+  }
+
+  // start from what is shown right now, that is a mix if a transition is running already
+  const std::size_t count = ws2811_control_.GetLedCount();
+  from_.resize(count);
+  const std::size_t n = std::min(last_.size, count);
+  if (n) {
+    memcpy(from_.data(), last_.data, n * sizeof(ws2811_led_t));
+  }
+  std::fill(from_.begin() + n, from_.end(), 0);
+
+  transitions_total_.Inc();
+  transition_start_ = clock::now();
+  transition_active_ = true;
+  StartTick();
+}
+
+void Compositor::StartFade(const fade_t &fade) {
+  if (fade_active_) {
+    fade_active_ = false;
+    SigFadeDone(false);
+  }
+  if (fade.from != brightness_) {
+    StartTransition();
+  }
+
+  fade_ = fade;
+  fade_start_ = clock::now();
+  fade_active_ = true;
+  fade_done_ = false;
+  brightness_ = fade_.from;
+  StartTick();
+}
+
+void Compositor::StopFade() {
+  if (fade_active_) {
+    fade_active_ = false;
+    SigFadeDone(false);
+  }
+  if (brightness_ != 1.0F) {
+    StartTransition();
+    brightness_ = 1.0F;
+    SigBrightnessChanged();
+    Schedule();
+  }
+}
+
+void Compositor::UpdateFade() {
+  if (!fade_active_) {
+    return;
+  }
+  const clock::duration &elapsed = clock::now() - fade_start_;
+  brightness_ = fade_.GetBrightness(elapsed);
+  if (elapsed >= fade_.duration) {
+    fade_active_ = false;
+    fade_done_ = true;
+  }
+  SigBrightnessChanged();
+}
+
+void Compositor::StartTick() {
+  if (ticking_) {
+    return;
+  }
+  ticking_ = true;
+  tick_.expires_at(clock::now());
+  tick_.async_wait(Trace::Wrap(
+      "Compositor::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+      tick_.expiry()));
+}
+
+void Compositor::OnTick(const asio::error_code &error) {
+  if (error) {
+    ticking_ = false;
+    transition_active_ = false;
+    return;
+  }
+
+  // Compose() ends the transition and the fade once they are done
+  UpdateFade();
+  Compose();
+  if (fade_done_) {
+    fade_done_ = false;
+    SigFadeDone(true);
+  }
+  if (!transition_active_ && !fade_active_) {
+    ticking_ = false;
+    return;
+  }
+
+  // render at the pace the strip can take
+  const clock::time_point &now = clock::now();
+  tick_.expires_at(std::max(tick_.expiry() + ws2811_control_.GetFrameTime(), now));
+  tick_.async_wait(Trace::Wrap(
+      "Compositor::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+      tick_.expiry()));
+}
+
+void Compositor::Schedule() {
+  // several layers changing in one handler result in a single output frame, the tick of a
+  // running transition or fade renders anyway
+  if (pending_ || ticking_) {
+    return;
+  }
+  pending_ = true;
+  asio::post(io_, Trace::Wrap(
+                      "Compositor::Compose", [this]() { Compose(); }, Trace::clock::now()));
+}
+
+void Compositor::Compose() {
+  pending_ = false;
+  Metrics::ScopedTimer timer(compose_seconds_);
+  const std::size_t count = ws2811_control_.GetLedCount();
+
+  if (!segments_.empty()) {
+    ComposeSegments(count);
+    return;
+  }
+
+  // everything below the topmost opaque layer is hidden
+  std::size_t first = 0;
+  for (std::size_t i = layers_.size(); i-- > 0;) {
+    const layer_t &layer = layers_[i];
+    if (layer.active && layer.opacity == 255 && layer.blend == blend_e::normal &&
+        layer.frame.size >= count) {
+      first = i;
+      break;
+    }
+  }
+
+  std::size_t visible = 0;
+  std::size_t single = 0;
+  for (std::size_t i = first; i < layers_.size(); ++i) {
+    if (layers_[i].active && layers_[i].opacity != 0) {
+      visible++;
+      single = i;
+    }
+  }
+  layers_gauge_.Set(visible);
+
+  const layer_t &top = layers_[single];
+  if (visible == 1 && top.opacity == 255 && top.blend == blend_e::normal &&
+      top.frame.size >= count) {
+    Output(top.frame);
+    return;
+  }
+
+  output_.resize(count);
+  std::fill(output_.begin(), output_.end(), 0);
+  for (std::size_t i = first; i < layers_.size(); ++i) {
+    const layer_t &layer = layers_[i];
+    if (!layer.active || layer.opacity == 0) {
+      continue;
+    }
+
+    const auto &start = std::chrono::steady_clock::now();
+    const std::size_t n = std::min(layer.frame.size, count);
+    switch (layer.blend) {
+    case blend_e::normal:
+      BlendNormal(output_.data(), layer.frame.data, n, layer.opacity);
+      break;
+    case blend_e::add:
+      BlendAdd(output_.data(), layer.frame.data, n, layer.opacity);
+      break;
+    case blend_e::multiply:
+      BlendMultiply(output_.data(), layer.frame.data, n, layer.opacity);
+      break;
+    }
+    layer.blend_seconds->Observe(std::chrono::steady_clock::now() - start);
+  }
+
+  Output(output_);
+}
+
+void Compositor::ComposeSegments(std::size_t count) {
+  output_.resize(count);
+  std::fill(output_.begin(), output_.end(), 0);
+
+  // segments are clipped to the strip, later ones overlap earlier ones
+  std::size_t visible = 0;
+  for (const segment_t &segment : segments_) {
+    const layer_t &layer = layers_[segment.layer];
+    if (!layer.active || layer.frame.size == 0 || segment.offset >= count) {
+      continue;
+    }
+    visible++;
+    const std::size_t length = std::min(segment.length, count - segment.offset);
+    if (length == segment.length) {
+      Resample(output_.data() + segment.offset, length, layer.frame.data, layer.frame.size,
+               segment.reverse);
+      continue;
+    }
+
+    // keep the scale of the full segment, only the part on the strip is shown
+    clipped_.resize(segment.length);
+    Resample(clipped_.data(), segment.length, layer.frame.data, layer.frame.size,
+             segment.reverse);
+    memcpy(output_.data() + segment.offset, clipped_.data(), length * sizeof(ws2811_led_t));
+  }
+  layers_gauge_.Set(visible);
+
+  Output(output_);
+}
+
+void Compositor::Output(const frame_t &frame) {
+  const std::size_t count = ws2811_control_.GetLedCount();
+  frame_t output = frame;
+
+  if (brightness_ < 1.0F) {
+    const std::size_t n = std::min(frame.size, count);
+    dimmed_.resize(count);
+    Dim(dimmed_.data(), frame.data, n, std::lround(brightness_ * 65536));
+    std::fill(dimmed_.begin() + n, dimmed_.end(), 0);
+    output = frame_t(dimmed_);
+  }
+
+  // the snapshot is what was shown, thus mixed with the composition after dimming
+  if (transition_active_) {
+    const clock::duration &elapsed = clock::now() - transition_start_;
+    if (elapsed < transition_) {
+      const uint32_t t = elapsed * 256 / transition_;
+      mixed_.resize(count);
+      from_.resize(count);
+      const std::size_t n = std::min(output.size, count);
+      Mix(mixed_.data(), from_.data(), output.data, n, t);
+      Mix(mixed_.data() + n, from_.data() + n, nullptr, count - n, t);
+      output = frame_t(mixed_);
+    } else {
+      transition_active_ = false;
+    }
+  }
+
+  last_ = output;
+  ws2811_control_.SetFrame(last_);
+
+  // all off and the black frame is shown, release the driver until the next frame
+  const bool idle = std::none_of(layers_.begin(), layers_.end(),
+                                 [](const layer_t &layer) { return layer.active; });
+  if (idle && !transition_active_ && !fade_active_) {
+    ws2811_control_.Suspend();
+  }
+}
+
+void Compositor::Resample(ws2811_led_t *dst, std::size_t n, const ws2811_led_t *src,
+                          std::size_t m, bool reverse) {
+  const auto index = [n, reverse](std::size_t i) { return reverse ? n - 1 - i : i; };
+  if (m == n) {
+    for (std::size_t i = 0; i < n; ++i) {
+      dst[index(i)] = src[i];
+    }
+    return;
+  }
+
+  // the centers of the destination leds mapped onto the source in 16.16 fixed point
+  const int64_t step = (int64_t(m) << 16) / int64_t(n);
+  int64_t pos = step / 2 - 0x8000;
+  for (std::size_t i = 0; i < n; ++i, pos += step) {
+    const int64_t clamped = std::max<int64_t>(pos, 0);
+    const std::size_t k = std::min<std::size_t>(clamped >> 16, m - 1);
+    const std::size_t next = std::min(k + 1, m - 1);
+    dst[index(i)] = Lerp(src[k], src[next], (clamped >> 8) & 0xFF);
+  }
+}
+
+void Compositor::Dim(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                     uint32_t level) {
+  // 16 bit of level, the lanes hold the 24 bit products
+  for (std::size_t i = 0; i < n; ++i) {
+    const uint32_t s = src[i];
+    uint32_t dimmed = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+      dimmed |= (((s >> shift & 0xFF) * level + 0x8000) >> 16) << shift;
+    }
+    dst[i] = dimmed;
+  }
+}
+
+void Compositor::Mix(ws2811_led_t *dst, const ws2811_led_t *from, const ws2811_led_t *to,
+                     std::size_t n, uint32_t t) {
+  const auto &to_linear = kGammaTable.to_linear;
+  const auto &to_gamma = kGammaTable.to_gamma;
+  for (std::size_t i = 0; i < n; ++i) {
+    const uint32_t f = from[i];
+    const uint32_t g = to ? to[i] : 0;
+    if (f == g) {
+      dst[i] = f;
+      continue;
+    }
+
+    uint32_t mixed = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+      const int32_t a = to_linear[f >> shift & 0xFF];
+      const int32_t b = to_linear[g >> shift & 0xFF];
+      const int32_t linear = a + (((b - a) * int32_t(t)) >> 8);
+      mixed |= uint32_t(to_gamma[linear >> 4]) << shift;
+    }
+    dst[i] = mixed;
+  }
+}
+
+void Compositor::BlendNormal(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                             uint8_t opacity) {
+  if (opacity == 255) {
+    memcpy(dst, src, n * sizeof(ws2811_led_t));
+    return;
+  }
+  const uint32_t w = Weight(opacity);
+  for (std::size_t i = 0; i < n; ++i) {
+    dst[i] = Lerp(dst[i], src[i], w);
+  }
+}
+
+void Compositor::BlendAdd(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                          uint8_t opacity) {
+  const uint32_t w = Weight(opacity);
+  for (std::size_t i = 0; i < n; ++i) {
+    dst[i] = AddSaturated(dst[i], Scale(src[i], w));
+  }
+}
+
+void Compositor::BlendMultiply(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                               uint8_t opacity) {
+  const uint32_t w = Weight(opacity);
+  for (std::size_t i = 0; i < n; ++i) {
+    const uint32_t d = dst[i];
+    const uint32_t s = src[i];
+    const uint32_t m = Mul8(d & 0xFF, s & 0xFF) | Mul8(d >> 8 & 0xFF, s >> 8 & 0xFF) << 8 |
+                       Mul8(d >> 16 & 0xFF, s >> 16 & 0xFF) << 16 |
+                       Mul8(d >> 24, s >> 24) << 24;
+    dst[i] = Lerp(d, m, w);
+  }
+}
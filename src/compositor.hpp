@@ -0,0 +1,174 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_COMPOSITOR_HPP
+#define SRC_COMPOSITOR_HPP
+
+#include <asio.hpp>
+#include <sigslot/signal.hpp>
+#include <string>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+#include "clock.hpp"
+#include "fade.hpp"
+#include "frame.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+class WS2811Control;
+
+/**
+ * @brief Blend a stack of layers into the frame sent to the strip
+ *
+ * Layer 0 is the bottom one. Each layer has its own frame, power state, opacity and blend mode.
+ * Changes are coalesced, the output is composed once per io loop iteration. Inactive and fully
+ * transparent layers are skipped, a fully opaque layer in normal mode hides all layers below.
+ * If a single layer remains its frame is passed to the driver without any copy.
+ *
+ * Changes of the layer stack are crossfaded: the last output is kept and mixed with the new
+ * composition in linear light for the transition time.
+ *
+ * With segments set each segment shows the frame of a single layer, rescaled to the segment's
+ * length and optionally reversed, at its range of the strip. All segments are rendered into the
+ * output in one pass, the layers' opacity and blend mode do not apply then.
+ *
+ * The master brightness scales the composition before it is mixed. It is faded per output
+ * frame along an easing curve, see fade_t. A timer at the strip's frame time renders
+ * transitions and fades and runs only while one of them is active. Once all layers are off and
+ * the black frame is shown the driver is suspended.
+ */
+class Compositor : public Log {
+public:
+  enum class blend_e { normal, add, multiply };
+
+  struct segment_t {
+    std::size_t offset{0};
+    std::size_t length{0};
+    bool reverse{false};
+    // the layer shown in the segment
+    std::size_t layer{0};
+  };
+
+  Compositor(asio::io_context &io, WS2811Control &ws2811_control,
+             const std::vector<std::string> &names);
+  virtual ~Compositor();
+
+  static bool FromString(const std::string &name, blend_e &blend);
+  static const char *ToString(blend_e blend);
+
+  /** @brief Set a layer's frame, crossfade to it if `fade` is set */
+  void SetFrame(std::size_t layer, const frame_t &frame, bool fade = false);
+  void SetActive(std::size_t layer, bool active);
+  void SetOpacity(std::size_t layer, uint8_t opacity);
+  void SetBlend(std::size_t layer, blend_e blend);
+  void SetTransition(std::chrono::milliseconds duration) { transition_ = duration; }
+  std::chrono::milliseconds GetTransition() const { return transition_; }
+  /** @brief Compose again, e.g. after the LED count changed */
+  void Refresh() { Schedule(); }
+  /** @brief Split the strip into segments, an empty list shows the blended layers on all leds */
+  void SetSegments(const std::vector<segment_t> &segments);
+  const std::vector<segment_t> &GetSegments() const { return segments_; }
+
+  /** @brief Start a fade of the master brightness, replaces a running one */
+  void StartFade(const fade_t &fade);
+  /** @brief Stop a running fade and restore full brightness */
+  void StopFade();
+  float GetBrightness() const { return brightness_; }
+  bool GetFadeActive() const { return fade_active_; }
+
+  /** @brief A fade ended, with true if it completed, false if it was stopped or replaced */
+  sigslot::signal_st<bool> SigFadeDone;
+  /** @brief The master brightness changed, emitted once per frame while fading */
+  sigslot::signal_st<> SigBrightnessChanged;
+
+  bool GetActive(std::size_t layer) const { return layers_[layer].active; }
+  uint8_t GetOpacity(std::size_t layer) const { return layers_[layer].opacity; }
+  blend_e GetBlend(std::size_t layer) const { return layers_[layer].blend; }
+
+  // blend n leds of src into dst with the given opacity, exposed for the benchmark
+  static void BlendNormal(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                          uint8_t opacity);
+  static void BlendAdd(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                       uint8_t opacity);
+  static void BlendMultiply(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n,
+                            uint8_t opacity);
+  // mix from and to (black if null) by t (0..256) in linear light
+  static void Mix(ws2811_led_t *dst, const ws2811_led_t *from, const ws2811_led_t *to,
+                  std::size_t n, uint32_t t);
+  // resample m leds of src to n leds of dst with linear interpolation, optionally reversed
+  static void Resample(ws2811_led_t *dst, std::size_t n, const ws2811_led_t *src, std::size_t m,
+                       bool reverse);
+  // scale n leds by level (0..65536)
+  static void Dim(ws2811_led_t *dst, const ws2811_led_t *src, std::size_t n, uint32_t level);
+
+private:
+  using clock = Clock;
+  static constexpr auto kDefaultTransition = std::chrono::milliseconds(400);
+
+  void Schedule();
+  void Compose();
+  void ComposeSegments(std::size_t count);
+  void StartTransition();
+  void StartTick();
+  void OnTick(const asio::error_code &error);
+  void UpdateFade();
+  void Output(const frame_t &frame);
+
+  struct layer_t {
+    frame_t frame;
+    bool active{false};
+    uint8_t opacity{255};
+    blend_e blend{blend_e::normal};
+    Metrics::Histogram *blend_seconds{nullptr};
+  };
+
+  asio::io_context &io_;
+  WS2811Control &ws2811_control_;
+  std::vector<layer_t> layers_;
+  std::vector<segment_t> segments_;
+  std::vector<ws2811_led_t> output_;
+  bool pending_{false};
+
+  std::chrono::milliseconds transition_{kDefaultTransition};
+  bool transition_active_{false};
+  clock::time_point transition_start_;
+
+  fade_t fade_;
+  bool fade_active_{false};
+  bool fade_done_{false};
+  clock::time_point fade_start_;
+  float brightness_{1.0F};
+
+  SteadyTimer tick_;
+  bool ticking_{false};
+  // the frame sent last, the snapshot it is taken from when a transition starts
+  frame_t last_;
+  std::vector<ws2811_led_t> from_;
+  std::vector<ws2811_led_t> mixed_;
+  std::vector<ws2811_led_t> dimmed_;
+  std::vector<ws2811_led_t> clipped_;
+
+  Metrics::Histogram &compose_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_compose_seconds", "Time to compose all layers into the output frame")};
+  Metrics::Counter &transitions_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_transitions_total", "Crossfades started")};
+  Metrics::Gauge &layers_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_compose_layers", "Layers blended into the last output frame")};
+};
+
+#endif // SRC_COMPOSITOR_HPP
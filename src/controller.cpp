@@ -21,7 +21,9 @@
 #include <fmt/format.h>
 #include <nlohmann/json.hpp>
 
+#include "allocations.hpp"
 #include "session.hpp"
+#include "trace.hpp"
 
 #ifndef _MKSTR_1
 #define _MKSTR_1(x) #x
@@ -31,20 +33,42 @@
 #define VER_STR _MKSTR(VER_MAJOR) "." _MKSTR(VER_MINOR) "." _MKSTR(VER_STEP)
 #define WHAT_STR _MKSTR(APPLICATION_NAME) ", Version " VER_STR
 
-Controller::Controller() : Log("ctrl") {
-  I(fmt::format("-------------- {} --------------", WHAT_STR));
-  const std::filesystem::path path{kConfigPath};
+Controller::Controller(const std::string &config_path, uint16_t port,
+                       const std::string &animation_path)
+    : Log("ctrl"), config_path_(config_path), port_(port), animation_path_(animation_path) {
+  I("-------------- {} --------------", WHAT_STR);
+  const std::filesystem::path path{config_path_};
   std::filesystem::create_directories(path);
 
   power_.SigPowerStatusChanged.connect(&Controller::OnPowerStatusChanged, this);
+  light_.SigColorChanged.connect([this]() { Publish(Session::kTopicColor); });
+  animation_.SigAnimationChanged.connect([this]() { Publish(Session::kTopicAnimation); });
+  animation_.SigCatalogChanged.connect([this]() { Publish(Session::kTopicCatalog); });
+  alarm_.SigAlarmChanged.connect([this]() { Publish(Session::kTopicAlarm); });
+  effect_.SigEffectChanged.connect([this]() { Publish(Session::kTopicEffect); });
+  audio_.SigAudioChanged.connect([this]() { Publish(Session::kTopicAudio); });
+  fadeout_.SigFadeoutChanged.connect(
+      [this]() { Publish(Session::kTopicPower | Session::kTopicFadeout); });
+  // the probe would wake up an idle daemon once a second
+  ws2811_control_.SigSuspendChanged.connect([this]() {
+    if (ws2811_control_.GetSuspended()) {
+      probe_.cancel();
+    } else {
+      StartProbe();
+    }
+  });
 
   restore_state_active_ = true;
   try {
-    const nlohmann::json &cfg = LoadState(kConfigPath, kConfigFile);
+    const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
 
     name_ = cfg.value("name", "");
+    Log::SetLevel(cfg.value("log_level", Log::ToString(Log::kDebug)));
+    if (cfg.contains("animation_cache_mb")) {
+      animation_.SetCacheBudget(cfg["animation_cache_mb"].get<std::size_t>() * kMegabyte);
+    }
   } catch (const nlohmann::json::exception &e) {
-    E(fmt::format("Parsing system config failed: {}", e.what()));
+    E("Parsing system config failed: {}", e.what());
   }
   restore_state_active_ = false;
 }
@@ -54,6 +78,13 @@ Controller::~Controller() {}
 int Controller::Exec() {
   sig_.async_wait(
       [this](const asio::error_code &error, int signal_number) { OnSignal(error, signal_number); });
+  sig_dump_.async_wait([this](const asio::error_code &error, int signal_number) {
+    OnDumpTrace(error, signal_number);
+  });
+
+  if (!ws2811_control_.GetSuspended()) {
+    StartProbe();
+  }
 
   if (!SetupUdp()) {
     return -1;
@@ -63,8 +94,25 @@ int Controller::Exec() {
     return -1;
   }
 
+  if (!live_stream_.Start(port_ + 2)) {
+    return -1;
+  }
+
+  // daemons on other ports must not share the segment, it is sized by their LED count
+  const std::string &shm_name = port_ == kPort ? std::string(SharedFrame::kName)
+                                               : fmt::format("{}-{}", SharedFrame::kName, port_);
+  if (!shared_frame_.Start(shm_name)) {
+    return -1;
+  }
+
+  // metrics are optional, keep running without them
+  metrics_server_.Start(port_ + 3);
+  sync_.Start();
+
   D("*** start asio loop ***");
-  io_.run();
+  while (io_.run_one()) {
+    wakeups_total_.Inc();
+  }
 
   return 0;
 }
@@ -73,7 +121,7 @@ bool Controller::SetupUdp() {
   udp_socket_.open(asio::ip::udp::v4());
   asio::socket_base::broadcast option(true);
   udp_socket_.set_option(option);
-  udp_socket_.bind(asio::ip::udp::endpoint(asio::ip::address_v4::any(), kPort));
+  udp_socket_.bind(asio::ip::udp::endpoint(asio::ip::address_v4::any(), port_));
 
   struct ifreq s;
   strcpy(s.ifr_name, "wlan0");
@@ -81,14 +129,17 @@ bool Controller::SetupUdp() {
     const char *mac = s.ifr_addr.sa_data;
     mac_ = fmt::format("{:02X}:{:02X}:{:02X}:{:02X}:{:02X}:{:02X}", mac[0], mac[1], mac[2], mac[3],
                        mac[4], mac[5]);
-    D(fmt::format("MAC address is {}", mac_));
+    D("MAC address is {}", mac_);
   } else {
-    E(fmt::format("Failed to read MAC address from wlan0: {}", strerror(errno)));
+    E("Failed to read MAC address from wlan0: {}", strerror(errno));
   }
 
   udp_socket_.async_receive_from(
       asio::buffer(recv_buffer_), remote_endpoint_,
-      [this](const asio::error_code &error, std::size_t size) { OnReceiveUdp(error, size); });
+      Trace::Wrap("Controller::OnReceiveUdp",
+                  [this](const asio::error_code &error, std::size_t size) {
+                    OnReceiveUdp(error, size);
+                  }));
 
   return true;
 }
@@ -98,23 +149,101 @@ void Controller::SetName(const std::string &name) {
   SaveState();
 }
 
+bool Controller::SetLogLevel(const std::string &level) {
+  if (!Log::SetLevel(level)) {
+    return false;
+  }
+  SaveState();
+  return true;
+}
+
+void Controller::SetAnimationCacheSize(std::size_t megabytes) {
+  animation_.SetCacheBudget(megabytes * kMegabyte);
+  SaveState();
+}
+
 void Controller::SaveState() {
   nlohmann::json cfg;
   cfg["name"] = name_;
+  cfg["log_level"] = Log::ToString(Log::GetLevel());
+  cfg["animation_cache_mb"] = animation_.GetCacheBudget() / kMegabyte;
 
-  IModule::SaveState(kConfigPath, kConfigFile, cfg);
+  IModule::SaveState(config_path_, kConfigFile, cfg);
 }
 
 void Controller::OnSignal(const asio::error_code &error, int signal_number) {
-  I(fmt::format("Controller stopped with signal {}", signal_number));
+  I("Controller stopped with signal {}", signal_number);
 
   is_alive_.store(false);
   udp_socket_.close();
   acceptor_.close();
-  session_->Stop();
-  animation_.Play(false);
+  if (pending_session_) {
+    pending_session_->Stop();
+  }
+  for (auto &session : sessions_) {
+    session->Stop();
+  }
+  animation_.Stop();
   alarm_.Stop();
   fadeout_.Stop();
+  live_stream_.Stop();
+  shared_frame_.Stop();
+  effect_.Stop();
+  audio_.Stop();
+  sync_.Stop();
+  metrics_server_.Stop();
+  sig_dump_.cancel();
+  probe_.cancel();
+}
+
+void Controller::OnDumpTrace(const asio::error_code &error, int signal_number) {
+  if (error) {
+    return;
+  }
+
+  if (Trace::Dump(kTraceFile)) {
+    I("Trace written to {}", kTraceFile);
+  } else {
+    E("Failed to write trace to {}", kTraceFile);
+  }
+
+  sig_dump_.async_wait([this](const asio::error_code &error, int signal_number) {
+    OnDumpTrace(error, signal_number);
+  });
+}
+
+void Controller::StartProbe() {
+  if (!is_alive_.load()) {
+    return;
+  }
+  probe_.expires_after(kProbeInterval);
+  probe_.async_wait(Trace::Wrap(
+      "Controller::OnProbe", [this](const asio::error_code &error) { OnProbe(error); },
+      probe_.expiry()));
+}
+
+void Controller::OnProbe(const asio::error_code &error) {
+  if (error) {
+    return;
+  }
+
+  // the probe does nothing but measure how late the loop is able to serve it
+  const auto &now = std::chrono::steady_clock::now();
+  loop_lag_seconds_.Observe(now - probe_.expiry());
+
+  const uint64_t allocations = Allocations::GetCount();
+  const uint64_t frames = frames_total_.Get();
+  allocations_total_.Inc(allocations - last_allocations_);
+  allocations_per_frame_.Set(frames == last_frames_ ? 0.0
+                                                    : double(allocations - last_allocations_) /
+                                                          (frames - last_frames_));
+  last_allocations_ = allocations;
+  last_frames_ = frames;
+
+  probe_.expires_at(std::max(probe_.expiry() + kProbeInterval, now));
+  probe_.async_wait(Trace::Wrap(
+      "Controller::OnProbe", [this](const asio::error_code &error) { OnProbe(error); },
+      probe_.expiry()));
 }
 
 void Controller::OnReceiveUdp(const asio::error_code &error, std::size_t size) {
@@ -122,44 +251,94 @@ void Controller::OnReceiveUdp(const asio::error_code &error, std::size_t size) {
     recv_buffer_[size] = 0;
     try {
       const nlohmann::json &msg = nlohmann::json::parse(recv_buffer_);
-      if (msg["cmd"] == "identify") {
+      if (msg.value("cmd", "") == "identify") {
         nlohmann::json resp;
         resp["rsp"] = "identify";
         resp["name"] = name_;
         resp["mac"] = mac_;
 
         udp_socket_.send_to(asio::buffer(resp.dump()), remote_endpoint_);
+        identify_total_.Inc();
+      } else {
+        sync_.OnMessage(msg, remote_endpoint_);
       }
     } catch (const std::exception &e) {
-      E(fmt::format("Parsing message failed: {}", e.what()));
+      E("Parsing message failed: {}", e.what());
     }
   } else {
-    E(fmt::format("On receive UDP failed: {}", error.message()));
+    E("On receive UDP failed: {}", error.message());
   }
 
   if (is_alive_.load()) {
     udp_socket_.async_receive_from(
         asio::buffer(recv_buffer_), remote_endpoint_,
-        [this](const asio::error_code &error, std::size_t size) { OnReceiveUdp(error, size); });
+        Trace::Wrap("Controller::OnReceiveUdp",
+                  [this](const asio::error_code &error, std::size_t size) {
+                    OnReceiveUdp(error, size);
+                  }));
   }
 }
 
 bool Controller::StartServer() {
-  session_ = std::unique_ptr<Session>(new Session(io_, *this));
-  acceptor_.async_accept(session_->Socket(), [this](const asio::error_code &error) {
-    if (!error) {
-      D("New connection");
-      session_->Exec();
-    } else {
-      E(fmt::format("Server failed: {}", error.message()));
-    }
-  });
+  pending_session_ = std::unique_ptr<Session>(new Session(io_, *this));
+  acceptor_.async_accept(
+      pending_session_->Socket(),
+      Trace::Wrap("Controller::OnAccept", [this](const asio::error_code &error) {
+        if (error) {
+          E("Server failed: {}", error.message());
+          return;
+        }
+
+        if (sessions_.size() < kMaxSessions) {
+          D("New connection, {} sessions", sessions_.size() + 1);
+          sessions_.push_back(std::move(pending_session_));
+          sessions_.back()->Exec();
+          sessions_gauge_.Set(sessions_.size());
+        } else {
+          E("Too many sessions, reject connection");
+          pending_session_->Stop();
+        }
+
+        if (is_alive_.load()) {
+          StartServer();
+        }
+      }));
   return true;
 }
 
+void Controller::CloseSession(Session *session) {
+  sessions_.remove_if([session](const std::unique_ptr<Session> &s) { return s.get() == session; });
+  sessions_gauge_.Set(sessions_.size());
+  D("Session closed, {} sessions", sessions_.size());
+}
+
 void Controller::OnPowerStatusChanged() {
   D("OnPowerStatusChanged");
-  if (session_) {
-    session_->SendPowerStatus();
+  // legacy clients get the full power status on each change
+  for (auto &session : sessions_) {
+    if (!session->IsSubscribed()) {
+      session->SendPowerStatus();
+    }
+  }
+  Publish(Session::kTopicPower);
+}
+
+void Controller::Publish(uint32_t topics) {
+  // collect all changes of the current handler into a single notification
+  const bool scheduled = pending_topics_ != 0;
+  pending_topics_ |= topics;
+  if (scheduled) {
+    return;
   }
+
+  asio::post(io_, Trace::Wrap(
+                       "Controller::Publish",
+                       [this]() {
+                         const uint32_t topics = pending_topics_;
+                         pending_topics_ = 0;
+                         for (auto &session : sessions_) {
+                           session->Notify(topics);
+                         }
+                       },
+                       std::chrono::steady_clock::now()));
 }
@@ -19,25 +19,46 @@
 #define SRC_CONTROLER_HPP
 
 #include <asio.hpp>
+#include <list>
 
 #include "alarm.hpp"
 #include "animation.hpp"
+#include "audio.hpp"
+#include "effect.hpp"
 #include "fadeout.hpp"
 #include "i_module.hpp"
 #include "light.hpp"
+#include "live_stream.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
+#include "metrics_server.hpp"
 #include "power.hpp"
+#include "shared_frame.hpp"
+#include "sync.hpp"
 #include "ws2811_control.hpp"
 
 class Controller : public Log, public IModule {
 public:
-  Controller();
+  static constexpr uint16_t kPort = 7755;
+  static constexpr const char *kConfigPath = "/home/pi/.config/led_control/";
+
+  /**
+   * @brief Control the strip, `port` is the UDP port, the ports of all servers follow it
+   *
+   * Animations are read from `animation_path`.
+   */
+  Controller(const std::string &config_path = kConfigPath, uint16_t port = kPort,
+             const std::string &animation_path = Animation::kAnimationPath);
   virtual ~Controller();
 
   int Exec();
   bool StartServer();
+  void CloseSession(class Session *session);
   void SetName(const std::string &name);
   const std::string &GetName() const { return name_; }
+  bool SetLogLevel(const std::string &level);
+  void SetAnimationCacheSize(std::size_t megabytes);
+  std::size_t GetAnimationCacheSize() const { return animation_.GetCacheBudget() / kMegabyte; }
 
   WS2811Control &GetWS2811Control() { return ws2811_control_; }
   Power &GetPower() { return power_; }
@@ -45,42 +66,83 @@ public:
   Animation &GetAnimation() { return animation_; }
   Alarm &GetAlarm() { return alarm_; }
   Fadeout &GetFadeout() { return fadeout_; }
+  LiveStream &GetLiveStream() { return live_stream_; }
+  SharedFrame &GetSharedFrame() { return shared_frame_; }
+  Effect &GetEffect() { return effect_; }
+  Audio &GetAudio() { return audio_; }
+  Sync &GetSync() { return sync_; }
 
 private:
-  static constexpr uint16_t kPort = 7755;
-  static constexpr const char *kConfigPath = "/home/pi/.config/led_control/";
+  static constexpr std::size_t kMaxSessions = 16;
+  static constexpr std::size_t kMegabyte = 1024 * 1024;
+  static constexpr auto kProbeInterval = std::chrono::seconds(1);
+  static constexpr const char *kTraceFile = "/tmp/ledcontrol-trace.json";
   static constexpr const char *kConfigFile = "controller.json";
 
   void OnSignal(const asio::error_code &error, int signal_number);
+  void OnDumpTrace(const asio::error_code &error, int signal_number);
+  void StartProbe();
+  void OnProbe(const asio::error_code &error);
   void OnReceiveUdp(const asio::error_code &error, std::size_t size);
   void OnPowerStatusChanged();
+  void Publish(uint32_t topics);
 
   bool SetupUdp();
   void SaveState() override;
 
+  const std::string config_path_;
+  const uint16_t port_;
+  const std::string animation_path_;
   std::atomic_bool is_alive_{true};
 
   asio::io_context io_;
   asio::signal_set sig_ = {io_, SIGINT, SIGTERM};
+  asio::signal_set sig_dump_ = {io_, SIGUSR1};
+  asio::steady_timer probe_{io_};
 
   asio::ip::udp::socket udp_socket_{io_};
   asio::ip::udp::endpoint remote_endpoint_;
   std::array<int8_t, 1024> recv_buffer_;
 
-  asio::ip::tcp::endpoint endpoint_{asio::ip::tcp::v4(), 7756};
+  asio::ip::tcp::endpoint endpoint_{asio::ip::tcp::v4(), uint16_t(port_ + 1)};
   asio::ip::tcp::acceptor acceptor_{io_, endpoint_};
-  std::unique_ptr<class Session> session_;
+  std::unique_ptr<class Session> pending_session_;
+  std::list<std::unique_ptr<class Session>> sessions_;
+  uint32_t pending_topics_{0};
+
+  MetricsServer metrics_server_{io_};
+  Metrics::Gauge &sessions_gauge_{
+      Metrics::Instance().GetGauge("ledcontrol_sessions", "Connected TCP sessions")};
+  Metrics::Counter &wakeups_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_wakeups_total", "Handlers run by the io loop, each one a wakeup of the daemon")};
+  Metrics::Counter &identify_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_identify_total", "UDP identify requests answered")};
+  Metrics::Histogram &loop_lag_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_loop_lag_seconds", "Delay of the periodic probe timer behind its expiry")};
+  Metrics::Counter &allocations_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_heap_allocations_total", "Heap allocations, updated by the probe timer")};
+  Metrics::Gauge &allocations_per_frame_{Metrics::Instance().GetGauge(
+      "ledcontrol_heap_allocations_per_frame", "Heap allocations per frame in the last second")};
+  Metrics::Counter &frames_total_{
+      Metrics::Instance().GetCounter("ledcontrol_frames_total", "Frames rendered to the strip")};
+  uint64_t last_allocations_{0};
+  uint64_t last_frames_{0};
 
   std::string name_;
   std::string mac_;
 
-  WS2811Control ws2811_control_{kConfigPath};
-  Power power_{kConfigPath, ws2811_control_};
-  Fadeout fadeout_{io_, power_, ws2811_control_};
-
-  Light light_{kConfigPath, power_};
-  Animation animation_{io_, power_};
-  Alarm alarm_{kConfigPath, io_, power_, animation_};
+  WS2811Control ws2811_control_{config_path_};
+  Power power_{config_path_, io_, ws2811_control_};
+  Fadeout fadeout_{config_path_, io_, power_};
+
+  Light light_{config_path_, power_};
+  Animation animation_{io_, power_, animation_path_};
+  Alarm alarm_{config_path_, io_, power_, animation_};
+  LiveStream live_stream_{io_, power_};
+  SharedFrame shared_frame_{io_, power_};
+  Effect effect_{config_path_, io_, power_};
+  Audio audio_{config_path_, io_, power_, ws2811_control_};
+  Sync sync_{config_path_, io_, udp_socket_, port_, power_, animation_};
 };
 
 #endif // SRC_CONTROLER_HPP
@@ -0,0 +1,95 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "current_limiter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void CurrentLimiter::Sum(const ws2811_led_t *leds, std::size_t count, sums_t &sums) {
+  // Blocks of 256 LEDs are summed in two 32 bit accumulators with 16 bit lanes, one for the
+  // even and one for the odd bytes. 256 * 255 fits into a lane. The inner loop has no
+  // dependencies between the LEDs and is vectorized by the compiler.
+  constexpr std::size_t kBlock = 256;
+  while (count != 0) {
+    const std::size_t n = std::min(count, kBlock);
+    uint32_t even = 0;
+    uint32_t odd = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      even += leds[i] & 0x00FF00FF;
+      odd += (leds[i] >> 8) & 0x00FF00FF;
+    }
+    sums[0] += even & 0xFFFF;
+    sums[1] += odd & 0xFFFF;
+    sums[2] += even >> 16;
+    sums[3] += odd >> 16;
+    leds += n;
+    count -= n;
+  }
+}
+
+void CurrentLimiter::SetBudget(uint32_t budget_ma) {
+  budget_ma_ = budget_ma;
+  scale_ = 1.0;
+}
+
+uint8_t CurrentLimiter::Update(const sums_t &sums, std::size_t count, uint8_t max_brightness) {
+  // current of the values at full brightness, the hardware scales them by (brightness + 1) / 256
+  const double idle = model_.idle_ma * count;
+  const double full = (sums[0] * model_.blue_ma + sums[1] * model_.green_ma +
+                       sums[2] * model_.red_ma + sums[3] * model_.white_ma) /
+                      255.0;
+  const double max_factor = (max_brightness + 1) / 256.0;
+
+  if (budget_ma_ != 0) {
+    double target = 1.0;
+    if (full * max_factor > 0.0) {
+      target = std::clamp((budget_ma_ - idle) / (full * max_factor), 0.0, 1.0);
+    }
+
+    // full brightness is restored even if it is within the hysteresis of the current scale
+    if (target < scale_ || target >= 1.0 || target > scale_ + kHysteresis) {
+      scale_ = target;
+    }
+  }
+
+  uint8_t brightness = max_brightness;
+  if (scale_ < 1.0) {
+    // round down to stay within the budget
+    const double factor = scale_ * max_factor;
+    brightness = std::clamp(int(std::floor(factor * 256.0)) - 1, 0, int(max_brightness));
+  }
+  current_ma_ = idle + full * (brightness + 1) / 256.0;
+  return brightness;
+}
+
+void to_json(nlohmann::json &j, const CurrentLimiter::model_t &model) {
+  j = nlohmann::json{{"red_ma", model.red_ma},
+                     {"green_ma", model.green_ma},
+                     {"blue_ma", model.blue_ma},
+                     {"white_ma", model.white_ma},
+                     {"idle_ma", model.idle_ma}};
+}
+
+void from_json(const nlohmann::json &j, CurrentLimiter::model_t &model) {
+  const CurrentLimiter::model_t defaults;
+  model.red_ma = j.value("red_ma", defaults.red_ma);
+  model.green_ma = j.value("green_ma", defaults.green_ma);
+  model.blue_ma = j.value("blue_ma", defaults.blue_ma);
+  model.white_ma = j.value("white_ma", defaults.white_ma);
+  model.idle_ma = j.value("idle_ma", defaults.idle_ma);
+}
@@ -0,0 +1,85 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_CURRENT_LIMITER_HPP
+#define SRC_CURRENT_LIMITER_HPP
+
+#include <array>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <ws2811/ws2811.h>
+
+/**
+ * @brief Estimate of the supply current of a frame and a limiter to keep it within a budget
+ *
+ * The current is modeled as a quiescent current per LED plus a weight per color channel,
+ * scaled by its value and the hardware brightness. The limiter lowers the brightness of a frame
+ * just enough to stay within the budget. It reacts at once to a frame above the budget but
+ * raises the brightness again only if a frame allows for more than the hysteresis, so content
+ * near the budget does not pump.
+ */
+class CurrentLimiter {
+public:
+  // channel sums in the byte order of ws2811_led_t (0xWWRRGGBB)
+  using sums_t = std::array<uint64_t, 4>;
+
+  struct model_t {
+    // current of a single LED at full value per channel and its quiescent current
+    double red_ma{20.0};
+    double green_ma{20.0};
+    double blue_ma{20.0};
+    double white_ma{20.0};
+    double idle_ma{1.0};
+  };
+
+  /** @brief Add the channel values of the LEDs to `sums` */
+  static void Sum(const ws2811_led_t *leds, std::size_t count, sums_t &sums);
+
+  void SetModel(const model_t &model) { model_ = model; }
+  const model_t &GetModel() const { return model_; }
+  /** @brief Budget in mA, 0 disables the limiter. The next frame is limited from scratch. */
+  void SetBudget(uint32_t budget_ma);
+  uint32_t GetBudget() const { return budget_ma_; }
+
+  /**
+   * @brief Estimate the frame and compute its brightness
+   * @param sums channel sums of the frame
+   * @param count LEDs of the frame
+   * @param max_brightness configured brightness of the hardware
+   * @return brightness for the hardware
+   */
+  uint8_t Update(const sums_t &sums, std::size_t count, uint8_t max_brightness);
+
+  /** @brief Estimated current of the last frame at its limited brightness */
+  double GetCurrent() const { return current_ma_; }
+  /** @brief Applied scale of the brightness, 1 if not limited */
+  double GetScale() const { return scale_; }
+
+private:
+  // raise the brightness only if the frame allows for that much more
+  static constexpr double kHysteresis = 0.05;
+
+  model_t model_;
+  uint32_t budget_ma_{0};
+  double scale_{1.0};
+  double current_ma_{0.0};
+};
+
+void to_json(nlohmann::json &j, const CurrentLimiter::model_t &model);
+void from_json(const nlohmann::json &j, CurrentLimiter::model_t &model);
+
+#endif // SRC_CURRENT_LIMITER_HPP
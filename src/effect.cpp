@@ -0,0 +1,154 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "effect.hpp"
+
+#include <fmt/format.h>
+#include <nlohmann/json.hpp>
+
+#include "power.hpp"
+#include "trace.hpp"
+
+Effect::Effect(const std::string &config_path, asio::io_context &io, Power &power)
+    : Log("effect"), config_path_(config_path), power_(power), timer_(io) {
+  power_.SigPowerStatusChanged.connect(&Effect::OnPowerStatusChanged, this);
+  power_.SigLedCountChanged.connect([this]() {
+    if (active_) {
+      Render(false);
+    }
+  });
+
+  restore_state_active_ = true;
+  try {
+    const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
+    std::string error;
+    if (!SetEffect(cfg.value("source", ""),
+                   cfg.value("params", std::map<std::string, float>()), error)) {
+      E("Compiling effect failed: {}", error);
+    }
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing config failed: {}", e.what());
+  }
+  restore_state_active_ = false;
+
+  // the channel might have been restored as active already
+  OnPowerStatusChanged();
+}
+
+Effect::~Effect() {}
+
+void Effect::SaveState() {
+  nlohmann::json cfg;
+  cfg["source"] = source_;
+  cfg["params"] = params_;
+  IModule::SaveState(config_path_, kConfigFile, cfg);
+}
+
+void Effect::Stop() {
+  active_ = false;
+  timer_.cancel();
+}
+
+bool Effect::SetEffect(const std::string &source, const std::map<std::string, float> &params,
+                       std::string &error) {
+  std::vector<std::string> names;
+  for (const auto &[name, value] : params) {
+    names.push_back(name);
+  }
+  if (!shader_.Compile(source, names, error)) {
+    return false;
+  }
+  for (const auto &[name, value] : params) {
+    shader_.SetParam(name, value);
+  }
+  // new parameters keep the running program's time
+  if (source != source_) {
+    start_ = clock::now();
+  }
+  source_ = source;
+  params_ = params;
+  I("Effect with {} instructions", shader_.GetInstructionCount());
+
+  if (active_) {
+    Render(true);
+    StartTick();
+  }
+  SaveState();
+  SigEffectChanged();
+  return true;
+}
+
+void Effect::OnPowerStatusChanged() {
+  const bool active = power_.GetChannelState(Power::kEffect);
+  if (active == active_) {
+    return;
+  }
+
+  active_ = active;
+  if (active_) {
+    start_ = clock::now();
+    Render(false);
+    StartTick();
+  } else {
+    timer_.cancel();
+  }
+}
+
+void Effect::StartTick() {
+  timer_.cancel();
+  if (!shader_.GetTimeDependent()) {
+    return;
+  }
+  timer_.expires_after(kTickInterval);
+  timer_.async_wait(Trace::Wrap(
+      "Effect::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+      timer_.expiry()));
+}
+
+void Effect::OnTick(const asio::error_code &error) {
+  if (error || !active_) {
+    return;
+  }
+
+  Render(false);
+
+  timer_.expires_at(timer_.expiry() + kTickInterval);
+  timer_.async_wait(Trace::Wrap(
+      "Effect::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+      timer_.expiry()));
+}
+
+std::size_t Effect::GetLength() const {
+  for (const Compositor::segment_t &segment : power_.GetSegments()) {
+    if (segment.layer == Power::kEffect) {
+      return segment.length;
+    }
+  }
+  return power_.GetLedCount();
+}
+
+void Effect::Render(bool fade) {
+  Metrics::ScopedTimer timer(render_seconds_);
+  frames_total_.Inc();
+
+  frame_index_ = (frame_index_ + 1) % frames_.size();
+  std::vector<ws2811_led_t> &frame = frames_[frame_index_];
+  frame.resize(GetLength());
+  const float time = std::chrono::duration<float>(clock::now() - start_).count();
+  shader_.Render(frame.data(), frame.size(), time);
+  power_.SetChannelFrame(Power::kEffect, frame, fade);
+}
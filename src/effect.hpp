@@ -0,0 +1,96 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_EFFECT_HPP
+#define SRC_EFFECT_HPP
+
+#include <array>
+#include <asio.hpp>
+#include <map>
+#include <sigslot/signal.hpp>
+#include <string>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+#include "clock.hpp"
+#include "i_module.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+#include "shader.hpp"
+
+class Power;
+
+/**
+ * @brief Frame source evaluating a Shader program per pixel
+ *
+ * The program and its parameters are uploaded by clients and kept in the configuration. While
+ * the channel is on the frame is rendered each tick, a program not reading the time `t` is
+ * rendered once only. The pixel count is the length of the first segment showing the channel,
+ * the whole strip without one.
+ */
+class Effect : public Log, public IModule {
+public:
+  Effect(const std::string &config_path, asio::io_context &io, Power &power);
+  virtual ~Effect();
+
+  void Stop();
+
+  /**
+   * @brief Compile and show a program
+   *
+   * On failure `error` holds the reason with line and column, the current effect stays.
+   */
+  bool SetEffect(const std::string &source, const std::map<std::string, float> &params,
+                 std::string &error);
+  const std::string &GetSource() const { return source_; }
+  const std::map<std::string, float> &GetParams() const { return params_; }
+  std::size_t GetInstructionCount() const { return shader_.GetInstructionCount(); }
+
+  sigslot::signal_st<> SigEffectChanged;
+
+private:
+  using clock = Clock;
+  static constexpr const char *kConfigFile = "effect.json";
+  static constexpr auto kTickInterval = std::chrono::milliseconds(20);
+
+  void SaveState() override;
+  void OnPowerStatusChanged();
+  void OnTick(const asio::error_code &error);
+  void StartTick();
+  void Render(bool fade);
+  std::size_t GetLength() const;
+
+  const std::string config_path_;
+  Power &power_;
+  SteadyTimer timer_;
+  bool active_{false};
+  clock::time_point start_;
+
+  Shader shader_;
+  std::string source_;
+  std::map<std::string, float> params_;
+  // the previous frame is the start of the crossfade to a new program
+  std::array<std::vector<ws2811_led_t>, 2> frames_;
+  std::size_t frame_index_{0};
+
+  Metrics::Histogram &render_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_effect_render_seconds", "Time to evaluate the effect program for a frame")};
+  Metrics::Counter &frames_total_{
+      Metrics::Instance().GetCounter("ledcontrol_effect_frames_total", "Frames of the effect")};
+};
+
+#endif // SRC_EFFECT_HPP
@@ -0,0 +1,89 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "fade.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// the level treated as off by the exponential curve, below the smallest step of 8 bit
+static constexpr float kExponentialFloor = 1.0F / 512;
+
+// CIE 1976 lightness 0..1 of a relative luminance 0..1 and back
+static float ToLightness(float luminance) {
+  if (luminance <= 216.0F / 24389) {
+    return luminance * (24389.0F / 27) / 100;
+  }
+  return (116 * std::cbrt(luminance) - 16) / 100;
+}
+
+static float FromLightness(float lightness) {
+  if (lightness <= 0.08F) {
+    return lightness * 100 * (27.0F / 24389);
+  }
+  const float f = (lightness * 100 + 16) / 116;
+  return f * f * f;
+}
+
+float fade_t::GetBrightness(std::chrono::steady_clock::duration elapsed) const {
+  if (elapsed >= duration) {
+    return to;
+  }
+  const float p = std::max(std::chrono::duration<float>(elapsed) / duration, 0.0F);
+
+  switch (easing) {
+  case easing_e::linear:
+    return from + (to - from) * p;
+  case easing_e::exponential: {
+    const float a = std::log(std::max(from, kExponentialFloor));
+    const float b = std::log(std::max(to, kExponentialFloor));
+    const float level = std::exp(a + (b - a) * p);
+    return level <= kExponentialFloor ? 0.0F : level;
+  }
+  case easing_e::perceptual: {
+    const float a = ToLightness(from);
+    const float b = ToLightness(to);
+    return FromLightness(a + (b - a) * p);
+  }
+  }
+  return to;
+}
+
+bool fade_t::FromString(const std::string &name, easing_e &easing) {
+  if (name == "linear") {
+    easing = easing_e::linear;
+  } else if (name == "exponential") {
+    easing = easing_e::exponential;
+  } else if (name == "perceptual") {
+    easing = easing_e::perceptual;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *fade_t::ToString(easing_e easing) {
+  switch (easing) {
+  case easing_e::linear:
+    return "linear";
+  case easing_e::exponential:
+    return "exponential";
+  case easing_e::perceptual:
+    return "perceptual";
+  }
+  return "";
+}
@@ -0,0 +1,47 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_FADE_HPP
+#define SRC_FADE_HPP
+
+#include <chrono>
+#include <string>
+
+/**
+ * @brief A fade of the master brightness from one level to another
+ *
+ * The brightness is computed from the elapsed time for each output frame. The easing curve
+ * defines the space the levels are interpolated in: `linear` in output level, `exponential`
+ * in log space with the same ratio per time, `perceptual` in CIE lightness, so the fade looks
+ * evenly paced to the eye.
+ */
+struct fade_t {
+  enum class easing_e { linear, exponential, perceptual };
+
+  float from{1.0F};
+  float to{1.0F};
+  std::chrono::steady_clock::duration duration{};
+  easing_e easing{easing_e::perceptual};
+
+  /** @brief Brightness 0..1 after the elapsed time */
+  float GetBrightness(std::chrono::steady_clock::duration elapsed) const;
+
+  static bool FromString(const std::string &name, easing_e &easing);
+  static const char *ToString(easing_e easing);
+};
+
+#endif // SRC_FADE_HPP
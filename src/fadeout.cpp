@@ -18,25 +18,51 @@
 
 #include "fadeout.hpp"
 
+#include <algorithm>
 #include <fmt/format.h>
 
-#include "ws2811_control.hpp"
+#include "compositor.hpp"
+#include "trace.hpp"
 
-Fadeout::Fadeout(asio::io_context &io, Power &power, WS2811Control &ws2811_control)
-    : Log("fadeout"), power_(power), ws2811_control_(ws2811_control), timeout_power_(io),
-      timer_fade_out_(io) {
+Fadeout::Fadeout(const std::string &config_path, asio::io_context &io, Power &power)
+    : Log("fadeout"), config_path_(config_path), power_(power), timeout_power_(io) {
   power_.SigPowerStatusChanged.connect(&Fadeout::OnPowerStatusChanged, this);
+  power_.GetCompositor().SigFadeDone.connect(&Fadeout::OnFadeDone, this);
+  power_.GetCompositor().SigBrightnessChanged.connect(&Fadeout::OnBrightnessChanged, this);
+
+  restore_state_active_ = true;
+  try {
+    const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
+    fade_t::easing_e easing = fade_easing_;
+    fade_t::FromString(cfg.value("easing", fade_t::ToString(easing)), easing);
+    SetFade(std::chrono::seconds(cfg.value("fade_seconds", fade_duration_.count())), easing);
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing config failed: {}", e.what());
+  }
+  restore_state_active_ = false;
 }
 
 Fadeout::~Fadeout() {}
 
+void Fadeout::SaveState() {
+  nlohmann::json cfg;
+  cfg["fade_seconds"] = fade_duration_.count();
+  cfg["easing"] = fade_t::ToString(fade_easing_);
+  IModule::SaveState(config_path_, kConfigFile, cfg);
+}
+
 void Fadeout::Stop() {
-  std::size_t n = 0;
-  n += timeout_power_.cancel();
-  n += timer_fade_out_.cancel();
-  if (n != 0) {
+  bool active = timeout_power_.cancel() != 0;
+  if (fading_) {
+    // reset first, StopFade() reports the abort to OnFadeDone()
+    fading_ = false;
+    active = true;
+    power_.GetCompositor().StopFade();
+  }
+  if (active) {
     I("StopPowerTimeout");
     target_ = Power::kNone;
+    SigFadeoutChanged();
   }
 }
 
@@ -49,16 +75,23 @@ void Fadeout::OnPowerStatusChanged() {
   }
 }
 
+bool Fadeout::SetFade(std::chrono::seconds duration, fade_t::easing_e easing) {
+  if (duration.count() < 0) {
+    E("Invalid fade duration {}s", duration.count());
+    return false;
+  }
+  fade_duration_ = duration;
+  fade_easing_ = easing;
+  SaveState();
+  return true;
+}
+
 void Fadeout::SetTimeout(const std::string &target, std::chrono::minutes minutes) {
   I("SetPowerTimeout");
   Stop();
 
-  target_ = Power::kNone;
-  if (target == "animation") {
-    target_ = Power::kAnimation;
-  } else if (target == "light") {
-    target_ = Power::kLight;
-  } else {
+  target_ = Power::GetChannel(target);
+  if (target_ == Power::kNone) {
     return;
   }
 
@@ -68,39 +101,56 @@ void Fadeout::SetTimeout(const std::string &target, std::chrono::minutes minutes
     power_.SigPowerStatusChanged();
   }
 
-  timeout_power_.expires_after(minutes - kFadeoutSteps * kFadeoutInterval);
-  timeout_power_.async_wait([this](const asio::error_code &error) {
-    I(fmt::format("PowerTimeout {} {}", error.message(), error.value()));
-    if (!error) {
-      OnStartFadeOut();
-    }
-  });
+  SigFadeoutChanged();
+
+  timeout_fade_ = std::min<std::chrono::seconds>(fade_duration_, minutes);
+  timeout_power_.expires_after(minutes - timeout_fade_);
+  timeout_power_.async_wait(Trace::Wrap(
+      "Fadeout::OnTimeout",
+      [this](const asio::error_code &error) {
+        I("PowerTimeout {} {}", error.message(), error.value());
+        if (!error) {
+          OnStartFadeOut();
+        }
+      },
+      timeout_power_.expiry()));
 }
 
 void Fadeout::OnStartFadeOut() {
-  I("OnStartFadeOut");
-  uint8_t count = 1;
+  I("OnStartFadeOut {}s {}", timeout_fade_.count(), fade_t::ToString(fade_easing_));
+  fade_t fade;
+  fade.from = power_.GetCompositor().GetBrightness();
+  fade.to = 0.0F;
+  fade.duration = timeout_fade_;
+  fade.easing = fade_easing_;
+
+  power_.GetCompositor().StartFade(fade);
+  fading_ = true;
+  last_report_ = Clock::now();
+}
 
-  timer_fade_out_.expires_after(kFadeoutInterval);
-  timer_fade_out_.async_wait(
-      [this, count](const asio::error_code &error) { OnFadeOut(count, error); });
+void Fadeout::OnBrightnessChanged() {
+  const Clock::time_point &now = Clock::now();
+  if (fading_ && now - last_report_ >= kReportInterval) {
+    last_report_ = now;
+    SigFadeoutChanged();
+  }
 }
 
-void Fadeout::OnFadeOut(uint8_t count, const asio::error_code &error) {
-  if (!error) {
-    float brightness = 1.0 - count++ / float(kFadeoutSteps);
-    if (brightness > 0) {
-      ws2811_control_.SetBrightness(brightness);
-
-      timer_fade_out_.expires_at(timer_fade_out_.expiry() + kFadeoutInterval);
-      timer_fade_out_.async_wait(
-          [this, count](const asio::error_code &error) { OnFadeOut(count, error); });
-    } else {
-      Power::channel_e channel = target_;
-      target_ = Power::kNone; // must be set before calling SetChannelState()
-      power_.SetChannelState(channel, false);
-    }
+void Fadeout::OnFadeDone(bool completed) {
+  if (!fading_) {
+    return;
+  }
+  fading_ = false;
+
+  Power::channel_e channel = target_;
+  target_ = Power::kNone; // must be set before calling SetChannelState()
+  if (completed) {
+    power_.SetChannelState(channel, false);
+    power_.GetCompositor().StopFade();
   } else {
-    target_ = Power::kNone;
+    // replaced by another fade, e.g. the fade-in of an alarm
+    I("Fadeout aborted");
   }
+  SigFadeoutChanged();
 }
@@ -20,37 +20,62 @@
 
 #include <asio.hpp>
 
+#include "clock.hpp"
+#include "fade.hpp"
+#include "i_module.hpp"
 #include "log.hpp"
 #include "power.hpp"
 
 class Power;
-class WS2811Control;
 
-class Fadeout : public Log {
+/**
+ * @brief Switch a channel off after a timeout
+ *
+ * The last part of the timeout fades the master brightness to off, computed per output frame
+ * by the compositor. The fade's duration and easing are set independently of the timeout, a
+ * fade longer than the timeout starts right away and is shortened to end by the timeout.
+ */
+class Fadeout : public Log, public IModule {
 public:
-  Fadeout(asio::io_context &io, Power &power, WS2811Control &ws2811_control);
+  Fadeout(const std::string &config_path, asio::io_context &io, Power &power);
   ~Fadeout();
 
   void SetTimeout(const std::string &target, std::chrono::minutes minutes);
+  /** @brief Set the fade of the following timeouts, false for a negative duration */
+  bool SetFade(std::chrono::seconds duration, fade_t::easing_e easing);
+  std::chrono::seconds GetFadeDuration() const { return fade_duration_; }
+  fade_t::easing_e GetFadeEasing() const { return fade_easing_; }
   bool GetTimeoutActive() const { return target_ != Power::kNone; }
+  float GetBrightness() const { return power_.GetCompositor().GetBrightness(); }
 
   void Stop();
 
+  sigslot::signal_st<> SigFadeoutChanged;
+
 private:
-  static constexpr auto kFadeoutInterval = std::chrono::seconds(1);
-  static constexpr auto kFadeoutSteps = 100;
+  static constexpr const char *kConfigFile = "fadeout.json";
+  static constexpr auto kDefaultFadeDuration = std::chrono::seconds(100);
+  // subscribers get the brightness at this rate, not per frame
+  static constexpr auto kReportInterval = std::chrono::seconds(1);
 
+  void SaveState() override;
   void OnStartFadeOut();
-  void OnFadeOut(uint8_t count, const asio::error_code &error);
+  void OnFadeDone(bool completed);
+  void OnBrightnessChanged();
   void OnPowerStatusChanged();
 
+  const std::string config_path_;
   Power &power_;
-  WS2811Control &ws2811_control_;
 
-  asio::steady_timer timeout_power_;
-  asio::steady_timer timer_fade_out_;
+  SteadyTimer timeout_power_;
 
   Power::channel_e target_{Power::kNone};
+  bool fading_{false};
+  std::chrono::steady_clock::time_point last_report_;
+  std::chrono::seconds fade_duration_{kDefaultFadeDuration};
+  // the fade of the running timeout, shortened to end by the timeout
+  std::chrono::seconds timeout_fade_{kDefaultFadeDuration};
+  fade_t::easing_e fade_easing_{fade_t::easing_e::perceptual};
 };
 
 #endif // SRC_FADEOUT_HPP
@@ -0,0 +1,44 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_FRAME_HPP
+#define SRC_FRAME_HPP
+
+#include <memory>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+/**
+ * @brief Read only view of a frame
+ *
+ * Frames are passed by reference to their storage down to the driver, which does the only
+ * copy. The source of a frame has to keep the storage unchanged as long as the frame is set,
+ * or share its ownership by `owner`.
+ */
+struct frame_t {
+  frame_t() = default;
+  frame_t(const ws2811_led_t *data, std::size_t size, std::shared_ptr<const void> owner = nullptr)
+      : data(data), size(size), owner(std::move(owner)) {}
+  frame_t(const std::vector<ws2811_led_t> &frame, std::shared_ptr<const void> owner = nullptr)
+      : frame_t(frame.data(), frame.size(), std::move(owner)) {}
+
+  const ws2811_led_t *data{nullptr};
+  std::size_t size{0};
+  std::shared_ptr<const void> owner;
+};
+
+#endif // SRC_FRAME_HPP
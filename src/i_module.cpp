@@ -20,12 +20,24 @@
 #include <filesystem>
 #include <fstream>
 
+#include "metrics.hpp"
+#include "trace.hpp"
+
 void IModule::SaveState(const std::string &path, const std::string &filename,
                        const nlohmann::json &json) {
 
   if (restore_state_active_) {
     return;
   }
+
+  static Metrics::Counter &writes_total =
+      Metrics::Instance().GetCounter("ledcontrol_state_writes_total", "Configuration files written");
+  static Metrics::Histogram &write_seconds = Metrics::Instance().GetHistogram(
+      "ledcontrol_state_write_seconds", "Time to write a configuration file");
+  writes_total.Inc();
+  Metrics::ScopedTimer timer(write_seconds);
+  Trace::Span span("IModule::SaveState");
+
   std::filesystem::path filepath{path};
   filepath /= filename;
 
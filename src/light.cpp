@@ -24,6 +24,8 @@
 
 Light::Light(const std::string &config_path, Power &power)
     : Log("light"), power_(power), config_path_(config_path) {
+  power_.SigLedCountChanged.connect(&Light::ShowColor, this);
+
   restore_state_active_ = true;
   try {
     const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
@@ -32,7 +34,7 @@ Light::Light(const std::string &config_path, Power &power)
     SetColor(color >> 16 & 0xff, color >> 8 & 0x0FF, color & 0x0FF);
     SetPredefinedColors(cfg.value("predefined_colors", ColorVector()));
   } catch (const nlohmann::json::exception &e) {
-    E(fmt::format("Parsing system config failed: {}", e.what()));
+    E("Parsing system config failed: {}", e.what());
   }
   restore_state_active_ = false;
 }
@@ -53,8 +55,16 @@ std::tuple<uint8_t, uint8_t, uint8_t> Light::GetColor() const {
 
 void Light::SetColor(uint8_t red, uint8_t green, uint8_t blue) {
   color_ = (red << 16 | green << 8 | blue);
-  power_.SetChannelFrame(Power::kLight, color_);
+  ShowColor();
   SaveState();
+  SigColorChanged();
+}
+
+void Light::ShowColor() {
+  frame_index_ = (frame_index_ + 1) % frames_.size();
+  ColorVector &frame = frames_[frame_index_];
+  frame.assign(power_.GetLedCount(), color_);
+  power_.SetChannelFrame(Power::kLight, frame, true);
 }
 
 void Light::SetPredefinedColors(const ColorVector &colors) {
@@ -18,6 +18,8 @@
 #ifndef SRC_LIGHT_HPP
 #define SRC_LIGHT_HPP
 
+#include <array>
+#include <sigslot/signal.hpp>
 #include <vector>
 #include <ws2811/ws2811.h>
 
@@ -38,15 +40,21 @@ public:
   void SetPredefinedColors(const ColorVector &colors);
   ColorVector GetPredefinedColors() const { return predefined_colors_; }
 
+  sigslot::signal_st<> SigColorChanged;
+
 private:
   static constexpr const char *kConfigFile = "light.json";
   const std::string config_path_;
 
   void SaveState() override;
+  void ShowColor();
 
   Power &power_;
   ws2811_led_t color_{0};
   ColorVector predefined_colors_;
+  // the previous frame is the start of the crossfade to the new color
+  std::array<ColorVector, 2> frames_;
+  std::size_t frame_index_{0};
 };
 
 #endif // SRC_LIGHT_HPP
@@ -0,0 +1,167 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "live_stream.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+#include "power.hpp"
+#include "trace.hpp"
+
+LiveStream::LiveStream(asio::io_context &io, Power &power)
+    : Log("live"), power_(power), socket_(io), packet_(kMaxPacketSize) {
+  power_.SigLedCountChanged.connect(&LiveStream::OnLedCountChanged, this);
+  OnLedCountChanged();
+}
+
+LiveStream::~LiveStream() {}
+
+bool LiveStream::Start(uint16_t port) {
+  try {
+    socket_.open(asio::ip::udp::v4());
+    socket_.bind(asio::ip::udp::endpoint(asio::ip::address_v4::any(), port));
+  } catch (const asio::system_error &e) {
+    E("Failed to open port {}: {}", port, e.what());
+    return false;
+  }
+
+  I("Listening for frames on port {}", port);
+  Receive();
+  return true;
+}
+
+void LiveStream::Stop() {
+  is_alive_.store(false);
+  socket_.close();
+}
+
+void LiveStream::Receive() {
+  socket_.async_receive_from(
+      asio::buffer(packet_), remote_endpoint_,
+      Trace::Wrap("LiveStream::OnReceive", [this](const asio::error_code &error, std::size_t size) {
+        OnReceive(error, size);
+      }));
+}
+
+void LiveStream::OnReceive(const asio::error_code &error, std::size_t size) {
+  if (!error) {
+    OnPacket(size);
+  } else if (error != asio::error::operation_aborted) {
+    E("On receive UDP failed: {}", error.message());
+  }
+
+  if (is_alive_.load()) {
+    Receive();
+  }
+}
+
+void LiveStream::OnPacket(std::size_t size) {
+  packets_total_.Inc();
+  const uint8_t *data = packet_.data();
+  if (size < kHeaderSize || (data[0] & kVersionMask) != kVersion1) {
+    invalid_total_.Inc();
+    return;
+  }
+
+  const bool push = data[0] & kFlagPush;
+  const uint8_t format = data[1];
+  const uint16_t seq = data[2] << 8 | data[3];
+  const uint32_t offset = uint32_t(data[4]) << 24 | uint32_t(data[5]) << 16 |
+                          uint32_t(data[6]) << 8 | data[7];
+  const std::size_t length = data[8] << 8 | data[9];
+  const std::size_t bytes_per_pixel = format == kRgbw ? 4 : 3;
+
+  if ((format != kRgb && format != kRgbw) || kHeaderSize + length > size) {
+    invalid_total_.Inc();
+    return;
+  }
+  // all slots have the size of the last frame, the pixels must fit into it
+  const std::size_t count = length / bytes_per_pixel;
+  if (offset > last_frame_.size() || count > last_frame_.size() - offset) {
+    invalid_total_.Inc();
+    return;
+  }
+
+  // a sender restarting its sequence must not be locked out
+  const auto &now = std::chrono::steady_clock::now();
+  if (last_valid_ && now - last_show_ > kResyncTimeout) {
+    last_valid_ = false;
+  }
+
+  // drop anything not newer than the frame on display. The sequence number wraps.
+  if (last_valid_ && int16_t(seq - last_seq_) <= 0) {
+    dropped_total_.Inc();
+    return;
+  }
+
+  slot_t &slot = slots_[seq % kFrameSlots];
+  if (!slot.valid || slot.seq != seq) {
+    // start a new frame based on the last one, to allow partial updates
+    std::copy(last_frame_.begin(), last_frame_.end(), slot.frame.begin());
+    slot.valid = true;
+    slot.seq = seq;
+  }
+
+  // convert the pixels straight from the receive buffer into the frame
+  const uint8_t *pixel = data + kHeaderSize;
+  ws2811_led_t *led = slot.frame.data() + offset;
+  if (format == kRgbw) {
+    for (std::size_t i = 0; i < count; ++i, pixel += 4) {
+      led[i] = pixel[3] << 24 | pixel[0] << 16 | pixel[1] << 8 | pixel[2];
+    }
+  } else {
+    for (std::size_t i = 0; i < count; ++i, pixel += 3) {
+      led[i] = pixel[0] << 16 | pixel[1] << 8 | pixel[2];
+    }
+  }
+
+  if (push) {
+    last_show_ = now;
+    Show(seq);
+  }
+}
+
+void LiveStream::OnLedCountChanged() {
+  // allocate all buffers upfront, the receive path must not allocate
+  const std::size_t count = power_.GetLedCount();
+  for (slot_t &slot : slots_) {
+    slot.frame.resize(count, 0);
+  }
+  last_frame_.resize(count, 0);
+  // the frame set may have moved
+  if (last_valid_) {
+    power_.SetChannelFrame(Power::kLive, last_frame_);
+  }
+}
+
+void LiveStream::Show(uint16_t seq) {
+  slot_t &slot = slots_[seq % kFrameSlots];
+  std::swap(slot.frame, last_frame_);
+  last_seq_ = seq;
+  last_valid_ = true;
+
+  // everything older than the frame shown is obsolete now
+  for (slot_t &s : slots_) {
+    if (s.valid && int16_t(s.seq - seq) <= 0) {
+      s.valid = false;
+    }
+  }
+
+  frames_total_.Inc();
+  power_.SetChannelFrame(Power::kLive, last_frame_);
+}
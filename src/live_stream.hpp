@@ -0,0 +1,101 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_LIVE_STREAM_HPP
+#define SRC_LIVE_STREAM_HPP
+
+#include <array>
+#include <asio.hpp>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+class Power;
+
+/**
+   @brief Receive real-time frames via UDP and feed them into the Power::kLive channel
+
+   Packet layout (all numbers big endian):
+
+   | byte | content                                                          |
+   |------|------------------------------------------------------------------|
+   | 0    | flags: 0x40 version 1, 0x01 push (last packet of the frame)      |
+   | 1    | pixel format: 0 RGB (3 bytes/pixel), 1 RGBW (4 bytes/pixel)      |
+   | 2-3  | frame sequence number, shared by all packets of a frame          |
+   | 4-7  | offset of the first pixel in the payload                         |
+   | 8-9  | payload length in bytes                                          |
+   | 10.. | pixel payload                                                    |
+
+   A frame can be split over several packets. Packets of frames older than the last frame shown
+   are dropped. Up to kFrameSlots frames are assembled in parallel to cope with reordering.
+   Packets with pixels beyond the end of the strip are dropped as invalid.
+*/
+class LiveStream : public Log {
+public:
+  LiveStream(asio::io_context &io, Power &power);
+  virtual ~LiveStream();
+
+  bool Start(uint16_t port = kPort);
+  void Stop();
+
+private:
+  static constexpr uint16_t kPort = 7757;
+  static constexpr std::size_t kHeaderSize = 10;
+  static constexpr std::size_t kMaxPacketSize = 65507;
+  static constexpr std::size_t kFrameSlots = 4;
+  static constexpr auto kResyncTimeout = std::chrono::seconds(1);
+  static constexpr uint8_t kVersionMask = 0xC0;
+  static constexpr uint8_t kVersion1 = 0x40;
+  static constexpr uint8_t kFlagPush = 0x01;
+  enum format_e : uint8_t { kRgb = 0, kRgbw = 1 };
+
+  void Receive();
+  void OnReceive(const asio::error_code &error, std::size_t size);
+  void OnPacket(std::size_t size);
+  void Show(uint16_t seq);
+  void OnLedCountChanged();
+
+  Power &power_;
+  asio::ip::udp::socket socket_;
+  asio::ip::udp::endpoint remote_endpoint_;
+  std::vector<uint8_t> packet_;
+
+  struct slot_t {
+    bool valid{false};
+    uint16_t seq{0};
+    std::vector<ws2811_led_t> frame;
+  };
+  std::array<slot_t, kFrameSlots> slots_;
+  std::vector<ws2811_led_t> last_frame_;
+  bool last_valid_{false};
+  uint16_t last_seq_{0};
+  std::chrono::steady_clock::time_point last_show_;
+
+  Metrics::Counter &packets_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_live_packets_total", "UDP stream packets received")};
+  Metrics::Counter &frames_total_{
+      Metrics::Instance().GetCounter("ledcontrol_live_frames_total", "UDP stream frames shown")};
+  Metrics::Counter &dropped_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_live_dropped_total", "UDP stream packets dropped as late")};
+  Metrics::Counter &invalid_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_live_invalid_total", "UDP stream packets with invalid header")};
+  std::atomic_bool is_alive_{true};
+};
+
+#endif // SRC_LIVE_STREAM_HPP
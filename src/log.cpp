@@ -17,25 +17,223 @@
 **********************************************************************************************/
 #include "log.hpp"
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <fmt/chrono.h>
-#include <iostream>
+#include <mutex>
+#include <semaphore.h>
+#include <thread>
+
+namespace {
+/**
+   @brief Bounded lock-free multi-producer ring buffer drained by a background thread
+
+   Each slot carries a sequence number telling producers and the consumer whether the slot is
+   free or filled (D. Vyukov's bounded queue). Producers never block. If the ring is full the
+   message is dropped and counted. The consumer sleeps on a semaphore while the ring is empty.
+   Producers only post the semaphore if the consumer announced to sleep.
+*/
+class LogSink {
+public:
+  static constexpr std::size_t kCapacity = 256;
+  static constexpr std::size_t kTextSize = 480;
+  static constexpr std::size_t kTagSize = 16;
+
+  struct entry_t {
+    std::atomic<std::size_t> seq;
+    int64_t time_ms;
+    Log::level_e level;
+    std::size_t size;
+    char tag[kTagSize];
+    char text[kTextSize];
+  };
+
+  static LogSink &Instance() {
+    static LogSink sink;
+    return sink;
+  }
+
+  entry_t *Acquire() {
+    std::call_once(start_, [this]() { thread_ = std::thread(&LogSink::Run, this); });
+
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      entry_t &entry = ring_[pos % kCapacity];
+      const std::size_t seq = entry.seq.load(std::memory_order_acquire);
+      const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          return &entry;
+        }
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Commit(entry_t *entry) {
+    const std::size_t pos = entry->seq.load(std::memory_order_relaxed);
+    entry->seq.store(pos + 1, std::memory_order_seq_cst);
+    if (sleeping_.exchange(false)) {
+      sem_post(&pending_);
+    }
+  }
+
+  void Flush() {
+    const std::size_t head = head_.load(std::memory_order_acquire);
+    while (tail_.load(std::memory_order_acquire) < head && thread_.joinable()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  std::atomic<int> level{Log::kDebug};
+  std::atomic<FILE *> output{stdout};
+  std::atomic<uint64_t> dropped_{0};
+
+private:
+  LogSink() {
+    for (std::size_t i = 0; i < kCapacity; ++i) {
+      ring_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    sem_init(&pending_, 0, 0);
+  }
+
+  ~LogSink() {
+    if (thread_.joinable()) {
+      Flush();
+      stop_.store(true);
+      sem_post(&pending_);
+      thread_.join();
+    }
+    sem_destroy(&pending_);
+  }
+
+  void Run() {
+    fmt::memory_buffer line;
+    while (true) {
+      // announce to sleep, then check again to not miss an entry committed meanwhile
+      sleeping_.store(true);
+      std::size_t pos = tail_.load(std::memory_order_relaxed);
+      if (ring_[pos % kCapacity].seq.load() != pos + 1 && !stop_.load()) {
+        sem_wait(&pending_);
+      }
+      sleeping_.store(false);
+
+      // write everything pending in one go, flush once per batch
+      FILE *file = output.load();
+      for (;;) {
+        entry_t &entry = ring_[pos % kCapacity];
+        if (entry.seq.load(std::memory_order_acquire) != pos + 1) {
+          break;
+        }
+
+        Print(entry, line);
+        fwrite(line.data(), 1, line.size(), file);
+
+        entry.seq.store(pos + kCapacity, std::memory_order_release);
+        tail_.store(++pos, std::memory_order_release);
+      }
+      fflush(file);
+
+      if (stop_.load() && tail_.load() == head_.load()) {
+        return;
+      }
+    }
+  }
+
+  static void Print(const entry_t &entry, fmt::memory_buffer &line) {
+    static constexpr const char *kLevel[] = {"[D]", "[I]", "[E]"};
+    const std::chrono::system_clock::time_point time{std::chrono::milliseconds(entry.time_ms)};
+
+    line.clear();
+    fmt::format_to(std::back_inserter(line), "{:%H:%M:%S}.{:03} {} {}: ",
+                   std::chrono::time_point_cast<std::chrono::seconds>(time), entry.time_ms % 1000,
+                   kLevel[entry.level], entry.tag);
+    line.append(entry.text, entry.text + entry.size);
+    line.push_back('\n');
+  }
+
+  std::array<entry_t, kCapacity> ring_;
+  std::atomic<std::size_t> head_{0};
+  std::atomic<std::size_t> tail_{0};
+  std::atomic_bool stop_{false};
+  std::atomic_bool sleeping_{false};
+  sem_t pending_;
+  std::once_flag start_;
+  std::thread thread_;
+};
+} // namespace
 
 Log::Log(const std::string &tag) : tag_(tag) {}
 
 Log::~Log() {}
 
-void Log::E(const std::string &msg) const { print("[E]", msg); }
+void Log::SetLevel(level_e level) { LogSink::Instance().level.store(level); }
+
+Log::level_e Log::GetLevel() {
+  return static_cast<level_e>(LogSink::Instance().level.load(std::memory_order_relaxed));
+}
+
+bool Log::SetLevel(const std::string &level) {
+  for (level_e l : {kDebug, kInfo, kError}) {
+    if (level == ToString(l)) {
+      SetLevel(l);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *Log::ToString(level_e level) {
+  switch (level) {
+  case kDebug:
+    return "debug";
+  case kInfo:
+    return "info";
+  case kError:
+    return "error";
+  }
+  return "unknown";
+}
+
+void Log::SetOutput(FILE *file) { LogSink::Instance().output.store(file); }
 
-void Log::I(const std::string &msg) const { print("[I]", msg); }
+void Log::Flush() { LogSink::Instance().Flush(); }
 
-void Log::D(const std::string &msg) const { print("[D]", msg); }
+uint64_t Log::GetDropped() { return LogSink::Instance().dropped_.load(); }
 
-void Log::print(const std::string &level, const std::string &msg) const {
+void Log::Enqueue(level_e level, fmt::string_view format, fmt::format_args args) const {
   const auto &now = std::chrono::system_clock::now();
-  const auto &duration = now.time_since_epoch();
-  auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() % 1000;
+  const int64_t time_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+
+  LogSink &sink = LogSink::Instance();
+  LogSink::entry_t *entry = sink.Acquire();
+  if (entry == nullptr) {
+    return;
+  }
+
+  entry->time_ms = time_ms;
+  entry->level = level;
+  const std::size_t tag_size = std::min(tag_.size(), LogSink::kTagSize - 1);
+  std::copy_n(tag_.data(), tag_size, entry->tag);
+  entry->tag[tag_size] = 0;
+
+  // format straight into the slot, long messages are truncated
+  try {
+    const auto &result = fmt::vformat_to_n(entry->text, LogSink::kTextSize, format, args);
+    entry->size = std::min(result.size, LogSink::kTextSize);
+    if (result.size > LogSink::kTextSize) {
+      std::copy_n("...", 3, entry->text + LogSink::kTextSize - 3);
+    }
+  } catch (const fmt::format_error &e) {
+    entry->size = fmt::format_to_n(entry->text, LogSink::kTextSize, "format error: {}", e.what()).size;
+    entry->size = std::min(entry->size, LogSink::kTextSize);
+  }
 
-  std::cout << fmt::format("{:%H:%M:%S}.{:03} {} {}: ", now, millis, level, tag_) << msg
-            << std::endl;
+  sink.Commit(entry);
 }
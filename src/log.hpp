@@ -18,19 +18,60 @@
 #ifndef SRC_LOG_HPP
 #define SRC_LOG_HPP
 
+#include <cstdio>
+#include <fmt/format.h>
 #include <string>
 
+// Messages below this level are removed at compile time (0: debug, 1: info, 2: error)
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN 0
+#endif
+
 class Log {
+public:
+  enum level_e : int { kDebug = 0, kInfo = 1, kError = 2 };
+
+  static constexpr level_e kMinLevel = static_cast<level_e>(LOG_LEVEL_MIN);
+
+  static void SetLevel(level_e level);
+  static level_e GetLevel();
+  static bool SetLevel(const std::string &level);
+  static const char *ToString(level_e level);
+
+  // Redirect the output, stdout by default.
+  static void SetOutput(FILE *file);
+  // Block until all messages queued so far are written.
+  static void Flush();
+  // Number of messages lost because the ring buffer was full.
+  static uint64_t GetDropped();
+
 protected:
   Log(const std::string &tag);
   virtual ~Log();
 
-  void E(const std::string &msg) const;
-  void I(const std::string &msg) const;
-  void D(const std::string &msg) const;
+  // The arguments are formatted only if the level is enabled. The message is queued and
+  // written by a background thread.
+  template <typename... Args> void E(fmt::format_string<Args...> format, Args &&...args) const {
+    Write<kError>(format, fmt::make_format_args(args...));
+  }
+  template <typename... Args> void I(fmt::format_string<Args...> format, Args &&...args) const {
+    Write<kInfo>(format, fmt::make_format_args(args...));
+  }
+  template <typename... Args> void D(fmt::format_string<Args...> format, Args &&...args) const {
+    Write<kDebug>(format, fmt::make_format_args(args...));
+  }
 
 private:
-  void print(const std::string &level, const std::string &msg) const;
+  template <level_e level> void Write(fmt::string_view format, fmt::format_args args) const {
+    if constexpr (level >= kMinLevel) {
+      if (level >= GetLevel()) {
+        Enqueue(level, format, args);
+      }
+    }
+  }
+
+  void Enqueue(level_e level, fmt::string_view format, fmt::format_args args) const;
+
   std::string tag_;
 };
 
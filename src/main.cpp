@@ -16,10 +16,38 @@
 
 **********************************************************************************************/
 
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
 #include "controller.hpp"
 
 int main(int argc, char **argv) {
-  Controller controller;
+  // several daemons on one host (e.g. to test sync on loopback) need own config and ports
+  std::string config_path = Controller::kConfigPath;
+  uint16_t port = Controller::kPort;
+  std::string animation_path = Animation::kAnimationPath;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:p:a:")) != -1) {
+    switch (opt) {
+    case 'c':
+      config_path = optarg;
+      break;
+    case 'p':
+      port = std::atoi(optarg);
+      break;
+    case 'a':
+      animation_path = optarg;
+      break;
+    default:
+      std::fprintf(stderr, "Usage: %s [-c config_dir] [-p udp_port] [-a animation_dir]\n",
+                   argv[0]);
+      return -1;
+    }
+  }
+
+  Controller controller(config_path, port, animation_path);
 
   return controller.Exec();
 }
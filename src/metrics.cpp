@@ -0,0 +1,158 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "metrics.hpp"
+
+#include <fmt/format.h>
+
+const std::vector<double> Metrics::kDurationBounds = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0};
+
+void Metrics::Gauge::Add(double value) {
+  double current = value_.load(std::memory_order_relaxed);
+  while (!value_.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+  }
+}
+
+Metrics::Histogram::Histogram(const std::vector<double> &bounds)
+    : bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+  for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+    buckets_[i].store(0);
+  }
+}
+
+void Metrics::Histogram::Observe(double value) {
+  // the last bucket is +Inf
+  std::size_t i = 0;
+  while (i < bounds_.size() && value > bounds_[i]) {
+    ++i;
+  }
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+  }
+}
+
+Metrics &Metrics::Instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::entry_t *Metrics::Find(const std::string &name) {
+  for (entry_t &entry : entries_) {
+    if (entry.name == name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+Metrics::Counter &Metrics::GetCounter(const std::string &name, const std::string &help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entry_t *entry = Find(name);
+  if (entry == nullptr) {
+    entry = &entries_.emplace_back(entry_t{name, help, type_e::counter});
+    entry->counter = std::make_unique<Counter>();
+  }
+  return *entry->counter;
+}
+
+Metrics::Gauge &Metrics::GetGauge(const std::string &name, const std::string &help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entry_t *entry = Find(name);
+  if (entry == nullptr) {
+    entry = &entries_.emplace_back(entry_t{name, help, type_e::gauge});
+    entry->gauge = std::make_unique<Gauge>();
+  }
+  return *entry->gauge;
+}
+
+Metrics::Histogram &Metrics::GetHistogram(const std::string &name, const std::string &help,
+                                          const std::vector<double> &bounds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entry_t *entry = Find(name);
+  if (entry == nullptr) {
+    entry = &entries_.emplace_back(entry_t{name, help, type_e::histogram});
+    entry->histogram = std::make_unique<Histogram>(bounds);
+  }
+  return *entry->histogram;
+}
+
+nlohmann::json Metrics::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  nlohmann::json json;
+  for (const entry_t &entry : entries_) {
+    switch (entry.type) {
+    case type_e::counter:
+      json[entry.name] = entry.counter->Get();
+      break;
+    case type_e::gauge:
+      json[entry.name] = entry.gauge->Get();
+      break;
+    case type_e::histogram: {
+      const Histogram &histogram = *entry.histogram;
+      nlohmann::json buckets = nlohmann::json::array();
+      for (std::size_t i = 0; i <= histogram.GetBounds().size(); ++i) {
+        buckets.push_back(histogram.GetBucket(i));
+      }
+      json[entry.name] = {{"count", histogram.GetCount()},
+                          {"sum", histogram.GetSum()},
+                          {"bounds", histogram.GetBounds()},
+                          {"buckets", buckets}};
+      break;
+    }
+    }
+  }
+  return json;
+}
+
+std::string Metrics::ToPrometheus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fmt::memory_buffer out;
+  auto it = std::back_inserter(out);
+  for (const entry_t &entry : entries_) {
+    fmt::format_to(it, "# HELP {} {}\n", entry.name, entry.help);
+    switch (entry.type) {
+    case type_e::counter:
+      fmt::format_to(it, "# TYPE {} counter\n{} {}\n", entry.name, entry.name,
+                     entry.counter->Get());
+      break;
+    case type_e::gauge:
+      fmt::format_to(it, "# TYPE {} gauge\n{} {}\n", entry.name, entry.name, entry.gauge->Get());
+      break;
+    case type_e::histogram: {
+      const Histogram &histogram = *entry.histogram;
+      fmt::format_to(it, "# TYPE {} histogram\n", entry.name);
+      // buckets are cumulative in the Prometheus format
+      uint64_t cumulative = 0;
+      for (std::size_t i = 0; i < histogram.GetBounds().size(); ++i) {
+        cumulative += histogram.GetBucket(i);
+        fmt::format_to(it, "{}_bucket{{le=\"{}\"}} {}\n", entry.name, histogram.GetBounds()[i],
+                       cumulative);
+      }
+      cumulative += histogram.GetBucket(histogram.GetBounds().size());
+      fmt::format_to(it, "{}_bucket{{le=\"+Inf\"}} {}\n", entry.name, cumulative);
+      fmt::format_to(it, "{}_sum {}\n{}_count {}\n", entry.name, histogram.GetSum(), entry.name,
+                     histogram.GetCount());
+      break;
+    }
+    }
+  }
+  return fmt::to_string(out);
+}
@@ -0,0 +1,126 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_METRICS_HPP
+#define SRC_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+/**
+   @brief Registry of process wide counters, gauges and histograms
+
+   Metrics are registered once, usually in a constructor, and the returned reference is kept.
+   Updating a metric is a relaxed atomic operation and never takes a lock or allocates. The
+   registry is exported as JSON (session command `get_metrics`) and in the Prometheus text
+   format.
+*/
+class Metrics {
+public:
+  class Counter {
+  public:
+    void Inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> value_{0};
+  };
+
+  class Gauge {
+  public:
+    void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(double value);
+    double Get() const { return value_.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<double> value_{0};
+  };
+
+  class Histogram {
+  public:
+    Histogram(const std::vector<double> &bounds);
+
+    void Observe(double value);
+    template <typename Rep, typename Period>
+    void Observe(const std::chrono::duration<Rep, Period> &duration) {
+      Observe(std::chrono::duration<double>(duration).count());
+    }
+
+    const std::vector<double> &GetBounds() const { return bounds_; }
+    uint64_t GetBucket(std::size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    uint64_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+    double GetSum() const { return sum_.load(std::memory_order_relaxed); }
+
+  private:
+    const std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<double> sum_{0};
+  };
+
+  // Measure the time until the end of the scope
+  class ScopedTimer {
+  public:
+    ScopedTimer(Histogram &histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram_.Observe(std::chrono::steady_clock::now() - start_); }
+
+  private:
+    Histogram &histogram_;
+    const std::chrono::steady_clock::time_point start_;
+  };
+
+  static Metrics &Instance();
+
+  // Registering the same name twice returns the same metric
+  Counter &GetCounter(const std::string &name, const std::string &help);
+  Gauge &GetGauge(const std::string &name, const std::string &help);
+  Histogram &GetHistogram(const std::string &name, const std::string &help,
+                          const std::vector<double> &bounds = kDurationBounds);
+
+  nlohmann::json ToJson() const;
+  std::string ToPrometheus() const;
+
+  // Bucket bounds in seconds from 50 us to 1 s
+  static const std::vector<double> kDurationBounds;
+
+private:
+  Metrics() = default;
+
+  enum class type_e { counter, gauge, histogram };
+  struct entry_t {
+    std::string name;
+    std::string help;
+    type_e type;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  entry_t *Find(const std::string &name);
+
+  mutable std::mutex mutex_;
+  std::list<entry_t> entries_;
+};
+
+#endif // SRC_METRICS_HPP
@@ -0,0 +1,112 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "metrics_server.hpp"
+
+#include "metrics.hpp"
+#include "trace.hpp"
+
+MetricsServer::MetricsServer(asio::io_context &io)
+    : Log("metrics"), acceptor_(io), socket_(io), timer_(io) {}
+
+MetricsServer::~MetricsServer() {}
+
+bool MetricsServer::Start(uint16_t port) {
+  try {
+    const asio::ip::tcp::endpoint endpoint{asio::ip::tcp::v4(), port};
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+  } catch (const asio::system_error &e) {
+    E("Failed to open port {}: {}", port, e.what());
+    return false;
+  }
+
+  I("Serving metrics on port {}", port);
+  Accept();
+  return true;
+}
+
+void MetricsServer::Stop() {
+  is_alive_.store(false);
+  acceptor_.close();
+  Close();
+}
+
+void MetricsServer::Accept() {
+  acceptor_.async_accept(socket_, [this](const asio::error_code &error) {
+    if (error) {
+      if (is_alive_.load()) {
+        E("Accept failed: {}", error.message());
+      }
+      return;
+    }
+
+    timer_.expires_after(kTimeout);
+    timer_.async_wait([this](const asio::error_code &error) {
+      if (!error) {
+        socket_.close();
+      }
+    });
+
+    asio::async_read_until(socket_, request_, "\r\n\r\n",
+                           Trace::Wrap("MetricsServer::OnRequest",
+                                       [this](const asio::error_code &error, std::size_t size) {
+                                         OnRequest(error, size);
+                                       }));
+  });
+}
+
+void MetricsServer::OnRequest(const asio::error_code &error, std::size_t size) {
+  // also a request head exceeding kMaxRequest
+  if (error) {
+    Next();
+    return;
+  }
+
+  const std::string &body = Metrics::Instance().ToPrometheus();
+  response_ = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+              std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+  asio::async_write(socket_, asio::buffer(response_),
+                    Trace::Wrap("MetricsServer::OnResponse",
+                                [this](const asio::error_code &error, std::size_t size) {
+                                  OnResponse(error, size);
+                                }));
+}
+
+void MetricsServer::OnResponse(const asio::error_code &error, std::size_t size) {
+  if (error) {
+    E("Sending metrics failed: {}", error.message());
+  }
+  Next();
+}
+
+void MetricsServer::Next() {
+  Close();
+  if (is_alive_.load()) {
+    Accept();
+  }
+}
+
+void MetricsServer::Close() {
+  timer_.cancel();
+  asio::error_code error;
+  socket_.shutdown(asio::ip::tcp::socket::shutdown_both, error);
+  socket_.close(error);
+  request_.consume(request_.size());
+}
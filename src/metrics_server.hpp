@@ -0,0 +1,61 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_METRICS_SERVER_HPP
+#define SRC_METRICS_SERVER_HPP
+
+#include <asio.hpp>
+
+#include "log.hpp"
+
+/**
+   @brief Minimal HTTP endpoint serving the metrics in the Prometheus text format
+
+   Requests are served one after the other. Any request gets the metrics as response, the
+   connection is closed afterwards.
+*/
+class MetricsServer : public Log {
+public:
+  MetricsServer(asio::io_context &io);
+  virtual ~MetricsServer();
+
+  bool Start(uint16_t port = kPort);
+  void Stop();
+
+private:
+  static constexpr uint16_t kPort = 7758;
+  static constexpr auto kTimeout = std::chrono::seconds(5);
+  // a request head beyond that is dropped
+  static constexpr std::size_t kMaxRequest = 4096;
+
+  void Accept();
+  void OnRequest(const asio::error_code &error, std::size_t size);
+  void OnResponse(const asio::error_code &error, std::size_t size);
+  // close the connection and accept the next one
+  void Next();
+  void Close();
+
+  asio::ip::tcp::acceptor acceptor_;
+  asio::ip::tcp::socket socket_;
+  asio::steady_timer timer_;
+  asio::streambuf request_{kMaxRequest};
+  std::string response_;
+
+  std::atomic_bool is_alive_{true};
+};
+
+#endif // SRC_METRICS_SERVER_HPP
@@ -21,67 +21,165 @@
 
 #include "ws2811_control.hpp"
 
-const std::vector<ws2811_led_t> Power::kBlackFrame(WS2811Control::kLedCount, 0);
 
-Power::Power(const std::string &config_path, WS2811Control &ws2811_control)
-    : Log("power"), config_path_(config_path), ws2811_control_(ws2811_control) {
+Power::Power(const std::string &config_path, asio::io_context &io, WS2811Control &ws2811_control)
+    : Log("power"), config_path_(config_path), ws2811_control_(ws2811_control),
+      compositor_(io, ws2811_control, {"light", "animation", "live", "shm", "effect", "audio"}) {
+  ws2811_control_.SigLedCountChanged.connect([this]() {
+    compositor_.Refresh();
+    SigLedCountChanged();
+  });
+
   restore_state_active_ = true;
   try {
     const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
 
+    exclusive_ = cfg.value("exclusive", true);
+    compositor_.SetTransition(std::chrono::milliseconds(
+        cfg.value("transition_ms", compositor_.GetTransition().count())));
+    for (channel_e channel : GetAvailableChannels()) {
+      const nlohmann::json &layer = cfg.value("layers", nlohmann::json::object())
+                                        .value(GetChannelName(channel), nlohmann::json::object());
+      Compositor::blend_e blend = Compositor::blend_e::normal;
+      Compositor::FromString(layer.value("blend", "normal"), blend);
+      SetChannelLayer(channel, layer.value("opacity", 255), blend);
+    }
+    SetSegments(cfg.value("segments", std::vector<Compositor::segment_t>()));
+
     SetChannelState(kLight, cfg.value("light", false));
     SetChannelState(kAnimation, cfg.value("animation", false));
+    SetChannelState(kLive, cfg.value("live", false));
+    SetChannelState(kSharedFrame, cfg.value("shm", false));
+    SetChannelState(kEffect, cfg.value("effect", false));
+    SetChannelState(kAudio, cfg.value("audio", false));
   } catch (const nlohmann::json::exception &e) {
-    E(fmt::format("Parsing system config failed: {}", e.what()));
+    E("Parsing system config failed: {}", e.what());
   }
 
   restore_state_active_ = false;
 }
 Power::~Power() {}
 
-void Power::SetChannelState(channel_e id, bool on) {
+const char *Power::GetChannelName(channel_e channel) {
+  switch (channel) {
+  case kLight:
+    return "light";
+  case kAnimation:
+    return "animation";
+  case kLive:
+    return "live";
+  case kSharedFrame:
+    return "shm";
+  case kEffect:
+    return "effect";
+  case kAudio:
+    return "audio";
+  default:
+    return "";
+  }
+}
 
-  channel_e active_id = kNone;
-  for (channel_t &channel : channels_) {
-    if (channel.active) {
-      active_id = channel.id;
+Power::channel_e Power::GetChannel(const std::string &name) {
+  for (channel_e channel : GetAvailableChannels()) {
+    if (name == GetChannelName(channel)) {
+      return channel;
     }
   }
+  return kNone;
+}
 
+std::size_t Power::GetLedCount() const { return ws2811_control_.GetLedCount(); }
+
+void Power::SetChannelState(channel_e id, bool on) {
   D("------------- SetChannelState start -------------");
-  D(fmt::format("active channel: {}", active_id));
-  D(fmt::format("current channel: {} new state: {}", id, on));
+  D("current channel: {} new state: {} exclusive: {}", id, on, exclusive_);
 
   channel_t &channel = channels_[id];
 
   if (channel.active != on) {
-    if (active_id != kNone) {
-      channels_[active_id].active = false;
+    if (exclusive_ && on) {
+      for (channel_t &other : channels_) {
+        if (other.active) {
+          other.active = false;
+          compositor_.SetActive(other.id, false);
+        }
+      }
     }
     channel.active = on;
-    ws2811_control_.SetFrame(on ? channel.frame : kBlackFrame);
-    ws2811_control_.SetBrightness(1.0);
+    compositor_.SetActive(id, on);
   }
   SigPowerStatusChanged();
   D("------------- SetChannelState done -------------");
   SaveState();
 }
 
-void Power::SetChannelFrame(channel_e channel, const std::vector<ws2811_led_t> &frame) {
-  channel_t &channel_ = channels_[channel];
-  channel_.frame = frame;
-  if (channel_.active) {
-    ws2811_control_.SetFrame(channel_.frame);
+void Power::SetChannelFrame(channel_e channel, const frame_t &frame, bool fade) {
+  compositor_.SetFrame(channel, frame, fade);
+}
+
+void Power::SetTransition(std::chrono::milliseconds duration) {
+  compositor_.SetTransition(duration);
+  SaveState();
+}
+
+void Power::SetExclusive(bool exclusive) {
+  exclusive_ = exclusive;
+  if (exclusive_) {
+    // keep the topmost active channel
+    bool found = false;
+    for (auto it = channels_.rbegin(); it != channels_.rend(); ++it) {
+      if (it->active && found) {
+        it->active = false;
+        compositor_.SetActive(it->id, false);
+      }
+      found = found || it->active;
+    }
+    SigPowerStatusChanged();
   }
+  SaveState();
+}
+
+void Power::SetChannelLayer(channel_e channel, uint8_t opacity, Compositor::blend_e blend) {
+  compositor_.SetOpacity(channel, opacity);
+  compositor_.SetBlend(channel, blend);
+  SaveState();
 }
 
-void Power::SetChannelFrame(channel_e channel, const ws2811_led_t &color) {
-  SetChannelFrame(channel, std::vector<ws2811_led_t>(WS2811Control::kLedCount, color));
+void Power::SetSegments(const std::vector<Compositor::segment_t> &segments) {
+  compositor_.SetSegments(segments);
+  SaveState();
 }
 
 void Power::SaveState() {
   nlohmann::json cfg;
   cfg["light"] = GetChannelState(kLight);
   cfg["animation"] = GetChannelState(kAnimation);
+  cfg["live"] = GetChannelState(kLive);
+  cfg["shm"] = GetChannelState(kSharedFrame);
+  cfg["effect"] = GetChannelState(kEffect);
+  cfg["audio"] = GetChannelState(kAudio);
+  cfg["exclusive"] = exclusive_;
+  cfg["transition_ms"] = compositor_.GetTransition().count();
+  for (channel_e channel : GetAvailableChannels()) {
+    nlohmann::json &layer = cfg["layers"][GetChannelName(channel)];
+    layer["opacity"] = compositor_.GetOpacity(channel);
+    layer["blend"] = Compositor::ToString(compositor_.GetBlend(channel));
+  }
+  cfg["segments"] = compositor_.GetSegments();
   IModule::SaveState(config_path_, kConfigFile, cfg);
 }
+
+void to_json(nlohmann::json &json, const Compositor::segment_t &segment) {
+  json["offset"] = segment.offset;
+  json["length"] = segment.length;
+  json["reverse"] = segment.reverse;
+  json["source"] = Power::GetChannelName(Power::channel_e(segment.layer));
+}
+
+void from_json(const nlohmann::json &json, Compositor::segment_t &segment) {
+  segment.offset = json.value("offset", 0);
+  segment.length = json.value("length", 0);
+  segment.reverse = json.value("reverse", false);
+  // an unknown source is out of range and dropped by the compositor
+  segment.layer = std::size_t(Power::GetChannel(json.value("source", "")));
+}
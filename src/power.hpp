@@ -19,46 +19,102 @@
 #define SRC_POWER_HPP
 
 #include <array>
+#include <nlohmann/json.hpp>
 #include <sigslot/signal.hpp>
+#include <vector>
 #include <ws2811/ws2811.h>
 
+#include "compositor.hpp"
+#include "frame.hpp"
 #include "i_module.hpp"
 #include "log.hpp"
 
 class WS2811Control;
 
+/**
+ * @brief Power state of the frame sources
+ *
+ * Each channel is a layer of the compositor. In exclusive mode (the default) switching on a
+ * channel switches off the others, otherwise the active channels are blended by their
+ * opacity and blend mode.
+ */
 class Power : public Log, public IModule {
 public:
-  Power(const std::string &config_path, WS2811Control &ws2811_control);
+  Power(const std::string &config_path, asio::io_context &io, WS2811Control &ws2811_control);
   virtual ~Power();
 
-  enum channel_e : int { kLight, kAnimation, kMaxChannel, kNone = -1 };
+  enum channel_e : int {
+    kLight,
+    kAnimation,
+    kLive,
+    kSharedFrame,
+    kEffect,
+    kAudio,
+    kMaxChannel,
+    kNone = -1
+  };
 
   bool GetChannelState(channel_e channel) const { return channels_[channel].active; }
-  static std::vector<channel_e> GetAvailableChannels() { return {kLight, kAnimation}; }
+  static std::vector<channel_e> GetAvailableChannels() {
+    return {kLight, kAnimation, kLive, kSharedFrame, kEffect, kAudio};
+  }
+  static const char *GetChannelName(channel_e channel);
+  static channel_e GetChannel(const std::string &name);
 
   void SetChannelState(channel_e channel, bool on);
-  void SetChannelFrame(channel_e channel, const std::vector<ws2811_led_t> &frame);
-  void SetChannelFrame(channel_e channel, const ws2811_led_t &color);
+  /**
+   * @brief Set the frame of a channel, the frame's storage is referenced, not copied
+   *
+   * With `fade` set the change is crossfaded. The storage of the previous frame must stay
+   * unchanged for that.
+   */
+  void SetChannelFrame(channel_e channel, const frame_t &frame, bool fade = false);
+  void SetTransition(std::chrono::milliseconds duration);
+  std::chrono::milliseconds GetTransition() const { return compositor_.GetTransition(); }
+
+  void SetExclusive(bool exclusive);
+  bool GetExclusive() const { return exclusive_; }
+  void SetChannelLayer(channel_e channel, uint8_t opacity, Compositor::blend_e blend);
+  uint8_t GetChannelOpacity(channel_e channel) const { return compositor_.GetOpacity(channel); }
+  Compositor::blend_e GetChannelBlend(channel_e channel) const {
+    return compositor_.GetBlend(channel);
+  }
+  void SetSegments(const std::vector<Compositor::segment_t> &segments);
+  const std::vector<Compositor::segment_t> &GetSegments() const {
+    return compositor_.GetSegments();
+  }
+  /** @brief The compositor, e.g. to fade the master brightness */
+  Compositor &GetCompositor() { return compositor_; }
+  const Compositor &GetCompositor() const { return compositor_; }
+
+  /** @brief LEDs of the strip on all output channels, the size of a full frame */
+  std::size_t GetLedCount() const;
 
   sigslot::signal_st<> SigPowerStatusChanged;
+  sigslot::signal_st<> SigLedCountChanged;
 
 private:
   static constexpr const char *kConfigFile = "power.json";
-  static const std::vector<ws2811_led_t> kBlackFrame;
   const std::string config_path_;
 
   void SaveState() override;
 
   WS2811Control &ws2811_control_;
+  Compositor compositor_;
+  bool exclusive_{true};
+
   struct channel_t {
     channel_t(channel_e id) : id(id) {}
     const channel_e id;
     bool active{false};
-    std::vector<ws2811_led_t> frame{kBlackFrame};
   };
 
-  std::array<channel_t, kMaxChannel> channels_{channel_t(kLight), channel_t(kAnimation)};
+  std::array<channel_t, kMaxChannel> channels_{channel_t(kLight), channel_t(kAnimation),
+                                                channel_t(kLive), channel_t(kSharedFrame),
+                                                channel_t(kEffect), channel_t(kAudio)};
 };
 
+void to_json(nlohmann::json &json, const Compositor::segment_t &segment);
+void from_json(const nlohmann::json &json, Compositor::segment_t &segment);
+
 #endif // SRC_POWER_HPP
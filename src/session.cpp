@@ -17,9 +17,11 @@
  **********************************************************************************************/
 #include "session.hpp"
 
+#include <cmath>
 #include <fmt/format.h>
 
 #include "controller.hpp"
+#include "trace.hpp"
 
 Session::Session(asio::io_context &io, Controller &controller)
     : Log("session"), socket_(io), timer_(io), controller_(controller) {}
@@ -27,22 +29,25 @@ Session::Session(asio::io_context &io, Controller &controller)
 Session::~Session() { D("~Session"); }
 
 void Session::Exec() {
-  // timeout stall sessions
+  // timeout stall sessions. Subscribers are idle by intention, they rely on TCP keep alive.
   timer_.cancel();
-  timer_.expires_at(std::chrono::steady_clock::now() + std::chrono::minutes(1));
-  timer_.async_wait([this](const asio::error_code &error) {
-    if (error != asio::error::operation_aborted) {
-      I("Session timeout");
-      socket_.close();
-    }
-  });
+  if (!IsSubscribed()) {
+    timer_.expires_at(std::chrono::steady_clock::now() + std::chrono::minutes(1));
+    timer_.async_wait([this](const asio::error_code &error) {
+      if (error != asio::error::operation_aborted) {
+        I("Session timeout");
+        socket_.close();
+      }
+    });
+  }
 
   // start receiving
-  std::shared_ptr<asio::streambuf> buffer(new asio::streambuf());
-  asio::async_read_until(socket_, *buffer.get(), '\n',
-                         [this, buffer](const asio::error_code &error, std::size_t size) {
-                           OnMessageReceived(buffer, error, size);
-                         });
+  reading_ = true;
+  asio::async_read(socket_, buffer_, asio::transfer_at_least(1),
+                   Trace::Wrap("Session::OnMessageReceived",
+                               [this](const asio::error_code &error, std::size_t size) {
+                                 OnMessageReceived(error, size);
+                               }));
 }
 
 void Session::Stop() {
@@ -51,124 +56,548 @@ void Session::Stop() {
   timer_.cancel();
 }
 
-void Session::OnMessageReceived(std::shared_ptr<asio::streambuf> buffer,
-                                const asio::error_code &error, std::size_t size) {
+void Session::Close() {
+  socket_.close();
+  timer_.cancel();
+  if (is_alive_.load() && !reading_ && send_queue_.empty()) {
+    asio::post(socket_.get_executor(), [this]() { controller_.CloseSession(this); });
+  }
+}
+
+void Session::OnMessageReceived(const asio::error_code &error, std::size_t size) {
+  reading_ = false;
   if (error) {
-    E(fmt::format("OnMessageReceived failed: {}", error.message()));
-    timer_.cancel();
-    if (is_alive_.load()) {
-      asio::post([this]() { controller_.StartServer(); });
+    E("OnMessageReceived failed: {}", error.message());
+    Close();
+    return;
+  }
+
+  bytes_in_total_.Inc(size);
+
+  try {
+    std::size_t offset = 0;
+    std::size_t length = 0;
+    std::size_t total = 0;
+    // the encoding can change with each message, thus search for the next message each time
+    while (Codec::FindMessage(encoding_, static_cast<const uint8_t *>(buffer_.data().data()),
+                              buffer_.size(), offset, length, total)) {
+      nlohmann::json msg;
+      try {
+        if (length != 0) {
+          const uint8_t *data = static_cast<const uint8_t *>(buffer_.data().data());
+          msg = Codec::Decode(encoding_, data + offset, length);
+        }
+      } catch (const nlohmann::json::exception &e) {
+        E("Decoding message failed: {}", e.what());
+      }
+      buffer_.consume(total);
+
+      if (!msg.is_null()) {
+        OnCommand(msg);
+      }
     }
+  } catch (const std::length_error &e) {
+    E("Dropping session: {}", e.what());
+    socket_.close();
+  }
+
+  Exec();
+}
+
+void Session::OnCommand(const nlohmann::json &msg) {
+  D("recv {}", msg);
+  messages_in_total_.Inc();
+  Metrics::ScopedTimer timer(command_seconds_);
+
+  try {
+    const std::string &cmd = msg["cmd"];
+
+    if (cmd == "set_encoding") {
+      // the response is sent with the old encoding, everything after with the new one
+      Codec::encoding_e encoding = encoding_;
+      const bool ok = Codec::FromString(msg["encoding"], encoding);
+      nlohmann::json resp;
+      resp["rsp"] = "set_encoding";
+      resp["encoding"] = Codec::ToString(encoding);
+      resp["available"] = Codec::GetAvailableEncodings();
+      sendMessage(resp);
+      if (ok) {
+        encoding_ = encoding;
+      }
+    } else if (cmd == "subscribe") {
+      OnSubscribe(msg["topics"], true);
+    } else if (cmd == "unsubscribe") {
+      OnSubscribe(msg["topics"], false);
+    } else if (cmd == "get_metrics") {
+      nlohmann::json resp;
+      resp["rsp"] = "get_metrics";
+      resp["metrics"] = Metrics::Instance().ToJson();
+      sendMessage(resp);
+    } else if (cmd == "get_trace") {
+      nlohmann::json resp = Trace::ToChromeTrace();
+      resp["rsp"] = "get_trace";
+      sendMessage(resp);
+    } else if (cmd == "get_system_config") {
+      nlohmann::json resp;
+      resp["rsp"] = "get_system_config";
+      resp["name"] = controller_.GetName();
+      resp["led_count"] = controller_.GetWS2811Control().GetLedCount();
+      resp["led_counts"] = controller_.GetWS2811Control().GetLedCounts();
+      resp["max_brightness"] = controller_.GetWS2811Control().GetMaxBrightness();
+      resp["current_budget_ma"] = controller_.GetWS2811Control().GetCurrentBudget();
+      resp["current_ma"] = std::lround(controller_.GetWS2811Control().GetCurrent());
+      resp["animation_cache_mb"] = controller_.GetAnimationCacheSize();
+      sendMessage(resp);
+    } else if (cmd == "set_system_config") {
+      controller_.SetName(msg["name"]);
+      WS2811Control &ws2811_control = controller_.GetWS2811Control();
+      if (msg.contains("led_counts")) {
+        ws2811_control.SetParameters(
+            msg["led_counts"].get<std::array<int, WS2811Control::kChannelCount>>(),
+            msg["max_brightness"]);
+      } else {
+        ws2811_control.SetParameters(msg["led_count"].get<int>(), msg["max_brightness"]);
+      }
+      if (msg.contains("current_budget_ma")) {
+        ws2811_control.SetCurrentBudget(msg["current_budget_ma"]);
+      }
+      if (msg.contains("animation_cache_mb")) {
+        controller_.SetAnimationCacheSize(msg["animation_cache_mb"]);
+      }
+    } else if (cmd == "set_log_level") {
+      controller_.SetLogLevel(msg["level"]);
+    } else if (cmd == "get_log_level") {
+      nlohmann::json resp;
+      resp["rsp"] = "get_log_level";
+      resp["level"] = Log::ToString(Log::GetLevel());
+      resp["dropped"] = Log::GetDropped();
+      sendMessage(resp);
+    } else if (cmd == "get_frame") {
+      // the output as sent to the strip, e.g. to compare the playback of several daemons
+      const WS2811Control &ws2811_control = controller_.GetWS2811Control();
+      nlohmann::json resp;
+      resp["rsp"] = "get_frame";
+      resp["frame"] = ws2811_control.GetFrameCount();
+      resp["time_ns"] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            ws2811_control.GetRenderTime().time_since_epoch())
+                            .count();
+      resp["leds"] = ws2811_control.GetLeds();
+      sendMessage(resp);
+    } else if (cmd == "get_power") {
+      SendPowerStatus();
+    } else if (cmd == "set_power_light") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kLight, msg["power"]);
+    } else if (cmd == "set_power_animation") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kAnimation, msg["power"]);
+    } else if (cmd == "set_power_live") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kLive, msg["power"]);
+    } else if (cmd == "set_power_shm") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kSharedFrame, msg["power"]);
+    } else if (cmd == "set_power_effect") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kEffect, msg["power"]);
+    } else if (cmd == "set_power_audio") {
+      controller_.GetFadeout().Stop();
+      controller_.GetPower().SetChannelState(Power::kAudio, msg["power"]);
+    } else if (cmd == "get_layers") {
+      SendLayers();
+    } else if (cmd == "set_layers") {
+      Power &power = controller_.GetPower();
+      if (msg.contains("exclusive")) {
+        power.SetExclusive(msg["exclusive"]);
+      }
+      if (msg.contains("transition_ms")) {
+        power.SetTransition(std::chrono::milliseconds(msg["transition_ms"]));
+      }
+      std::string error;
+      for (const auto &layer : msg.value("layers", nlohmann::json::array())) {
+        const Power::channel_e channel = Power::GetChannel(layer["channel"]);
+        if (channel == Power::kNone) {
+          continue;
+        }
+        const int opacity = layer.value("opacity", int(power.GetChannelOpacity(channel)));
+        if (opacity < 0 || opacity > 255) {
+          error = fmt::format("opacity {} of {} is not in 0..255", opacity,
+                              Power::GetChannelName(channel));
+          E("{}", error);
+          continue;
+        }
+        Compositor::blend_e blend = power.GetChannelBlend(channel);
+        Compositor::FromString(layer.value("blend", ""), blend);
+        power.SetChannelLayer(channel, opacity, blend);
+      }
+      SendLayers(error);
+    } else if (cmd == "get_segments") {
+      SendSegments();
+    } else if (cmd == "set_segments") {
+      controller_.GetPower().SetSegments(msg["segments"].get<std::vector<Compositor::segment_t>>());
+      SendSegments();
+    } else if (cmd == "get_sync") {
+      SendSync();
+    } else if (cmd == "set_sync") {
+      Sync &sync = controller_.GetSync();
+      Sync::role_e role = sync.GetRole();
+      const std::string &name = msg.value("role", "");
+      const std::string &leader = msg.value("leader", "");
+      if (!Sync::FromString(name, role)) {
+        E("Unknown sync role {}", name);
+        SendSync(fmt::format("unknown role {}", name));
+      } else if (!sync.SetRole(role, leader)) {
+        SendSync(fmt::format("invalid leader address {}", leader));
+      } else {
+        SendSync();
+      }
+    } else if (cmd == "get_color") {
+      nlohmann::json resp = GetTopicState(kTopicColor);
+      resp["rsp"] = "get_color";
+      sendMessage(resp);
+    } else if (cmd == "set_color") {
+      controller_.GetLight().SetColor(msg["red"], msg["green"], msg["blue"]);
+    } else if (cmd == "set_predefined_colors") {
+      controller_.GetLight().SetPredefinedColors(msg["colors"].get<ColorVector>());
+    } else if (cmd == "get_predefined_colors") {
+      nlohmann::json resp;
+      resp["rsp"] = "get_predefined_colors";
+      resp["colors"] = controller_.GetLight().GetPredefinedColors();
+      sendMessage(resp);
+    } else if (cmd == "get_animations") {
+      nlohmann::json resp;
+      resp["rsp"] = "get_animations";
+      resp["animations"] = controller_.GetAnimation().GetAnimationInfo();
+      sendMessage(resp);
+    } else if (cmd == "get_animation") {
+      nlohmann::json resp = GetTopicState(kTopicAnimation);
+      resp["rsp"] = "get_animation";
+      sendMessage(resp);
+    } else if (cmd == "set_animation") {
+      controller_.GetAnimation().SetAnimation(msg["hash"]);
+    } else if (cmd == "get_effect") {
+      nlohmann::json resp = GetTopicState(kTopicEffect);
+      resp["rsp"] = "get_effect";
+      sendMessage(resp);
+    } else if (cmd == "set_effect") {
+      // without source only the parameters change
+      Effect &effect = controller_.GetEffect();
+      std::string error;
+      const bool ok = effect.SetEffect(msg.value("source", effect.GetSource()),
+                                       msg.value("params", effect.GetParams()), error);
+      nlohmann::json resp;
+      resp["rsp"] = "set_effect";
+      resp["ok"] = ok;
+      if (!ok) {
+        resp["error"] = error;
+      }
+      sendMessage(resp);
+    } else if (cmd == "get_audio" || cmd == "set_audio") {
+      Audio &audio = controller_.GetAudio();
+      std::string error;
+      if (cmd == "set_audio") {
+        // keys not given keep their value
+        nlohmann::json cfg = audio.GetConfig();
+        cfg.update(msg);
+        audio.SetConfig(cfg.get<Audio::config_t>(), error);
+      }
+      nlohmann::json resp = GetTopicState(kTopicAudio);
+      resp["rsp"] = "get_audio";
+      if (!error.empty()) {
+        resp["error"] = error;
+      }
+      resp["latency_ms"] = std::chrono::duration<double, std::milli>(audio.GetLatency()).count();
+      sendMessage(resp);
+    } else if (cmd == "set_alarm") {
+      Alarm::alarm_t alarm;
+      alarm.name = msg["name"];
+      alarm.active = msg["active"];
+      alarm.hour = msg["hour"];
+      alarm.minute = msg["minute"];
+      alarm.days = msg["days"].get<std::set<int>>();
+      alarm.animation_hash = msg["animation_hash"];
+      alarm.fade_in = std::chrono::seconds(msg.value("fade_in", 0));
+      controller_.GetAlarm().SetAlarm(alarm);
+    } else if (cmd == "get_alarm") {
+      nlohmann::json resp = GetTopicState(kTopicAlarm);
+      resp["rsp"] = "get_alarm";
+      sendMessage(resp);
+    } else if (cmd == "add_alarm") {
+      nlohmann::json resp;
+      resp["rsp"] = "add_alarm";
+      resp["id"] = controller_.GetAlarm().AddAlarm(msg.get<Alarm::alarm_t>());
+      sendMessage(resp);
+    } else if (cmd == "remove_alarm") {
+      nlohmann::json resp;
+      resp["rsp"] = "remove_alarm";
+      resp["id"] = msg["id"];
+      resp["removed"] = controller_.GetAlarm().RemoveAlarm(msg["id"]);
+      sendMessage(resp);
+    } else if (cmd == "list_alarms") {
+      nlohmann::json resp;
+      resp["rsp"] = "list_alarms";
+      resp["alarms"] = controller_.GetAlarm().GetAlarms();
+      sendMessage(resp);
+    } else if (cmd == "set_timeout") {
+      Fadeout &fadeout = controller_.GetFadeout();
+      const int minutes = msg.at("minutes");
+      const int64_t fade_seconds = msg.value("fade_seconds", fadeout.GetFadeDuration().count());
+      fade_t::easing_e easing = fadeout.GetFadeEasing();
+      std::string error;
+      if (minutes < 0) {
+        error = fmt::format("negative timeout {}", minutes);
+      } else if (fade_seconds < 0) {
+        error = fmt::format("negative fade_seconds {}", fade_seconds);
+      } else if (msg.contains("easing") && !fade_t::FromString(msg.at("easing"), easing)) {
+        error = fmt::format("unknown easing {}", msg.at("easing").dump());
+      }
+      if (error.empty()) {
+        if (msg.contains("fade_seconds") || msg.contains("easing")) {
+          fadeout.SetFade(std::chrono::seconds(fade_seconds), easing);
+        }
+        fadeout.SetTimeout(msg.at("target"), std::chrono::minutes(minutes));
+      } else {
+        E("Invalid timeout: {}", error);
+      }
+      nlohmann::json resp;
+      resp["rsp"] = "set_timeout";
+      resp["ok"] = error.empty();
+      if (!error.empty()) {
+        resp["error"] = error;
+      }
+      sendMessage(resp);
+    }
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing message failed: {}", e.what());
+  }
+}
+
+void Session::sendMessage(const nlohmann::json &msg) {
+  if (!socket_.is_open()) {
+    return;
+  }
+  Trace::Span span("Session::sendMessage");
+  std::vector<uint8_t> buffer;
+  Codec::Encode(encoding_, msg, buffer);
+  D("send: {} ({} bytes {})", msg, buffer.size(), Codec::ToString(encoding_));
+  // a single large message is fine, a growing backlog is not
+  if (!send_queue_.empty() && send_backlog_ + buffer.size() > kMaxSendBacklog) {
+    E("Dropping session, {} bytes not sent", send_backlog_);
+    dropped_total_.Inc();
+    // the pending write fails and closes the session
+    socket_.close();
     return;
   }
+  messages_out_total_.Inc();
+  send_backlog_ += buffer.size();
+  send_queue_.push_back(std::move(buffer));
+  if (send_queue_.size() == 1) {
+    StartWrite();
+  }
+}
 
-  std::istream is(buffer.get());
-  std::string s;
-  std::getline(is, s);
-
-  while (s.size()) {
-    D(fmt::format("recv {}", s));
-
-    try {
-      const nlohmann::json &msg = nlohmann::json::parse(s);
-      const std::string &cmd = msg["cmd"];
-
-      if (cmd == "get_system_config") {
-        nlohmann::json resp;
-        resp["rsp"] = "get_system_config";
-        resp["name"] = controller_.GetName();
-        resp["led_count"] = controller_.GetWS2811Control().GetLedCount();
-        resp["max_brightness"] = controller_.GetWS2811Control().GetMaxBrightness();
-        sendJson(resp);
-      } else if (cmd == "set_system_config") {
-        controller_.SetName(msg["name"]);
-        controller_.GetWS2811Control().SetParameters(msg["led_count"], msg["max_brightness"]);
-      } else if (cmd == "get_power") {
-        SendPowerStatus();
-      } else if (cmd == "set_power_light") {
-        controller_.GetFadeout().Stop();
-        controller_.GetPower().SetChannelState(Power::kLight, msg["power"]);
-      } else if (cmd == "set_power_animation") {
-        controller_.GetFadeout().Stop();
-        controller_.GetPower().SetChannelState(Power::kAnimation, msg["power"]);
-      } else if (cmd == "get_color") {
-        auto [red, green, blue] = controller_.GetLight().GetColor();
-        nlohmann::json resp;
-        resp["rsp"] = "get_color";
-        resp["red"] = red;
-        resp["green"] = green;
-        resp["blue"] = blue;
-        sendJson(resp);
-      } else if (cmd == "set_color") {
-        controller_.GetLight().SetColor(msg["red"], msg["green"], msg["blue"]);
-      } else if (cmd == "set_predefined_colors") {
-        controller_.GetLight().SetPredefinedColors(msg["colors"].get<ColorVector>());
-      } else if (cmd == "get_predefined_colors") {
-        nlohmann::json resp;
-        resp["rsp"] = "get_predefined_colors";
-        resp["colors"] = controller_.GetLight().GetPredefinedColors();
-        sendJson(resp);
-      } else if (cmd == "get_animations") {
-        nlohmann::json resp;
-        resp["rsp"] = "get_animations";
-        resp["animations"] = controller_.GetAnimation().GetAnimationInfo();
-        sendJson(resp);
-      } else if (cmd == "get_animation") {
-        nlohmann::json resp;
-        resp["rsp"] = "get_animation";
-        resp["hash"] = controller_.GetAnimation().GetAnimation();
-        sendJson(resp);
-      } else if (cmd == "set_animation") {
-        controller_.GetAnimation().SetAnimation(msg["hash"]);
-      } else if (cmd == "set_alarm") {
-        Alarm::alarm_t alarm;
-        alarm.name = msg["name"];
-        alarm.active = msg["active"];
-        alarm.hour = msg["hour"];
-        alarm.minute = msg["minute"];
-        alarm.days = msg["days"].get<std::set<int>>();
-        alarm.animation_hash = msg["animation_hash"];
-        controller_.GetAlarm().SetAlarm(alarm);
-      } else if (cmd == "get_alarm") {
-        const Alarm::alarm_t &alarm = controller_.GetAlarm().GetAlarm();
-        nlohmann::json resp;
-        resp["rsp"] = "get_alarm";
-        resp["name"] = alarm.name;
-        resp["active"] = alarm.active;
-        resp["hour"] = alarm.hour;
-        resp["minute"] = alarm.minute;
-        resp["days"] = alarm.days;
-        resp["animation_hash"] = alarm.animation_hash;
-        sendJson(resp);
-      } else if (cmd == "set_timeout") {
-        controller_.GetFadeout().SetTimeout(msg["target"], std::chrono::minutes(msg["minutes"]));
-      }
-    } catch (const nlohmann::json::exception &e) {
-      E(fmt::format("Parsing message failed: {}", e.what()));
-      break;
+void Session::StartWrite() {
+  asio::async_write(socket_, asio::buffer(send_queue_.front()),
+                    Trace::Wrap("Session::OnWrite",
+                                [this](const asio::error_code &error, std::size_t size) {
+                                  OnWrite(error, size);
+                                }));
+}
+
+void Session::OnWrite(const asio::error_code &error, std::size_t size) {
+  if (error) {
+    // closed by us otherwise
+    if (socket_.is_open()) {
+      E("Send failed: {}", error.message());
     }
+    send_queue_.clear();
+    send_backlog_ = 0;
+    Close();
+    return;
+  }
 
-    std::getline(is, s);
+  bytes_out_total_.Inc(size);
+  send_backlog_ -= send_queue_.front().size();
+  send_queue_.pop_front();
+  if (!send_queue_.empty()) {
+    StartWrite();
   }
+}
 
-  Exec();
+void Session::SendLayers(const std::string &error) {
+  const Power &power = controller_.GetPower();
+  nlohmann::json resp;
+  resp["rsp"] = "get_layers";
+  if (!error.empty()) {
+    resp["error"] = error;
+  }
+  resp["exclusive"] = power.GetExclusive();
+  resp["transition_ms"] = power.GetTransition().count();
+  resp["layers"] = nlohmann::json::array();
+  for (Power::channel_e channel : Power::GetAvailableChannels()) {
+    nlohmann::json layer;
+    layer["channel"] = Power::GetChannelName(channel);
+    layer["power"] = power.GetChannelState(channel);
+    layer["opacity"] = power.GetChannelOpacity(channel);
+    layer["blend"] = Compositor::ToString(power.GetChannelBlend(channel));
+    resp["layers"].push_back(layer);
+  }
+  sendMessage(resp);
+}
+
+void Session::SendSegments() {
+  nlohmann::json resp;
+  resp["rsp"] = "get_segments";
+  resp["segments"] = controller_.GetPower().GetSegments();
+  sendMessage(resp);
 }
 
-void Session::sendJson(const nlohmann::json &msg) {
-  if (socket_.is_open()) {
-    D(fmt::format("send: {}", msg.dump()));
-    socket_.send(asio::buffer(msg.dump() + "\n"));
+void Session::SendSync(const std::string &error) {
+  nlohmann::json resp = controller_.GetSync().GetStatus();
+  resp["rsp"] = "get_sync";
+  if (!error.empty()) {
+    resp["error"] = error;
   }
+  sendMessage(resp);
 }
 
 void Session::SendPowerStatus() {
-  nlohmann::json resp;
-  const Power &power = controller_.GetPower();
+  nlohmann::json resp = GetTopicState(kTopicPower);
   resp["rsp"] = "get_power";
-  resp["light"] = power.GetChannelState(Power::kLight);
-  resp["animation"] = power.GetChannelState(Power::kAnimation);
+  sendMessage(resp);
+}
 
-  const Fadeout &fadeout = controller_.GetFadeout();
-  resp["timeout_active"] = fadeout.GetTimeoutActive();
-  sendJson(resp);
+nlohmann::json Session::GetTopicState(topic_e topic) const {
+  nlohmann::json state;
+  switch (topic) {
+  case kTopicPower: {
+    const Power &power = controller_.GetPower();
+    state["light"] = power.GetChannelState(Power::kLight);
+    state["animation"] = power.GetChannelState(Power::kAnimation);
+    state["live"] = power.GetChannelState(Power::kLive);
+    state["shm"] = power.GetChannelState(Power::kSharedFrame);
+    state["effect"] = power.GetChannelState(Power::kEffect);
+    state["audio"] = power.GetChannelState(Power::kAudio);
+    state["timeout_active"] = controller_.GetFadeout().GetTimeoutActive();
+    break;
+  }
+  case kTopicColor: {
+    auto [red, green, blue] = controller_.GetLight().GetColor();
+    state["red"] = red;
+    state["green"] = green;
+    state["blue"] = blue;
+    break;
+  }
+  case kTopicAnimation: {
+    const Animation &animation = controller_.GetAnimation();
+    state["hash"] = animation.GetAnimation();
+    state["loading"] = animation.GetLoading();
+    // progress of a preload in the background is not of interest
+    state["progress"] = animation.GetLoading().empty() ? 100 : animation.GetLoadProgress();
+    break;
+  }
+  case kTopicAlarm: {
+    const Alarm::alarm_t &alarm = controller_.GetAlarm().GetAlarm();
+    state["name"] = alarm.name;
+    state["active"] = alarm.active;
+    state["hour"] = alarm.hour;
+    state["minute"] = alarm.minute;
+    state["days"] = alarm.days;
+    state["animation_hash"] = alarm.animation_hash;
+    state["fade_in"] = alarm.fade_in.count();
+    state["alarms"] = controller_.GetAlarm().GetAlarms();
+    break;
+  }
+  case kTopicFadeout: {
+    const Fadeout &fadeout = controller_.GetFadeout();
+    state["timeout_active"] = fadeout.GetTimeoutActive();
+    state["brightness"] = fadeout.GetBrightness();
+    state["fade_seconds"] = fadeout.GetFadeDuration().count();
+    state["easing"] = fade_t::ToString(fadeout.GetFadeEasing());
+    break;
+  }
+  case kTopicCatalog:
+    state["animations"] = controller_.GetAnimation().GetAnimationInfo();
+    break;
+  case kTopicEffect: {
+    const Effect &effect = controller_.GetEffect();
+    state["source"] = effect.GetSource();
+    state["params"] = effect.GetParams();
+    state["instructions"] = effect.GetInstructionCount();
+    break;
+  }
+  case kTopicAudio: {
+    const Audio &audio = controller_.GetAudio();
+    state = audio.GetConfig();
+    state["capturing"] = audio.GetCapturing();
+    state["sources"] = nlohmann::json::array();
+    for (AudioSource::type_e type : AudioSource::GetAvailableTypes()) {
+      state["sources"].push_back(AudioSource::ToString(type));
+    }
+    break;
+  }
+  }
+  return state;
+}
+
+void Session::OnSubscribe(const nlohmann::json &topics, bool subscribe) {
+  uint32_t mask = 0;
+  for (const auto &name : topics) {
+    for (const auto &[topic, topic_name] : kTopics) {
+      if (name == topic_name) {
+        mask |= topic;
+      }
+    }
+  }
+
+  const uint32_t added = subscribe ? mask & ~topics_ : 0;
+  topics_ = subscribe ? topics_ | mask : topics_ & ~mask;
+  for (const auto &topic : kTopics) {
+    if ((topics_ & topic.first) == 0) {
+      last_state_.erase(topic.first);
+    }
+  }
+
+  // subscribers are idle most of the time, let TCP detect dead peers instead of the timeout
+  asio::error_code error;
+  socket_.set_option(asio::socket_base::keep_alive(IsSubscribed()), error);
+
+  nlohmann::json resp;
+  resp["rsp"] = subscribe ? "subscribe" : "unsubscribe";
+  resp["topics"] = nlohmann::json::array();
+  for (const auto &[topic, name] : kTopics) {
+    if (topics_ & topic) {
+      resp["topics"].push_back(name);
+    }
+  }
+  sendMessage(resp);
+
+  // start with the full state of new topics
+  Notify(added);
+}
+
+void Session::Notify(uint32_t topics) {
+  for (const auto &[topic, name] : kTopics) {
+    if ((topics & topics_ & topic) == 0) {
+      continue;
+    }
+
+    const nlohmann::json &state = GetTopicState(topic);
+    nlohmann::json &last = last_state_[topic];
+
+    // send changed values only
+    nlohmann::json delta;
+    for (const auto &[key, value] : state.items()) {
+      if (!last.contains(key) || last[key] != value) {
+        delta[key] = value;
+      }
+    }
+    if (delta.empty()) {
+      continue;
+    }
+
+    last = state;
+    delta["evt"] = name;
+    sendMessage(delta);
+  }
 }
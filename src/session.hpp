@@ -18,10 +18,15 @@
 #ifndef SRC_SESSION_HPP
 #define SRC_SESSION_HPP
 
+#include <array>
 #include <asio.hpp>
+#include <deque>
+#include <map>
 #include <nlohmann/json.hpp>
 
+#include "codec.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 
 class Controller;
 
@@ -35,16 +40,80 @@ public:
   void Stop();
 
   void SendPowerStatus();
+  // with `error` set if a layer of the last set_layers was rejected
+  void SendLayers(const std::string &error = "");
+  void SendSegments();
+  // with `error` set if the last set_sync was rejected
+  void SendSync(const std::string &error = "");
+
+  enum topic_e : uint32_t {
+    kTopicPower = 0x01,
+    kTopicColor = 0x02,
+    kTopicAnimation = 0x04,
+    kTopicAlarm = 0x08,
+    kTopicFadeout = 0x10,
+    kTopicCatalog = 0x20,
+    kTopicEffect = 0x40,
+    kTopicAudio = 0x80,
+  };
+
+  bool IsSubscribed() const { return topics_ != 0; }
+  // Push the changes of all subscribed topics in topics since the last notification
+  void Notify(uint32_t topics);
 
 private:
-  void OnMessageReceived(std::shared_ptr<asio::streambuf> buffer, const asio::error_code &error,
-                         std::size_t size);
-  void sendJson(const nlohmann::json &msg);
+  static constexpr std::array<std::pair<topic_e, const char *>, 8> kTopics = {{
+      {kTopicPower, "power"},
+      {kTopicColor, "color"},
+      {kTopicAnimation, "animation"},
+      {kTopicAlarm, "alarm"},
+      {kTopicFadeout, "fadeout"},
+      {kTopicCatalog, "catalog"},
+      {kTopicEffect, "effect"},
+      {kTopicAudio, "audio"},
+  }};
+
+  void OnMessageReceived(const asio::error_code &error, std::size_t size);
+  void OnCommand(const nlohmann::json &msg);
+  void OnSubscribe(const nlohmann::json &topics, bool subscribe);
+  void sendMessage(const nlohmann::json &msg);
+  void StartWrite();
+  void OnWrite(const asio::error_code &error, std::size_t size);
+  // close the socket, the session is deleted once the pending read and write are done
+  void Close();
+
+  nlohmann::json GetTopicState(topic_e topic) const;
+
+  // a client that doesn't read anymore is dropped once that much waits to be sent
+  static constexpr std::size_t kMaxSendBacklog = 256 * 1024;
 
   std::atomic_bool is_alive_{true};
+  bool reading_{false};
 
   asio::ip::tcp::socket socket_;
   asio::steady_timer timer_;
+  asio::streambuf buffer_;
+
+  Codec::encoding_e encoding_{Codec::encoding_e::json};
+  // encoded messages, the front one is being written
+  std::deque<std::vector<uint8_t>> send_queue_;
+  std::size_t send_backlog_{0};
+
+  Metrics::Counter &messages_in_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_session_messages_in_total", "Messages received by all sessions")};
+  Metrics::Counter &messages_out_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_session_messages_out_total", "Messages sent by all sessions")};
+  Metrics::Counter &bytes_in_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_session_bytes_in_total", "Bytes received by all sessions")};
+  Metrics::Counter &bytes_out_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_session_bytes_out_total", "Bytes sent by all sessions")};
+  Metrics::Counter &dropped_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_session_dropped_total", "Sessions closed for not reading their messages")};
+  Metrics::Histogram &command_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_session_command_seconds", "Time to process a session command")};
+
+  uint32_t topics_{0};
+  std::map<topic_e, nlohmann::json> last_state_;
 
   Controller &controller_;
 };
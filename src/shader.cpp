@@ -0,0 +1,783 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "shader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+#include <map>
+#include <stdexcept>
+
+namespace {
+using op_e = Shader::op_e;
+
+struct function_t {
+  const char *name;
+  op_e op;
+  std::size_t arity;
+};
+
+constexpr function_t kFunctions[] = {
+    {"sin", op_e::sin, 1},     {"cos", op_e::cos, 1},     {"abs", op_e::abs, 1},
+    {"floor", op_e::floor, 1}, {"fract", op_e::fract, 1}, {"sqrt", op_e::sqrt, 1},
+    {"exp", op_e::exp, 1},     {"pow", op_e::pow, 2},     {"min", op_e::min, 2},
+    {"max", op_e::max, 2},     {"clamp", op_e::clamp, 3}, {"mix", op_e::mix, 3},
+    {"step", op_e::step, 2},   {"smoothstep", op_e::smoothstep, 3},
+    {"rand", op_e::rand, 1},
+};
+
+inline float Mod(float a, float b) { return a - b * std::floor(a / b); }
+inline float Fract(float a) { return a - std::floor(a); }
+inline float Clamp(float a, float lo, float hi) { return std::min(std::max(a, lo), hi); }
+inline float Smoothstep(float lo, float hi, float a) {
+  const float x = Clamp((a - lo) / (hi - lo), 0.0F, 1.0F);
+  return x * x * (3.0F - 2.0F * x);
+}
+// cheap hash to 0..1, the same value for the same input
+inline float Rand(float a) { return Fract(std::sin(a * 12.9898F) * 43758.5453F); }
+
+float Apply(op_e op, float a, float b, float c) {
+  switch (op) {
+  case op_e::add:
+    return a + b;
+  case op_e::sub:
+    return a - b;
+  case op_e::mul:
+    return a * b;
+  case op_e::div:
+    return a / b;
+  case op_e::mod:
+    return Mod(a, b);
+  case op_e::neg:
+    return -a;
+  case op_e::lt:
+    return a < b;
+  case op_e::le:
+    return a <= b;
+  case op_e::gt:
+    return a > b;
+  case op_e::ge:
+    return a >= b;
+  case op_e::eq:
+    return a == b;
+  case op_e::ne:
+    return a != b;
+  case op_e::land:
+    return a != 0.0F && b != 0.0F;
+  case op_e::lor:
+    return a != 0.0F || b != 0.0F;
+  case op_e::lnot:
+    return a == 0.0F;
+  case op_e::select:
+    return a != 0.0F ? b : c;
+  case op_e::sin:
+    return std::sin(a);
+  case op_e::cos:
+    return std::cos(a);
+  case op_e::abs:
+    return std::fabs(a);
+  case op_e::floor:
+    return std::floor(a);
+  case op_e::fract:
+    return Fract(a);
+  case op_e::sqrt:
+    return std::sqrt(a);
+  case op_e::exp:
+    return std::exp(a);
+  case op_e::pow:
+    return std::pow(a, b);
+  case op_e::min:
+    return std::min(a, b);
+  case op_e::max:
+    return std::max(a, b);
+  case op_e::clamp:
+    return Clamp(a, b, c);
+  case op_e::mix:
+    return a + (b - a) * c;
+  case op_e::step:
+    return b >= a;
+  case op_e::smoothstep:
+    return Smoothstep(a, b, c);
+  case op_e::rand:
+    return Rand(a);
+  }
+  return 0.0F;
+}
+
+// the destination is never an operand, a register is reused only after its last read
+template <typename F> void Unary(float *__restrict d, const float *a, F f) {
+  for (std::size_t k = 0; k < Shader::kBatch; ++k) {
+    d[k] = f(a[k]);
+  }
+}
+
+template <typename F> void Binary(float *__restrict d, const float *a, const float *b, F f) {
+  for (std::size_t k = 0; k < Shader::kBatch; ++k) {
+    d[k] = f(a[k], b[k]);
+  }
+}
+
+template <typename F>
+void Ternary(float *__restrict d, const float *a, const float *b, const float *c, F f) {
+  for (std::size_t k = 0; k < Shader::kBatch; ++k) {
+    d[k] = f(a[k], b[k], c[k]);
+  }
+}
+
+// 0..1 to 0..255, NaN is 0
+inline uint32_t ToChannel(float v) {
+  if (!(v > 0.0F)) {
+    return 0;
+  }
+  if (v >= 1.0F) {
+    return 255;
+  }
+  return static_cast<uint32_t>(v * 255.0F + 0.5F);
+}
+
+struct compile_error : public std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+} // namespace
+
+/**
+ * @brief Recursive descent parser emitting the bytecode directly
+ *
+ * Registers of values used in one statement only are reused by the following statements. The
+ * uniform and constant registers are never reused, the uniform code runs once before all
+ * batches.
+ */
+class ShaderCompiler {
+public:
+  ShaderCompiler(const std::string &source, const std::vector<std::string> &params)
+      : source_(source), params_(params) {}
+
+  void Compile(Shader &shader);
+
+private:
+  struct token_t {
+    enum { end, number, name, symbol } kind{end};
+    std::string text;
+    float value{0};
+    std::size_t line{1};
+    std::size_t column{1};
+  };
+
+  struct register_t {
+    bool uniform{true};
+    bool constant{false};
+    float value{0};
+    // variables bound to the register
+    int bound{0};
+    bool reusable{false};
+  };
+
+  [[noreturn]] void Fail(const token_t &token, const std::string &message) const {
+    throw compile_error(fmt::format("{}:{}: {}", token.line, token.column, message));
+  }
+
+  void Next();
+  bool Accept(const char *symbol);
+  void Expect(const char *symbol);
+
+  void Statement();
+  uint16_t Expression();
+  uint16_t Or();
+  uint16_t And();
+  uint16_t Comparison();
+  uint16_t Sum();
+  uint16_t Product();
+  uint16_t Unary();
+  uint16_t Primary();
+
+  uint16_t Allocate(bool uniform);
+  uint16_t Constant(float value);
+  uint16_t Emit(op_e op, uint16_t a, uint16_t b = 0, uint16_t c = 0, std::size_t arity = 2);
+  void Bind(const std::string &name, uint16_t reg);
+  void RemoveDeadCode(const std::array<uint16_t, 4> &outputs);
+
+  const std::string &source_;
+  const std::vector<std::string> &params_;
+  std::size_t pos_{0};
+  std::size_t line_{1};
+  std::size_t column_{1};
+  token_t token_;
+  std::size_t depth_{0};
+
+  std::vector<register_t> registers_;
+  std::vector<uint16_t> free_;
+  std::vector<uint16_t> statement_;
+  std::map<std::string, uint16_t> names_;
+  std::map<float, uint16_t> constants_;
+  std::vector<Shader::instruction_t> uniform_code_;
+  std::vector<Shader::instruction_t> code_;
+  bool time_dependent_{false};
+};
+
+void ShaderCompiler::Next() {
+  // skip white space and comments
+  while (pos_ < source_.size()) {
+    const char ch = source_[pos_];
+    if (ch == '\n') {
+      line_++;
+      column_ = 1;
+      pos_++;
+    } else if (std::isspace(static_cast<unsigned char>(ch))) {
+      column_++;
+      pos_++;
+    } else if (source_.compare(pos_, 2, "//") == 0) {
+      while (pos_ < source_.size() && source_[pos_] != '\n') {
+        pos_++;
+      }
+    } else {
+      break;
+    }
+  }
+
+  token_ = token_t();
+  token_.line = line_;
+  token_.column = column_;
+  if (pos_ >= source_.size()) {
+    return;
+  }
+
+  const std::size_t start = pos_;
+  const char ch = source_[pos_];
+  if (std::isdigit(static_cast<unsigned char>(ch)) || ch == '.') {
+    token_.kind = token_t::number;
+    const char *begin = source_.c_str() + pos_;
+    char *end = nullptr;
+    token_.value = std::strtof(begin, &end);
+    if (end == begin) {
+      Fail(token_, "invalid number");
+    }
+    pos_ += end - begin;
+  } else if (std::isalpha(static_cast<unsigned char>(ch)) || ch == '_') {
+    token_.kind = token_t::name;
+    while (pos_ < source_.size() &&
+           (std::isalnum(static_cast<unsigned char>(source_[pos_])) || source_[pos_] == '_')) {
+      pos_++;
+    }
+  } else {
+    token_.kind = token_t::symbol;
+    static const char *kSymbols[] = {"<=", ">=", "==", "!=", "&&", "||"};
+    pos_++;
+    for (const char *symbol : kSymbols) {
+      if (source_.compare(start, 2, symbol) == 0) {
+        pos_++;
+        break;
+      }
+    }
+    if (pos_ - start == 1 && std::strchr("+-*/%()<>!?:=,;", ch) == nullptr) {
+      Fail(token_, fmt::format("unexpected character '{}'", ch));
+    }
+  }
+  token_.text = source_.substr(start, pos_ - start);
+  column_ += pos_ - start;
+}
+
+bool ShaderCompiler::Accept(const char *symbol) {
+  if (token_.kind == token_t::symbol && token_.text == symbol) {
+    Next();
+    return true;
+  }
+  return false;
+}
+
+void ShaderCompiler::Expect(const char *symbol) {
+  if (!Accept(symbol)) {
+    Fail(token_, fmt::format("expected '{}'", symbol));
+  }
+}
+
+void ShaderCompiler::Compile(Shader &shader) {
+  if (source_.size() > Shader::kMaxSourceSize) {
+    throw compile_error(fmt::format("source larger than {} bytes", Shader::kMaxSourceSize));
+  }
+  if (params_.size() > Shader::kMaxParams) {
+    throw compile_error(fmt::format("more than {} parameters", Shader::kMaxParams));
+  }
+
+  registers_.resize(Shader::kFixedRegisters);
+  registers_[Shader::kRegI].uniform = false;
+  registers_[Shader::kRegX].uniform = false;
+  names_ = {{"i", Shader::kRegI}, {"x", Shader::kRegX}, {"n", Shader::kRegN}, {"t", Shader::kRegT}};
+  for (const std::string &param : params_) {
+    const bool valid =
+        !param.empty() && (std::isalpha(static_cast<unsigned char>(param[0])) || param[0] == '_') &&
+        std::all_of(param.begin(), param.end(),
+                    [](char ch) { return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_'; });
+    if (!valid || names_.count(param) != 0 || param == "pi") {
+      throw compile_error(fmt::format("invalid parameter name '{}'", param));
+    }
+    names_[param] = Allocate(true);
+  }
+  // inputs and parameters can't be assigned
+  const std::map<std::string, uint16_t> fixed = names_;
+
+  Next();
+  while (token_.kind != token_t::end) {
+    const token_t target = token_;
+    if (target.kind != token_t::name) {
+      Fail(target, "expected an assignment");
+    }
+    if (fixed.count(target.text) != 0 || target.text == "pi" ||
+        std::any_of(std::begin(kFunctions), std::end(kFunctions),
+                    [&](const function_t &f) { return target.text == f.name; })) {
+      Fail(target, fmt::format("can't assign to '{}'", target.text));
+    }
+    Next();
+    Expect("=");
+    const uint16_t value = Expression();
+    if (token_.kind != token_t::end) {
+      Expect(";");
+    }
+    Bind(target.text, value);
+  }
+
+  // allocating the constant may fail, the shader is changed only once all is done
+  std::array<uint16_t, 4> outputs;
+  for (std::size_t i = 0; i < outputs.size(); ++i) {
+    auto it = names_.find(std::string(1, "rgbw"[i]));
+    outputs[i] = it != names_.end() ? it->second : Constant(0.0F);
+  }
+  RemoveDeadCode(outputs);
+
+  std::copy(outputs.begin(), outputs.end(), shader.outputs_);
+  shader.uniform_code_ = std::move(uniform_code_);
+  shader.code_ = std::move(code_);
+  shader.params_ = params_;
+  shader.time_dependent_ = time_dependent_;
+  shader.register_count_ = registers_.size();
+  shader.registers_.assign(registers_.size() * Shader::kBatch, 0.0F);
+  for (std::size_t reg = 0; reg < registers_.size(); ++reg) {
+    if (registers_[reg].constant) {
+      std::fill_n(shader.Row(reg), Shader::kBatch, registers_[reg].value);
+    }
+  }
+}
+
+void ShaderCompiler::Bind(const std::string &name, uint16_t reg) {
+  registers_[reg].bound++;
+  auto it = names_.find(name);
+  if (it != names_.end()) {
+    register_t &previous = registers_[it->second];
+    previous.bound--;
+    if (previous.reusable && previous.bound == 0) {
+      free_.push_back(it->second);
+    }
+    it->second = reg;
+  } else {
+    names_[name] = reg;
+  }
+
+  // values of this statement not bound to a variable are free for the next one
+  for (uint16_t temp : statement_) {
+    if (registers_[temp].bound == 0) {
+      free_.push_back(temp);
+    }
+  }
+  statement_.clear();
+}
+
+uint16_t ShaderCompiler::Allocate(bool uniform) {
+  if (!uniform && !free_.empty()) {
+    const uint16_t reg = free_.back();
+    free_.pop_back();
+    statement_.push_back(reg);
+    return reg;
+  }
+  if (registers_.size() >= Shader::kMaxRegisters) {
+    Fail(token_, "program too large");
+  }
+  registers_.emplace_back();
+  registers_.back().uniform = uniform;
+  const uint16_t reg = registers_.size() - 1;
+  if (!uniform) {
+    registers_.back().reusable = true;
+    statement_.push_back(reg);
+  }
+  return reg;
+}
+
+uint16_t ShaderCompiler::Constant(float value) {
+  auto it = constants_.find(value);
+  if (it != constants_.end()) {
+    return it->second;
+  }
+  const uint16_t reg = Allocate(true);
+  registers_[reg].constant = true;
+  registers_[reg].value = value;
+  if (!std::isnan(value)) {
+    constants_[value] = reg;
+  }
+  return reg;
+}
+
+uint16_t ShaderCompiler::Emit(op_e op, uint16_t a, uint16_t b, uint16_t c, std::size_t arity) {
+  const uint16_t operands[] = {a, b, c};
+  bool constant = true;
+  bool uniform = true;
+  for (std::size_t i = 0; i < arity; ++i) {
+    constant = constant && registers_[operands[i]].constant;
+    uniform = uniform && registers_[operands[i]].uniform;
+  }
+  if (constant) {
+    return Constant(Apply(op, registers_[a].value, registers_[b].value, registers_[c].value));
+  }
+  if (uniform_code_.size() + code_.size() >= Shader::kMaxInstructions) {
+    Fail(token_, "program too large");
+  }
+  const uint16_t dst = Allocate(uniform);
+  (uniform ? uniform_code_ : code_).push_back({op, dst, a, b, c});
+  return dst;
+}
+
+void ShaderCompiler::RemoveDeadCode(const std::array<uint16_t, 4> &outputs) {
+  // registers are reused, thus track liveness backwards through the straight code
+  std::vector<bool> live(registers_.size(), false);
+  for (uint16_t output : outputs) {
+    live[output] = true;
+  }
+  auto sweep = [&](std::vector<Shader::instruction_t> &code) {
+    std::vector<Shader::instruction_t> kept;
+    for (auto it = code.rbegin(); it != code.rend(); ++it) {
+      if (!live[it->dst]) {
+        continue;
+      }
+      live[it->dst] = false;
+      live[it->a] = live[it->b] = live[it->c] = true;
+      kept.push_back(*it);
+    }
+    code.assign(kept.rbegin(), kept.rend());
+  };
+  sweep(code_);
+  sweep(uniform_code_);
+}
+
+uint16_t ShaderCompiler::Expression() {
+  if (++depth_ > Shader::kMaxDepth) {
+    Fail(token_, "expression nested too deep");
+  }
+  uint16_t value = Or();
+  if (Accept("?")) {
+    const uint16_t if_true = Expression();
+    Expect(":");
+    const uint16_t if_false = Expression();
+    value = Emit(op_e::select, value, if_true, if_false, 3);
+  }
+  depth_--;
+  return value;
+}
+
+uint16_t ShaderCompiler::Or() {
+  uint16_t value = And();
+  while (Accept("||")) {
+    value = Emit(op_e::lor, value, And());
+  }
+  return value;
+}
+
+uint16_t ShaderCompiler::And() {
+  uint16_t value = Comparison();
+  while (Accept("&&")) {
+    value = Emit(op_e::land, value, Comparison());
+  }
+  return value;
+}
+
+uint16_t ShaderCompiler::Comparison() {
+  static const std::pair<const char *, op_e> kOperators[] = {
+      {"<", op_e::lt}, {"<=", op_e::le}, {">", op_e::gt},
+      {">=", op_e::ge}, {"==", op_e::eq}, {"!=", op_e::ne}};
+  uint16_t value = Sum();
+  bool found = true;
+  while (found) {
+    found = false;
+    for (const auto &[symbol, op] : kOperators) {
+      if (Accept(symbol)) {
+        value = Emit(op, value, Sum());
+        found = true;
+        break;
+      }
+    }
+  }
+  return value;
+}
+
+uint16_t ShaderCompiler::Sum() {
+  uint16_t value = Product();
+  while (true) {
+    if (Accept("+")) {
+      value = Emit(op_e::add, value, Product());
+    } else if (Accept("-")) {
+      value = Emit(op_e::sub, value, Product());
+    } else {
+      return value;
+    }
+  }
+}
+
+uint16_t ShaderCompiler::Product() {
+  uint16_t value = Unary();
+  while (true) {
+    if (Accept("*")) {
+      value = Emit(op_e::mul, value, Unary());
+    } else if (Accept("/")) {
+      value = Emit(op_e::div, value, Unary());
+    } else if (Accept("%")) {
+      value = Emit(op_e::mod, value, Unary());
+    } else {
+      return value;
+    }
+  }
+}
+
+uint16_t ShaderCompiler::Unary() {
+  if (++depth_ > Shader::kMaxDepth) {
+    Fail(token_, "expression nested too deep");
+  }
+  uint16_t value;
+  if (Accept("-")) {
+    value = Emit(op_e::neg, Unary(), 0, 0, 1);
+  } else if (Accept("!")) {
+    value = Emit(op_e::lnot, Unary(), 0, 0, 1);
+  } else if (Accept("+")) {
+    value = Unary();
+  } else {
+    value = Primary();
+  }
+  depth_--;
+  return value;
+}
+
+uint16_t ShaderCompiler::Primary() {
+  const token_t token = token_;
+  if (token.kind == token_t::number) {
+    Next();
+    return Constant(token.value);
+  }
+  if (Accept("(")) {
+    const uint16_t value = Expression();
+    Expect(")");
+    return value;
+  }
+  if (token.kind != token_t::name) {
+    Fail(token, token.kind == token_t::end ? "unexpected end" : "expected a value");
+  }
+  Next();
+
+  if (Accept("(")) {
+    const function_t *function = nullptr;
+    for (const function_t &f : kFunctions) {
+      if (token.text == f.name) {
+        function = &f;
+      }
+    }
+    if (function == nullptr) {
+      Fail(token, fmt::format("unknown function '{}'", token.text));
+    }
+    uint16_t args[3] = {0, 0, 0};
+    std::size_t count = 0;
+    if (!Accept(")")) {
+      do {
+        if (count == 3) {
+          Fail(token_, "too many arguments");
+        }
+        args[count++] = Expression();
+      } while (Accept(","));
+      Expect(")");
+    }
+    if (count != function->arity) {
+      Fail(token, fmt::format("{} takes {} argument{}", function->name, function->arity,
+                              function->arity == 1 ? "" : "s"));
+    }
+    return Emit(function->op, args[0], args[1], args[2], count);
+  }
+
+  if (token.text == "pi") {
+    return Constant(static_cast<float>(M_PI));
+  }
+  auto it = names_.find(token.text);
+  if (it == names_.end()) {
+    Fail(token, fmt::format("unknown name '{}'", token.text));
+  }
+  if (it->second == Shader::kRegT) {
+    time_dependent_ = true;
+  }
+  return it->second;
+}
+
+Shader::Shader() {
+  // an empty program shows black
+  std::string error;
+  Compile("", {}, error);
+}
+
+bool Shader::Compile(const std::string &source, const std::vector<std::string> &params,
+                     std::string &error) {
+  try {
+    ShaderCompiler compiler(source, params);
+    compiler.Compile(*this);
+  } catch (const compile_error &e) {
+    error = e.what();
+    return false;
+  }
+  return true;
+}
+
+void Shader::SetParam(const std::string &name, float value) {
+  for (std::size_t i = 0; i < params_.size(); ++i) {
+    if (params_[i] == name) {
+      std::fill_n(Row(kFixedRegisters + i), kBatch, value);
+    }
+  }
+}
+
+void Shader::Execute(const std::vector<instruction_t> &code) {
+  for (const instruction_t &in : code) {
+    float *d = Row(in.dst);
+    const float *a = Row(in.a);
+    const float *b = Row(in.b);
+    const float *c = Row(in.c);
+    switch (in.op) {
+    case op_e::add:
+      Binary(d, a, b, [](float x, float y) { return x + y; });
+      break;
+    case op_e::sub:
+      Binary(d, a, b, [](float x, float y) { return x - y; });
+      break;
+    case op_e::mul:
+      Binary(d, a, b, [](float x, float y) { return x * y; });
+      break;
+    case op_e::div:
+      Binary(d, a, b, [](float x, float y) { return x / y; });
+      break;
+    case op_e::mod:
+      Binary(d, a, b, Mod);
+      break;
+    case op_e::neg:
+      Unary(d, a, [](float x) { return -x; });
+      break;
+    case op_e::lt:
+      Binary(d, a, b, [](float x, float y) { return x < y ? 1.0F : 0.0F; });
+      break;
+    case op_e::le:
+      Binary(d, a, b, [](float x, float y) { return x <= y ? 1.0F : 0.0F; });
+      break;
+    case op_e::gt:
+      Binary(d, a, b, [](float x, float y) { return x > y ? 1.0F : 0.0F; });
+      break;
+    case op_e::ge:
+      Binary(d, a, b, [](float x, float y) { return x >= y ? 1.0F : 0.0F; });
+      break;
+    case op_e::eq:
+      Binary(d, a, b, [](float x, float y) { return x == y ? 1.0F : 0.0F; });
+      break;
+    case op_e::ne:
+      Binary(d, a, b, [](float x, float y) { return x != y ? 1.0F : 0.0F; });
+      break;
+    case op_e::land:
+      Binary(d, a, b, [](float x, float y) { return x != 0.0F && y != 0.0F ? 1.0F : 0.0F; });
+      break;
+    case op_e::lor:
+      Binary(d, a, b, [](float x, float y) { return x != 0.0F || y != 0.0F ? 1.0F : 0.0F; });
+      break;
+    case op_e::lnot:
+      Unary(d, a, [](float x) { return x == 0.0F ? 1.0F : 0.0F; });
+      break;
+    case op_e::select:
+      Ternary(d, a, b, c, [](float x, float y, float z) { return x != 0.0F ? y : z; });
+      break;
+    case op_e::sin:
+      Unary(d, a, [](float x) { return std::sin(x); });
+      break;
+    case op_e::cos:
+      Unary(d, a, [](float x) { return std::cos(x); });
+      break;
+    case op_e::abs:
+      Unary(d, a, [](float x) { return std::fabs(x); });
+      break;
+    case op_e::floor:
+      Unary(d, a, [](float x) { return std::floor(x); });
+      break;
+    case op_e::fract:
+      Unary(d, a, Fract);
+      break;
+    case op_e::sqrt:
+      Unary(d, a, [](float x) { return std::sqrt(x); });
+      break;
+    case op_e::exp:
+      Unary(d, a, [](float x) { return std::exp(x); });
+      break;
+    case op_e::pow:
+      Binary(d, a, b, [](float x, float y) { return std::pow(x, y); });
+      break;
+    case op_e::min:
+      Binary(d, a, b, [](float x, float y) { return std::min(x, y); });
+      break;
+    case op_e::max:
+      Binary(d, a, b, [](float x, float y) { return std::max(x, y); });
+      break;
+    case op_e::clamp:
+      Ternary(d, a, b, c, Clamp);
+      break;
+    case op_e::mix:
+      Ternary(d, a, b, c, [](float x, float y, float z) { return x + (y - x) * z; });
+      break;
+    case op_e::step:
+      Binary(d, a, b, [](float x, float y) { return y >= x ? 1.0F : 0.0F; });
+      break;
+    case op_e::smoothstep:
+      Ternary(d, a, b, c, Smoothstep);
+      break;
+    case op_e::rand:
+      Unary(d, a, Rand);
+      break;
+    }
+  }
+}
+
+void Shader::Render(ws2811_led_t *frame, std::size_t count, float time) {
+  std::fill_n(Row(kRegN), kBatch, static_cast<float>(count));
+  std::fill_n(Row(kRegT), kBatch, time);
+  Execute(uniform_code_);
+
+  const float scale = count > 1 ? 1.0F / (count - 1) : 0.0F;
+  float *index = Row(kRegI);
+  float *position = Row(kRegX);
+  for (std::size_t start = 0; start < count; start += kBatch) {
+    for (std::size_t k = 0; k < kBatch; ++k) {
+      index[k] = static_cast<float>(start + k);
+      position[k] = index[k] * scale;
+    }
+    Execute(code_);
+
+    const float *red = Row(outputs_[0]);
+    const float *green = Row(outputs_[1]);
+    const float *blue = Row(outputs_[2]);
+    const float *white = Row(outputs_[3]);
+    const std::size_t lanes = std::min(kBatch, count - start);
+    for (std::size_t k = 0; k < lanes; ++k) {
+      frame[start + k] = ToChannel(white[k]) << 24 | ToChannel(red[k]) << 16 |
+                         ToChannel(green[k]) << 8 | ToChannel(blue[k]);
+    }
+  }
+}
@@ -0,0 +1,131 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_SHADER_HPP
+#define SRC_SHADER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ws2811/ws2811.h>
+
+/**
+ * @brief Per pixel expression language, compiled to bytecode
+ *
+ * A program is a list of assignments `name = expression;`. The inputs are the pixel index `i`,
+ * its position `x` from 0 to 1, the pixel count `n`, the time `t` in seconds and the named
+ * parameters. The outputs are the variables `r`, `g`, `b` and `w` in the range 0 to 1, unset
+ * ones are 0. Expressions know the arithmetic, comparison and logic operators of C, `?:`, the
+ * constant `pi` and a fixed set of functions (see kFunctions). There are no loops, no memory
+ * access and no calls into the daemon, a program runs in bounded time by construction.
+ *
+ * Each register is assigned once. Instructions depending on uniform values only (`n`, `t`,
+ * parameters and constants) are hoisted and run once per frame, all others run on batches of
+ * kBatch pixels with each instruction looping over the batch. Constant expressions are folded
+ * at compile time.
+ */
+class Shader {
+public:
+  static constexpr std::size_t kBatch = 64;
+  static constexpr std::size_t kMaxSourceSize = 16 * 1024;
+  static constexpr std::size_t kMaxInstructions = 1024;
+  static constexpr std::size_t kMaxRegisters = 1024;
+  static constexpr std::size_t kMaxParams = 16;
+  static constexpr std::size_t kMaxDepth = 64;
+
+  enum class op_e : uint8_t {
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    neg,
+    lt,
+    le,
+    gt,
+    ge,
+    eq,
+    ne,
+    land,
+    lor,
+    lnot,
+    select,
+    sin,
+    cos,
+    abs,
+    floor,
+    fract,
+    sqrt,
+    exp,
+    pow,
+    min,
+    max,
+    clamp,
+    mix,
+    step,
+    smoothstep,
+    rand
+  };
+
+  struct instruction_t {
+    op_e op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+  };
+
+  Shader();
+
+  /**
+   * @brief Compile the source with the given parameter names
+   *
+   * On failure `error` holds the reason with line and column and the previous program is kept.
+   * All parameters are 0 afterwards.
+   */
+  bool Compile(const std::string &source, const std::vector<std::string> &params,
+               std::string &error);
+  void SetParam(const std::string &name, float value);
+
+  /** @brief Evaluate the program for `count` pixels at time `time` into frame */
+  void Render(ws2811_led_t *frame, std::size_t count, float time);
+
+  /** @brief The program reads `t`, i.e. the frame changes over time */
+  bool GetTimeDependent() const { return time_dependent_; }
+  std::size_t GetInstructionCount() const { return uniform_code_.size() + code_.size(); }
+  std::size_t GetRegisterCount() const { return register_count_; }
+
+private:
+  friend class ShaderCompiler;
+
+  void Execute(const std::vector<instruction_t> &code);
+  float *Row(uint16_t reg) { return registers_.data() + reg * kBatch; }
+
+  // fixed registers, followed by the parameters, constants and the program's values
+  enum : uint16_t { kRegI, kRegX, kRegN, kRegT, kFixedRegisters };
+
+  std::vector<instruction_t> uniform_code_;
+  std::vector<instruction_t> code_;
+  std::vector<std::string> params_;
+  std::vector<float> registers_;
+  std::size_t register_count_{kFixedRegisters};
+  // registers of r, g, b and w
+  uint16_t outputs_[4]{};
+  bool time_dependent_{false};
+};
+
+#endif // SRC_SHADER_HPP
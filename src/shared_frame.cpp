@@ -0,0 +1,151 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "shared_frame.hpp"
+
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "power.hpp"
+#include "trace.hpp"
+
+SharedFrame::SharedFrame(asio::io_context &io, Power &power)
+    : Log("shm"), power_(power), timer_(io) {
+  power_.SigPowerStatusChanged.connect(&SharedFrame::OnPowerStatusChanged, this);
+}
+
+SharedFrame::~SharedFrame() {
+  if (header_ != nullptr) {
+    munmap(header_, size_);
+  }
+}
+
+bool SharedFrame::Start(const std::string &name) {
+  name_ = name;
+  // producers map the segment with the size at start, a new LED count applies after a restart
+  led_count_ = power_.GetLedCount();
+  size_ = sizeof(header_t) + kBufferCount * led_count_ * sizeof(ws2811_led_t);
+
+  int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0666);
+  if (fd < 0) {
+    E("shm_open {} failed: {}", name_, strerror(errno));
+    return false;
+  }
+  // allow producers without root privileges, independent of the umask
+  fchmod(fd, 0666);
+  if (ftruncate(fd, size_) != 0) {
+    E("ftruncate {} failed: {}", name_, strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  void *addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    E("mmap {} failed: {}", name_, strerror(errno));
+    return false;
+  }
+
+  header_ = static_cast<header_t *>(addr);
+  buffers_ = reinterpret_cast<ws2811_led_t *>(static_cast<uint8_t *>(addr) + sizeof(header_t));
+
+  header_->version = kVersion;
+  header_->buffer_count = kBufferCount;
+  header_->led_count = led_count_;
+  header_->header_size = sizeof(header_t);
+  header_->reading.store(0);
+  header_->latest.store(0);
+  // the magic is written last to mark the header as valid
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  header_->magic = kMagic;
+
+  I("Shared framebuffer {} with {} LEDs", name_, led_count_);
+
+  // the channel might have been restored as active already
+  OnPowerStatusChanged();
+  return true;
+}
+
+void SharedFrame::Stop() {
+  active_ = false;
+  timer_.cancel();
+}
+
+void SharedFrame::OnPowerStatusChanged() {
+  bool active = power_.GetChannelState(Power::kSharedFrame);
+  if (active == active_ || header_ == nullptr) {
+    return;
+  }
+
+  active_ = active;
+  if (active_) {
+    timer_.expires_after(kTickInterval);
+    timer_.async_wait(Trace::Wrap(
+        "SharedFrame::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+        timer_.expiry()));
+  } else {
+    timer_.cancel();
+  }
+}
+
+void SharedFrame::OnTick(const asio::error_code &error) {
+  if (error || !active_) {
+    return;
+  }
+
+  Poll();
+
+  timer_.expires_at(timer_.expiry() + kTickInterval);
+  timer_.async_wait(Trace::Wrap(
+      "SharedFrame::OnTick", [this](const asio::error_code &error) { OnTick(error); },
+      timer_.expiry()));
+}
+
+void SharedFrame::Poll() {
+  uint32_t latest = header_->latest.load(std::memory_order_acquire);
+  if (latest == last_seen_) {
+    return;
+  }
+
+  // claim the buffer and make sure the producer did not publish a new one in between. If it
+  // did it might already write into the one we just claimed.
+  bool claimed = false;
+  for (int i = 0; i < 3 && !claimed; ++i) {
+    header_->reading.store(latest & kIndexMask, std::memory_order_seq_cst);
+    const uint32_t confirm = header_->latest.load(std::memory_order_seq_cst);
+    claimed = confirm == latest;
+    latest = confirm;
+  }
+  if (!claimed) {
+    // the producer is too fast, try again next tick
+    return;
+  }
+
+  last_seen_ = latest;
+  const uint32_t index = latest & kIndexMask;
+  if (index >= kBufferCount) {
+    return;
+  }
+
+  frames_total_.Inc();
+  // the claimed buffer is not written by the producer until another one is claimed
+  power_.SetChannelFrame(Power::kSharedFrame, {buffers_ + index * led_count_, led_count_});
+}
@@ -0,0 +1,91 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_SHARED_FRAME_HPP
+#define SRC_SHARED_FRAME_HPP
+
+#include <asio.hpp>
+#include <atomic>
+#include <string>
+#include <ws2811/ws2811.h>
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+class Power;
+
+/**
+   @brief Framebuffer in POSIX shared memory for producers running on the device
+
+   The segment holds a header followed by three frame buffers (triple buffering). The
+   producer writes into a buffer that is neither `latest` nor `reading`, then publishes it by
+   storing `index | (counter << 2)` to `latest`. The daemon claims a buffer by writing its index
+   to `reading` and confirms that `latest` did not move meanwhile. Thus the buffer on display is
+   never written and neither side has to wait or call into the kernel.
+
+   The segment is kName for the daemon on the default port, `/ledcontrol-<port>` for others.
+*/
+class SharedFrame : public Log {
+public:
+  SharedFrame(asio::io_context &io, Power &power);
+  virtual ~SharedFrame();
+
+  /** @brief Create the segment `name`, each daemon on a host needs its own */
+  bool Start(const std::string &name = kName);
+  void Stop();
+  const std::string &GetName() const { return name_; }
+
+  static constexpr const char *kName = "/ledcontrol";
+  static constexpr uint32_t kMagic = 0x4C454446; // "LEDF"
+  static constexpr uint16_t kVersion = 1;
+  static constexpr uint16_t kBufferCount = 3;
+
+  struct header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t buffer_count;
+    uint32_t led_count;
+    uint32_t header_size;
+    std::atomic<uint32_t> latest;
+    std::atomic<uint32_t> reading;
+    uint32_t reserved[10];
+  };
+  static_assert(sizeof(header_t) == 64, "header layout is part of the protocol");
+
+private:
+  static constexpr auto kTickInterval = std::chrono::milliseconds(10);
+  static constexpr uint32_t kIndexMask = 0x03;
+
+  void OnTick(const asio::error_code &error);
+  void OnPowerStatusChanged();
+  void Poll();
+
+  Power &power_;
+  asio::steady_timer timer_;
+
+  header_t *header_{nullptr};
+  ws2811_led_t *buffers_{nullptr};
+  std::string name_;
+  std::size_t size_{0};
+  uint32_t led_count_{0};
+  uint32_t last_seen_{0};
+  Metrics::Counter &frames_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_shm_frames_total", "Frames taken from the shared framebuffer")};
+  bool active_{false};
+};
+
+#endif // SRC_SHARED_FRAME_HPP
@@ -0,0 +1,406 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "sync.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fmt/format.h>
+
+#include "animation.hpp"
+#include "power.hpp"
+#include "trace.hpp"
+
+namespace {
+// the datagrams come from anyone on the network, a missing or mistyped field drops them
+bool GetInt(const nlohmann::json &msg, const char *key, int64_t &value) {
+  const auto &it = msg.find(key);
+  if (it == msg.end() || !it->is_number_integer()) {
+    return false;
+  }
+  value = it->get<int64_t>();
+  return true;
+}
+} // namespace
+
+Sync::Sync(const std::string &config_path, asio::io_context &io, asio::ip::udp::socket &socket,
+           uint16_t port, Power &power, Animation &animation)
+    : Log("sync"), config_path_(config_path), socket_(socket), port_(port), power_(power),
+      animation_(animation), timer_(io) {
+  animation_.SigPlaybackChanged.connect(&Sync::OnPlaybackChanged, this);
+  animation_.SigAnimationChanged.connect(&Sync::OnPlaybackChanged, this);
+  power_.SigPowerStatusChanged.connect(&Sync::OnPlaybackChanged, this);
+
+  restore_state_active_ = true;
+  try {
+    const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
+    role_e role = role_e::off;
+    FromString(cfg.value("role", "off"), role);
+    SetRole(role, cfg.value("leader", ""));
+  } catch (const nlohmann::json::exception &e) {
+    E("Parsing config failed: {}", e.what());
+  }
+  restore_state_active_ = false;
+}
+
+Sync::~Sync() {}
+
+bool Sync::FromString(const std::string &name, role_e &role) {
+  if (name == "off") {
+    role = role_e::off;
+  } else if (name == "leader") {
+    role = role_e::leader;
+  } else if (name == "follower") {
+    role = role_e::follower;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char *Sync::ToString(role_e role) {
+  switch (role) {
+  case role_e::off:
+    return "off";
+  case role_e::leader:
+    return "leader";
+  case role_e::follower:
+    return "follower";
+  }
+  return "";
+}
+
+int64_t Sync::Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch())
+      .count();
+}
+
+void Sync::SaveState() {
+  nlohmann::json cfg;
+  cfg["role"] = ToString(role_);
+  cfg["leader"] = leader_;
+  IModule::SaveState(config_path_, kConfigFile, cfg);
+}
+
+void Sync::Start() {
+  if (role_ == role_e::follower) {
+    StartPing();
+  }
+}
+
+void Sync::Stop() { timer_.cancel(); }
+
+bool Sync::SetRole(role_e role, const std::string &leader) {
+  // the leader's address as host[:port], broadcast if not set
+  const std::size_t colon = leader.rfind(':');
+  const std::string &host = leader.empty() ? "255.255.255.255" : leader.substr(0, colon);
+  unsigned port = port_;
+  if (colon != std::string::npos) {
+    const char *first = leader.data() + colon + 1;
+    const char *last = leader.data() + leader.size();
+    const auto [end, ec] = std::from_chars(first, last, port);
+    if (ec != std::errc() || end != last || port == 0 || port > 65535) {
+      E("Invalid port in leader address {}", leader);
+      return false;
+    }
+  }
+  asio::error_code error;
+  const asio::ip::address &address = asio::ip::make_address(host, error);
+  if (error) {
+    E("Invalid leader address {}: {}", leader, error.message());
+    return false;
+  }
+
+  I("SetRole {} {}", ToString(role), leader);
+  timer_.cancel();
+  if (role_ == role_e::follower) {
+    animation_.SetEpoch(std::nullopt);
+  }
+
+  role_ = role;
+  leader_ = leader;
+  samples_.clear();
+  fit_.clear();
+  samples_total_ = 0;
+  offset_ = 0;
+  drift_ = 0;
+  residual_ = 0;
+  play_hash_.clear();
+  play_active_.reset();
+  followers_.clear();
+
+  leader_endpoint_ = asio::ip::udp::endpoint(address, static_cast<uint16_t>(port));
+
+  if (!restore_state_active_ && role_ == role_e::follower) {
+    StartPing();
+  }
+  SaveState();
+  return true;
+}
+
+void Sync::Send(const nlohmann::json &msg, const asio::ip::udp::endpoint &endpoint) {
+  asio::error_code error;
+  socket_.send_to(asio::buffer(msg.dump()), endpoint, 0, error);
+  if (error) {
+    E("Send to {} failed: {}", endpoint.address().to_string(), error.message());
+  }
+}
+
+bool Sync::OnMessage(const nlohmann::json &msg, const asio::ip::udp::endpoint &sender) {
+  const std::string &cmd = msg.value("cmd", "");
+  if (cmd == "sync_ping") {
+    if (role_ == role_e::leader) {
+      OnPingRequest(msg, sender);
+    }
+  } else if (cmd == "sync_pong") {
+    if (role_ == role_e::follower && IsLeader(sender)) {
+      OnPong(msg);
+    }
+  } else if (cmd == "sync_play") {
+    if (role_ == role_e::follower && IsLeader(sender) && msg.contains("play")) {
+      OnPlay(msg.at("play"));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool Sync::IsLeader(const asio::ip::udp::endpoint &sender) const {
+  // pinged by broadcast any leader may answer
+  return leader_.empty() || sender == leader_endpoint_;
+}
+
+void Sync::StartPing() {
+  timer_.expires_after(samples_total_ < kStartSamples ? kStartInterval : kPingInterval);
+  timer_.async_wait(Trace::Wrap(
+      "Sync::OnPing", [this](const asio::error_code &error) { OnPing(error); }, timer_.expiry()));
+}
+
+void Sync::OnPing(const asio::error_code &error) {
+  if (error) {
+    return;
+  }
+
+  nlohmann::json msg;
+  msg["cmd"] = "sync_ping";
+  msg["seq"] = ++seq_;
+  msg["skew"] = GetSkew();
+  msg["rtt"] = samples_.empty() ? 0 : fit_.back().rtt;
+  msg["t0"] = Now();
+  Send(msg, leader_endpoint_);
+  StartPing();
+}
+
+void Sync::OnPingRequest(const nlohmann::json &msg, const asio::ip::udp::endpoint &sender) {
+  const int64_t t1 = Now();
+  int64_t seq = 0;
+  int64_t t0 = 0;
+  if (!GetInt(msg, "seq", seq) || !GetInt(msg, "t0", t0)) {
+    return;
+  }
+
+  const std::string &address =
+      fmt::format("{}:{}", sender.address().to_string(), sender.port());
+  follower_t &follower = followers_[address];
+  follower.endpoint = sender;
+  follower.skew = msg.value("skew", int64_t(0));
+  follower.rtt = msg.value("rtt", int64_t(0));
+  follower.seen = clock::now();
+
+  int64_t max_skew = 0;
+  for (auto it = followers_.begin(); it != followers_.end();) {
+    if (clock::now() - it->second.seen > kFollowerTimeout) {
+      I("Follower {} timed out", it->first);
+      it = followers_.erase(it);
+      continue;
+    }
+    max_skew = std::max(max_skew, std::abs(it->second.skew));
+    ++it;
+  }
+  followers_gauge_.Set(followers_.size());
+  skew_gauge_.Set(max_skew * 1e-9);
+
+  nlohmann::json resp;
+  resp["cmd"] = "sync_pong";
+  resp["seq"] = seq;
+  resp["t0"] = t0;
+  resp["t1"] = t1;
+  resp["lateness"] = animation_.GetLateness().count();
+  resp["play"] = GetPlayback();
+  resp["t2"] = Now();
+  Send(resp, sender);
+}
+
+void Sync::OnPong(const nlohmann::json &msg) {
+  const int64_t t3 = Now();
+  int64_t t0 = 0;
+  int64_t t1 = 0;
+  int64_t t2 = 0;
+  if (!GetInt(msg, "t0", t0) || !GetInt(msg, "t1", t1) || !GetInt(msg, "t2", t2)) {
+    return;
+  }
+
+  sample_t sample;
+  sample.local = t0 + (t3 - t0) / 2;
+  sample.offset = ((t1 - t0) + (t2 - t3)) / 2;
+  sample.rtt = (t3 - t0) - (t2 - t1);
+  rtt_seconds_.Observe(sample.rtt * 1e-9);
+  leader_lateness_ = msg.value("lateness", int64_t(0));
+  AddSample(sample);
+
+  if (msg.contains("play")) {
+    OnPlay(msg.at("play"));
+  }
+}
+
+void Sync::AddSample(const sample_t &sample) {
+  samples_total_++;
+  samples_.push_back(sample);
+  if (samples_.size() > kFilterSamples) {
+    samples_.pop_front();
+  }
+
+  // queueing delays only add to the round trip, the fastest sample is the most accurate one
+  const sample_t &best = *std::min_element(
+      samples_.begin(), samples_.end(),
+      [](const sample_t &a, const sample_t &b) { return a.rtt < b.rtt; });
+  if (fit_.empty() || fit_.back().local != best.local) {
+    fit_.push_back(best);
+    if (fit_.size() > kFitSamples) {
+      fit_.pop_front();
+    }
+  }
+
+  // least squares fit of the offset over the local time
+  t0_ = fit_.front().local;
+  double sx = 0;
+  double sy = 0;
+  for (const sample_t &s : fit_) {
+    sx += s.local - t0_;
+    sy += s.offset;
+  }
+  const double n = fit_.size();
+  const double mx = sx / n;
+  const double my = sy / n;
+  double sxx = 0;
+  double sxy = 0;
+  for (const sample_t &s : fit_) {
+    sxx += (s.local - t0_ - mx) * (s.local - t0_ - mx);
+    sxy += (s.local - t0_ - mx) * (s.offset - my);
+  }
+  drift_ = sxx > 0 ? sxy / sxx : 0;
+  offset_ = my - drift_ * mx;
+  residual_ = sample.offset - GetOffset(sample.local);
+
+  offset_gauge_.Set(GetOffset(Now()) * 1e-9);
+  drift_gauge_.Set(drift_ * 1e6);
+  skew_gauge_.Set(GetSkew() * 1e-9);
+}
+
+int64_t Sync::GetOffset(int64_t local) const {
+  return std::llround(offset_ + drift_ * double(local - t0_));
+}
+
+int64_t Sync::ToLocal(int64_t shared) const {
+  // the offset hardly changes within the offset itself, one iteration is enough
+  return shared - GetOffset(shared - GetOffset(shared));
+}
+
+int64_t Sync::GetSkew() const {
+  if (role_ != role_e::follower || fit_.empty()) {
+    return 0;
+  }
+  return residual_ + animation_.GetLateness().count() - leader_lateness_;
+}
+
+nlohmann::json Sync::GetPlayback() const {
+  nlohmann::json play;
+  play["hash"] = animation_.GetLoading().empty() ? animation_.GetAnimation()
+                                                  : animation_.GetLoading();
+  play["active"] = power_.GetChannelState(Power::kAnimation);
+  play["epoch"] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      animation_.GetEpoch().time_since_epoch())
+                      .count();
+  return play;
+}
+
+void Sync::OnPlaybackChanged() {
+  if (role_ != role_e::leader || followers_.empty()) {
+    return;
+  }
+
+  nlohmann::json msg;
+  msg["cmd"] = "sync_play";
+  msg["play"] = GetPlayback();
+  for (const auto &[address, follower] : followers_) {
+    Send(msg, follower.endpoint);
+  }
+}
+
+void Sync::OnPlay(const nlohmann::json &play) {
+  // nothing to align to without a clock estimate
+  if (!play.is_object() || fit_.empty()) {
+    return;
+  }
+  const auto &hash_it = play.find("hash");
+  const auto &active_it = play.find("active");
+  int64_t epoch = 0;
+  if (hash_it == play.end() || !hash_it->is_string() || active_it == play.end() ||
+      !active_it->is_boolean() || !GetInt(play, "epoch", epoch)) {
+    return;
+  }
+
+  const std::string &hash = hash_it->get<std::string>();
+  if (hash != play_hash_) {
+    play_hash_ = hash;
+    if (!hash.empty() && hash != animation_.GetAnimation()) {
+      animation_.SetAnimation(hash);
+    }
+  }
+
+  animation_.SetEpoch(clock::time_point(std::chrono::nanoseconds(ToLocal(epoch))));
+
+  const bool active = active_it->get<bool>();
+  if (play_active_ != active) {
+    play_active_ = active;
+    power_.SetChannelState(Power::kAnimation, active);
+  }
+}
+
+nlohmann::json Sync::GetStatus() const {
+  nlohmann::json status;
+  status["role"] = ToString(role_);
+  status["leader"] = leader_;
+  if (role_ == role_e::follower) {
+    status["samples"] = samples_total_;
+    status["offset_ns"] = fit_.empty() ? 0 : GetOffset(Now());
+    status["drift_ppm"] = drift_ * 1e6;
+    status["rtt_ns"] = fit_.empty() ? 0 : fit_.back().rtt;
+    status["skew_ns"] = GetSkew();
+  } else if (role_ == role_e::leader) {
+    status["followers"] = nlohmann::json::array();
+    for (const auto &[address, follower] : followers_) {
+      nlohmann::json entry;
+      entry["address"] = address;
+      entry["skew_ns"] = follower.skew;
+      entry["rtt_ns"] = follower.rtt;
+      status["followers"].push_back(entry);
+    }
+  }
+  return status;
+}
@@ -0,0 +1,160 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_SYNC_HPP
+#define SRC_SYNC_HPP
+
+#include <asio.hpp>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+
+#include "i_module.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+class Animation;
+class Power;
+
+/**
+ * @brief Synchronized animation playback of several controllers
+ *
+ * One controller is the leader, its steady clock is the shared timeline. Followers ping the
+ * leader via the UDP port once per second (NTP style, four timestamps). From the samples with
+ * the least round trip time they estimate the offset of the leader's clock by a least squares
+ * fit, the slope of which is the drift. The leader answers with its playback state: the
+ * animation, its power state and the epoch of the animation on the shared timeline. Followers
+ * play the same animation aligned to that epoch.
+ *
+ * Each follower reports its skew to the leader: the residual of its clock estimate plus the
+ * difference of the frame lateness of both.
+ */
+class Sync : public Log, public IModule {
+public:
+  enum class role_e { off, leader, follower };
+
+  Sync(const std::string &config_path, asio::io_context &io, asio::ip::udp::socket &socket,
+       uint16_t port, Power &power, Animation &animation);
+  virtual ~Sync();
+
+  static bool FromString(const std::string &name, role_e &role);
+  static const char *ToString(role_e role);
+
+  void Start();
+  void Stop();
+
+  /** @brief Handle a message received on the UDP port, returns false if it is none of sync */
+  bool OnMessage(const nlohmann::json &msg, const asio::ip::udp::endpoint &sender);
+
+  /**
+   * @brief Set the role, `leader` is the leader's address for a follower, empty to broadcast
+   *
+   * @return false if `leader` is no valid host[:port], the role is unchanged then
+   */
+  bool SetRole(role_e role, const std::string &leader);
+  role_e GetRole() const { return role_; }
+  nlohmann::json GetStatus() const;
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr const char *kConfigFile = "sync.json";
+  static constexpr auto kPingInterval = std::chrono::seconds(1);
+  // ping faster until that many samples are taken
+  static constexpr auto kStartInterval = std::chrono::milliseconds(200);
+  static constexpr std::size_t kStartSamples = 8;
+  // the sample with the least round trip time of that many is used for the fit
+  static constexpr std::size_t kFilterSamples = 4;
+  static constexpr std::size_t kFitSamples = 32;
+  // followers not heard of for that long are dropped
+  static constexpr auto kFollowerTimeout = std::chrono::seconds(10);
+
+  struct sample_t {
+    int64_t local{0};
+    int64_t offset{0};
+    int64_t rtt{0};
+  };
+
+  struct follower_t {
+    asio::ip::udp::endpoint endpoint;
+    int64_t skew{0};
+    int64_t rtt{0};
+    clock::time_point seen;
+  };
+
+  static int64_t Now();
+  void SaveState() override;
+  void Send(const nlohmann::json &msg, const asio::ip::udp::endpoint &endpoint);
+  // a follower only takes pongs and playback from its leader
+  bool IsLeader(const asio::ip::udp::endpoint &sender) const;
+  void StartPing();
+  void OnPing(const asio::error_code &error);
+  void OnPingRequest(const nlohmann::json &msg, const asio::ip::udp::endpoint &sender);
+  void OnPong(const nlohmann::json &msg);
+  void OnPlay(const nlohmann::json &play);
+  void OnPlaybackChanged();
+  nlohmann::json GetPlayback() const;
+  void AddSample(const sample_t &sample);
+  int64_t GetOffset(int64_t local) const;
+  int64_t ToLocal(int64_t shared) const;
+  int64_t GetSkew() const;
+
+  const std::string config_path_;
+  asio::ip::udp::socket &socket_;
+  const uint16_t port_;
+  Power &power_;
+  Animation &animation_;
+  asio::steady_timer timer_;
+
+  role_e role_{role_e::off};
+  std::string leader_;
+  asio::ip::udp::endpoint leader_endpoint_;
+  uint32_t seq_{0};
+
+  // follower: raw samples, the filtered ones and the fit offset(t) = offset_ + drift_ * (t - t0)
+  std::deque<sample_t> samples_;
+  std::deque<sample_t> fit_;
+  std::size_t samples_total_{0};
+  int64_t t0_{0};
+  double offset_{0};
+  double drift_{0};
+  int64_t residual_{0};
+  int64_t leader_lateness_{0};
+  std::string play_hash_;
+  std::optional<bool> play_active_;
+
+  // leader: followers by address
+  std::map<std::string, follower_t> followers_;
+
+  Metrics::Histogram &rtt_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_sync_rtt_seconds", "Round trip time of the sync pings",
+      {0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5})};
+  Metrics::Gauge &offset_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_sync_offset_seconds", "Estimated offset of the leader's clock")};
+  Metrics::Gauge &drift_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_sync_drift_ppm", "Estimated drift of the leader's clock")};
+  Metrics::Gauge &skew_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_sync_skew_seconds",
+      "Follower: estimated skew to the leader, leader: largest skew of all followers")};
+  Metrics::Gauge &followers_gauge_{
+      Metrics::Instance().GetGauge("ledcontrol_sync_followers", "Followers of the leader")};
+};
+
+#endif // SRC_SYNC_HPP
@@ -0,0 +1,95 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#include "trace.hpp"
+
+#include <fstream>
+#include <unistd.h>
+
+std::array<Trace::event_t, Trace::kCapacity> Trace::ring_;
+std::atomic<std::size_t> Trace::head_{0};
+std::atomic_bool Trace::enabled_{true};
+
+static uint32_t ThreadId() {
+  static std::atomic<uint32_t> next{1};
+  thread_local const uint32_t id = next.fetch_add(1);
+  return id;
+}
+
+void Trace::Record(const char *name, clock::time_point ready, clock::time_point start,
+                   clock::time_point end) {
+  using namespace std::chrono;
+  const std::size_t index = head_.fetch_add(1, std::memory_order_relaxed);
+  event_t &event = ring_[index % kCapacity];
+  event.seq.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  event.name.store(name, std::memory_order_relaxed);
+  event.start_us.store(duration_cast<microseconds>(start.time_since_epoch()).count(),
+                       std::memory_order_relaxed);
+  event.duration_us.store(duration_cast<microseconds>(end - start).count(),
+                          std::memory_order_relaxed);
+  event.delay_us.store(std::max<int64_t>(0, duration_cast<microseconds>(start - ready).count()),
+                       std::memory_order_relaxed);
+  event.tid.store(ThreadId(), std::memory_order_relaxed);
+  event.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+nlohmann::json Trace::ToChromeTrace() {
+  const std::size_t head = head_.load();
+  const std::size_t first = head > kCapacity ? head - kCapacity : 0;
+  const int pid = getpid();
+
+  nlohmann::json events = nlohmann::json::array();
+  for (std::size_t i = first; i < head; ++i) {
+    const event_t &event = ring_[i % kCapacity];
+    // not complete yet or already overwritten by a later index
+    const std::size_t seq = event.seq.load(std::memory_order_acquire);
+    if (seq != 2 * i + 2) {
+      continue;
+    }
+    const char *name = event.name.load(std::memory_order_relaxed);
+    const int64_t start_us = event.start_us.load(std::memory_order_relaxed);
+    const int32_t duration_us = event.duration_us.load(std::memory_order_relaxed);
+    const int32_t delay_us = event.delay_us.load(std::memory_order_relaxed);
+    const uint32_t tid = event.tid.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (event.seq.load(std::memory_order_relaxed) != seq || name == nullptr) {
+      continue;
+    }
+
+    nlohmann::json json;
+    json["name"] = name;
+    json["ph"] = "X";
+    json["ts"] = start_us;
+    json["dur"] = duration_us;
+    json["pid"] = pid;
+    json["tid"] = tid;
+    json["args"] = {{"delay_us", delay_us}};
+    events.push_back(json);
+  }
+
+  nlohmann::json trace;
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  return trace;
+}
+
+bool Trace::Dump(const std::string &filename) {
+  std::ofstream file(filename);
+  file << ToChromeTrace();
+  return file.good();
+}
@@ -0,0 +1,97 @@
+/**********************************************************************************************
+    Copyright (C) 2022 Oliver Eichler <oliver.eichler@gmx.de>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+**********************************************************************************************/
+#ifndef SRC_TRACE_HPP
+#define SRC_TRACE_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <utility>
+
+/**
+   @brief Record which handler held the io loop for how long
+
+   Completion handlers are wrapped with Trace::Wrap(). The wrapper records the handler's name,
+   its queue delay (time from being ready until it runs) and its run time into a ring buffer
+   of the last kCapacity events. Trace::Span marks sections inside a handler. The ring can be
+   exported in Chrome's trace event format to be inspected with chrome://tracing or Perfetto.
+
+   The queue delay is only known for timers (ready at expiry) and posted handlers (ready when
+   posted). Pass the time the handler became ready as third argument in these cases.
+
+   Any thread may record, e.g. the animation loader. Each slot carries a sequence number, the
+   export skips slots that are written meanwhile.
+*/
+class Trace {
+public:
+  using clock = std::chrono::steady_clock;
+  static constexpr std::size_t kCapacity = 4096;
+
+  class Span {
+  public:
+    Span(const char *name) : name_(name), start_(clock::now()) {}
+    ~Span() { Record(name_, start_, start_, clock::now()); }
+
+  private:
+    const char *name_;
+    const clock::time_point start_;
+  };
+
+  template <typename Handler>
+  static auto Wrap(const char *name, Handler &&handler,
+                   clock::time_point ready = clock::time_point::min()) {
+    return [name, ready, handler = std::forward<Handler>(handler)](auto &&...args) mutable {
+      if (!IsEnabled()) {
+        handler(std::forward<decltype(args)>(args)...);
+        return;
+      }
+      const clock::time_point &start = clock::now();
+      handler(std::forward<decltype(args)>(args)...);
+      Record(name, ready == clock::time_point::min() ? start : ready, start, clock::now());
+    };
+  }
+
+  static void Record(const char *name, clock::time_point ready, clock::time_point start,
+                     clock::time_point end);
+
+  static void SetEnabled(bool enabled) { enabled_.store(enabled); }
+  static bool IsEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  static nlohmann::json ToChromeTrace();
+  static bool Dump(const std::string &filename);
+
+private:
+  // written by one thread while others may read it, hence relaxed atomics guarded by seq
+  struct event_t {
+    // 2 * index + 2 once the event of that ring index is complete, odd while written
+    std::atomic<std::size_t> seq{0};
+    std::atomic<const char *> name{nullptr};
+    std::atomic<int64_t> start_us{0};
+    std::atomic<int32_t> duration_us{0};
+    std::atomic<int32_t> delay_us{0};
+    std::atomic<uint32_t> tid{0};
+  };
+
+  static std::array<event_t, kCapacity> ring_;
+  static std::atomic<std::size_t> head_;
+  static std::atomic_bool enabled_;
+};
+
+#endif // SRC_TRACE_HPP
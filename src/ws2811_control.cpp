@@ -17,70 +17,240 @@
 **********************************************************************************************/
 #include "ws2811_control.hpp"
 
+#include <algorithm>
 #include <fmt/format.h>
 #include <memory.h>
 #include <nlohmann/json.hpp>
+#include <thread>
+
+#include "clock.hpp"
+#include "trace.hpp"
 
 WS2811Control::WS2811Control(const std::string &config_path)
-    : Log("ws2811"), config_path_(config_path), current_frame_(kLedCount, 0) {
+    : Log("ws2811"), config_path_(config_path) {
   memset(&ledstring_, 0, sizeof(ledstring_));
   ledstring_.freq = kTargetFreq;
   ledstring_.dmanum = kDma;
-  ledstring_.channel[0].gpionum = kGpioPin;
+  for (ws2811_channel_t &channel : ledstring_.channel) {
+    channel.invert = 0;
+    channel.brightness = max_brightness_;
+    channel.strip_type = kStripeType;
+  }
   ledstring_.channel[0].count = kLedCount;
-  ledstring_.channel[0].invert = 0;
-  ledstring_.channel[0].brightness = max_brightness_;
-  ledstring_.channel[0].strip_type = kStripeType;
 
   restore_state_active_ = true;
   try {
     const nlohmann::json &cfg = LoadState(config_path_, kConfigFile);
+    // led_count is the legacy configuration of channel 0
     ledstring_.channel[0].count = cfg.value("led_count", kLedCount);
+    const nlohmann::json &channels = cfg.value("channels", nlohmann::json::array());
+    for (std::size_t i = 0; i < channels.size() && i < kChannelCount; ++i) {
+      ledstring_.channel[i].count = channels[i].value("led_count", 0);
+    }
     max_brightness_ = cfg.value("max_brightness", max_brightness_);
+    const nlohmann::json &current = cfg.value("current", nlohmann::json::object());
+    current_limiter_.SetModel(current.get<CurrentLimiter::model_t>());
+    current_limiter_.SetBudget(current.value("budget_ma", 0U));
+    if (cfg.value("backend", "hardware") == "simulated") {
+      backend_ = backend_e::simulated;
+    }
   } catch (const nlohmann::json::exception &e) {
-    E(fmt::format("Parsing system config failed: {}", e.what()));
+    E("Parsing system config failed: {}", e.what());
   }
 
   WriteHardwareInit();
   restore_state_active_ = false;
 }
 
-WS2811Control::~WS2811Control() { ws2811_fini(&ledstring_); }
+WS2811Control::~WS2811Control() {
+  if (backend_ == backend_e::hardware && initialized_) {
+    ws2811_fini(&ledstring_);
+  }
+}
 
 uint8_t WS2811Control::GetMaxBrightness() const { return max_brightness_; }
 
-void WS2811Control::SetBrightness(float brightness) {
-  brightness_ = brightness;
-  WriteHardwareInit();
+int WS2811Control::GetLedCount() const {
+  int count = 0;
+  for (const ws2811_channel_t &channel : ledstring_.channel) {
+    count += channel.count;
+  }
+  return count;
 }
 
-int WS2811Control::GetLedCount() const { return ledstring_.channel[0].count; }
+int WS2811Control::GetLedCount(int channel) const { return ledstring_.channel[channel].count; }
+
+std::array<int, WS2811Control::kChannelCount> WS2811Control::GetLedCounts() const {
+  std::array<int, kChannelCount> counts{};
+  for (int i = 0; i < kChannelCount; ++i) {
+    counts[i] = ledstring_.channel[i].count;
+  }
+  return counts;
+}
+
+std::chrono::microseconds WS2811Control::GetFrameTime() const {
+  // the channels are sent in parallel
+  int count = 0;
+  for (const ws2811_channel_t &channel : ledstring_.channel) {
+    count = std::max(count, channel.count);
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(kLedTime * count + kResetTime);
+}
 
 void WS2811Control::SetParameters(int led_count, uint8_t brightness) {
+  std::array<int, kChannelCount> led_counts = GetLedCounts();
+  led_counts[0] = led_count;
+  SetParameters(led_counts, brightness);
+}
+
+void WS2811Control::SetParameters(const std::array<int, kChannelCount> &led_counts,
+                                  uint8_t brightness) {
+  const bool changed = led_counts != GetLedCounts();
   max_brightness_ = brightness;
-  ledstring_.channel[0].count = led_count;
+  for (int i = 0; i < kChannelCount; ++i) {
+    ledstring_.channel[i].count = std::max(led_counts[i], 0);
+  }
 
   if (WriteHardwareInit()) {
     SaveState();
   }
+  if (changed) {
+    SigLedCountChanged();
+  }
+}
+
+void WS2811Control::SetCurrentBudget(uint32_t budget_ma) {
+  current_limiter_.SetBudget(budget_ma);
+  SaveState();
+  if (!suspended_) {
+    SetFrame(current_frame_);
+  }
 }
 
-bool WS2811Control::SetFrame(const std::vector<ws2811_led_t> &frame) {
+bool WS2811Control::SetFrame(const frame_t &frame) {
   current_frame_ = frame;
-  std::size_t size =
-      std::min(current_frame_.size(), static_cast<std::size_t>(ledstring_.channel[0].count));
-  memcpy(ledstring_.channel[0].leds, current_frame_.data(), size * sizeof(ws2811_led_t));
+  if (suspended_) {
+    // the init renders the current frame
+    const auto &start = std::chrono::steady_clock::now();
+    suspended_ = false;
+    const bool ok = WriteHardwareInit();
+    resume_seconds_.Observe(std::chrono::steady_clock::now() - start);
+    D("Resumed");
+    suspended_gauge_.Set(0);
+    SigSuspendChanged();
+    return ok;
+  }
+  if (!initialized_) {
+    // not initialized, the frame is shown after the next ws2811_init()
+    return false;
+  }
 
-  D(fmt::format("SetFrame of size {} with brightness {} {:08X}..{:08X}", size,
-                ledstring_.channel[0].brightness, frame[0], frame[size - 1]));
+  // the only copy of the frame on its way to the DMA buffer, split onto the channels
+  std::size_t offset = 0;
+  CurrentLimiter::sums_t sums{};
+  for (ws2811_channel_t &channel : ledstring_.channel) {
+    const std::size_t count = channel.count;
+    if (channel.leds == nullptr || count == 0) {
+      continue;
+    }
+    const std::size_t size = offset < frame.size ? std::min(frame.size - offset, count) : 0;
+    if (size != 0) {
+      memcpy(channel.leds, frame.data + offset, size * sizeof(ws2811_led_t));
+      CurrentLimiter::Sum(frame.data + offset, size, sums);
+    }
+    memset(channel.leds + size, 0, (count - size) * sizeof(ws2811_led_t));
+    offset += count;
+  }
 
-  ws2811_return_t ret = WS2811_SUCCESS;
-  if ((ret = ws2811_render(&ledstring_)) != WS2811_SUCCESS) {
-    E(fmt::format("ws2811_render failed: {} ({})", ws2811_get_return_t_str(ret), ret));
+  // the limiter dims by the hardware brightness, which the driver applies anyway
+  const uint8_t brightness = current_limiter_.Update(sums, offset, max_brightness_);
+  for (ws2811_channel_t &channel : ledstring_.channel) {
+    channel.brightness = brightness;
+  }
+  if (brightness != max_brightness_) {
+    current_limited_total_.Inc();
+  }
+  const double current = current_limiter_.GetCurrent() / 1000.0;
+  current_gauge_.Set(current);
+  current_amperes_.Observe(current);
+  current_scale_.Set(current_limiter_.GetScale());
+
+  D("SetFrame of size {} on {} LEDs with brightness {}", frame.size, offset, brightness);
+  if (!Render()) {
     return false;
   }
-  if ((ret = ws2811_wait(&ledstring_)) != WS2811_SUCCESS) {
-    E(fmt::format("ws2811_wait failed: {} ({})", ws2811_get_return_t_str(ret), ret));
+  render_time_ = std::chrono::steady_clock::now();
+  SigRendered(frame, brightness);
+  return true;
+}
+
+std::vector<ws2811_led_t> WS2811Control::GetLeds() const {
+  std::vector<ws2811_led_t> leds;
+  for (const ws2811_channel_t &channel : ledstring_.channel) {
+    if (channel.leds != nullptr) {
+      leds.insert(leds.end(), channel.leds, channel.leds + channel.count);
+    }
+  }
+  return leds;
+}
+
+void WS2811Control::Suspend() {
+  if (suspended_ || !initialized_) {
+    return;
+  }
+
+  D("Suspend");
+  if (backend_ == backend_e::simulated) {
+    if (!Clock::IsVirtual()) {
+      std::this_thread::sleep_until(simulated_busy_);
+    }
+    for (int i = 0; i < kChannelCount; ++i) {
+      simulated_leds_[i] = std::vector<ws2811_led_t>();
+      ledstring_.channel[i].leds = nullptr;
+    }
+  } else {
+    // the strip keeps the frame latched last, the line stays low without PWM
+    ws2811_wait(&ledstring_);
+    ws2811_fini(&ledstring_);
+  }
+  initialized_ = false;
+  suspended_ = true;
+  suspended_gauge_.Set(1);
+  SigSuspendChanged();
+}
+
+bool WS2811Control::Render() {
+  if (!initialized_) {
+    return false;
+  }
+
+  const auto &now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> interval = now - last_frame_;
+  last_frame_ = now;
+  if (interval.count() < 1.0) {
+    frame_rate_.Set(0.9 * frame_rate_.Get() + 0.1 / interval.count());
+  } else {
+    frame_rate_.Set(0);
+  }
+  frames_total_.Inc();
+  Metrics::ScopedTimer timer(render_seconds_);
+  Trace::Span span("WS2811Control::Render");
+
+  if (backend_ == backend_e::simulated) {
+    // like ws2811_render() wait for the previous transfer, then start the next one. In virtual
+    // time the timers pace the frames.
+    if (!Clock::IsVirtual()) {
+      std::this_thread::sleep_until(simulated_busy_);
+      simulated_busy_ = std::chrono::steady_clock::now() + GetFrameTime();
+    }
+    return true;
+  }
+
+  // ws2811_render() waits for the previous transfer to complete and returns once the next
+  // one is started. The next frame is composed while the DMA runs.
+  ws2811_return_t ret = WS2811_SUCCESS;
+  if ((ret = ws2811_render(&ledstring_)) != WS2811_SUCCESS) {
+    E("ws2811_render failed: {} ({})", ws2811_get_return_t_str(ret), ret);
     return false;
   }
 
@@ -88,26 +258,58 @@ bool WS2811Control::SetFrame(const std::vector<ws2811_led_t> &frame) {
 }
 
 bool WS2811Control::WriteHardwareInit() {
-  ledstring_.channel[0].brightness = round(max_brightness_ * brightness_);
+  for (int i = 0; i < kChannelCount; ++i) {
+    ws2811_channel_t &channel = ledstring_.channel[i];
+    channel.brightness = max_brightness_;
+    // a channel without LEDs is disabled by GPIO 0
+    channel.gpionum = channel.count != 0 ? kGpioPins[i] : 0;
+  }
+  if (suspended_) {
+    // applied when the next frame resumes
+    return true;
+  }
+
+  D("WriteHardwareInit {} count: {} + {} brightness: {}",
+    backend_ == backend_e::simulated ? "simulated" : "hardware", ledstring_.channel[0].count,
+    ledstring_.channel[1].count, max_brightness_);
+
+  if (backend_ == backend_e::simulated) {
+    for (int i = 0; i < kChannelCount; ++i) {
+      simulated_leds_[i].assign(ledstring_.channel[i].count, 0);
+      ledstring_.channel[i].leds = simulated_leds_[i].data();
+    }
+    initialized_ = true;
+    return SetFrame(current_frame_);
+  }
 
-  D(fmt::format("WriteHardwareInit count: {} brightness: {}", ledstring_.channel[0].count,
-                ledstring_.channel[0].brightness));
+  if (initialized_) {
+    ws2811_fini(&ledstring_);
+    initialized_ = false;
+  }
 
   ws2811_return_t ret = WS2811_SUCCESS;
   if ((ret = ws2811_init(&ledstring_)) != WS2811_SUCCESS) {
-    E(fmt::format("ws2811_init failed: {} ({})", ws2811_get_return_t_str(ret), ret));
+    E("ws2811_init failed: {} ({})", ws2811_get_return_t_str(ret), ret);
     if (ret == WS2811_ERROR_MMAP) {
       E("Try to run the app as root.");
     }
     return false;
   }
+  initialized_ = true;
   return SetFrame(current_frame_);
 }
 
 void WS2811Control::SaveState() {
   nlohmann::json cfg;
-  cfg["led_count"] = ledstring_.channel[0].count;
-  cfg["max_brightness"] = ledstring_.channel[0].brightness;
+  cfg["max_brightness"] = max_brightness_;
+  cfg["backend"] = backend_ == backend_e::simulated ? "simulated" : "hardware";
+  cfg["current"] = current_limiter_.GetModel();
+  cfg["current"]["budget_ma"] = current_limiter_.GetBudget();
+  for (const ws2811_channel_t &channel : ledstring_.channel) {
+    nlohmann::json entry;
+    entry["led_count"] = channel.count;
+    cfg["channels"].push_back(entry);
+  }
 
   IModule::SaveState(config_path_, kConfigFile, cfg);
 }
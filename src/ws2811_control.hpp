@@ -18,42 +18,129 @@
 #ifndef SRC_WS2811_CONTROL_HPP
 #define SRC_WS2811_CONTROL_HPP
 
+#include <array>
+#include <chrono>
+#include <sigslot/signal.hpp>
 #include <vector>
 #include <ws2811/ws2811.h>
 
+#include "current_limiter.hpp"
+#include "frame.hpp"
 #include "i_module.hpp"
 #include "log.hpp"
+#include "metrics.hpp"
 
+/**
+ * @brief Output of frames to the strips on both PWM channels
+ *
+ * The LEDs of channel 0 followed by those of channel 1 form one logical strip, a frame covers
+ * both. The LED counts are configured at runtime. Both channels are sent by the same DMA
+ * transfer, so they are refreshed in parallel.
+ *
+ * The supply current of each frame is estimated. With a current budget the brightness of the
+ * frame is lowered to stay within it, see CurrentLimiter.
+ *
+ * While everything is off the driver can be suspended: the DMA and PWM resources are released
+ * once the last frame is latched. The next frame initializes the driver again.
+ *
+ * The simulated backend does not touch the hardware. It keeps the LEDs in memory and blocks for
+ * the time the transfer would take, to run and benchmark the daemon on any machine.
+ */
 class WS2811Control : public Log, public IModule {
 public:
+  static constexpr int kChannelCount = RPI_PWM_CHANNELS;
+  // default LED count of channel 0, channel 1 is unused by default
   static constexpr int kLedCount = 300;
+
+  enum class backend_e { hardware, simulated };
+
   WS2811Control(const std::string &config_path);
   virtual ~WS2811Control();
 
   uint8_t GetMaxBrightness() const;
+  /** @brief LEDs of both channels */
   int GetLedCount() const;
+  int GetLedCount(int channel) const;
+  std::array<int, kChannelCount> GetLedCounts() const;
+  backend_e GetBackend() const { return backend_; }
+  /** @brief Time to transfer a frame to the strip, the fastest sensible frame interval */
+  std::chrono::microseconds GetFrameTime() const;
 
   void SetParameters(int led_count, uint8_t brightness);
+  void SetParameters(const std::array<int, kChannelCount> &led_counts, uint8_t brightness);
+  /** @brief Limit the estimated supply current to `budget_ma`, 0 for no limit */
+  void SetCurrentBudget(uint32_t budget_ma);
+  uint32_t GetCurrentBudget() const { return current_limiter_.GetBudget(); }
+  /** @brief Estimated supply current of the last frame in mA */
+  double GetCurrent() const { return current_limiter_.GetCurrent(); }
+
+  /** @brief Show a frame, its storage has to stay valid until the next frame is set */
+  bool SetFrame(const frame_t &frame);
+  /** @brief The LEDs of both channels as sent last, empty while suspended */
+  std::vector<ws2811_led_t> GetLeds() const;
+  /** @brief Time the last frame was sent to the strip */
+  std::chrono::steady_clock::time_point GetRenderTime() const { return render_time_; }
+  uint64_t GetFrameCount() const { return frames_total_.Get(); }
 
-  bool SetFrame(const std::vector<ws2811_led_t> &frame);
-  void SetBrightness(float brightness);
+  /** @brief Release the driver after the current frame is latched, the next frame resumes */
+  void Suspend();
+  bool GetSuspended() const { return suspended_; }
+
+  sigslot::signal_st<> SigLedCountChanged;
+  /** @brief The driver was suspended or resumed */
+  sigslot::signal_st<> SigSuspendChanged;
+  /** @brief A frame was rendered, with the brightness the driver scales it by */
+  sigslot::signal_st<const frame_t &, uint8_t> SigRendered;
 
 private:
   static constexpr int kTargetFreq = WS2811_TARGET_FREQ;
-  static constexpr int kGpioPin = 18;
+  // PWM0 and PWM1
+  static constexpr std::array<int, kChannelCount> kGpioPins = {18, 13};
   static constexpr int kDma = 10;
   static constexpr int kStripeType = SK6812_STRIP_GRBW; // SK6812RGBW (NOT SK6812RGB)
+  // 32 bit of 1.25us per led plus the reset time
+  static constexpr auto kLedTime = std::chrono::nanoseconds(40000);
+  static constexpr auto kResetTime = std::chrono::microseconds(300);
   static constexpr const char *kConfigFile = "ws2811.json";
 
   void SaveState() override;
   bool WriteHardwareInit();
+  bool Render();
 
   const std::string config_path_;
   ws2811_t ledstring_;
+  backend_e backend_{backend_e::hardware};
+  bool initialized_{false};
+  bool suspended_{false};
+  // the LEDs of the simulated backend and the end of its pending transfer
+  std::array<std::vector<ws2811_led_t>, kChannelCount> simulated_leds_;
+  std::chrono::steady_clock::time_point simulated_busy_;
 
   uint8_t max_brightness_{255};
-  float brightness_{1.0};
-  std::vector<ws2811_led_t> current_frame_;
+  frame_t current_frame_;
+  CurrentLimiter current_limiter_;
+
+  std::chrono::steady_clock::time_point last_frame_;
+  std::chrono::steady_clock::time_point render_time_;
+  Metrics::Counter &frames_total_{
+      Metrics::Instance().GetCounter("ledcontrol_frames_total", "Frames rendered to the strip")};
+  Metrics::Histogram &render_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_render_seconds", "Time to render a frame including the DMA transfer")};
+  Metrics::Gauge &frame_rate_{
+      Metrics::Instance().GetGauge("ledcontrol_frame_rate", "Frames per second, smoothed")};
+  Metrics::Gauge &suspended_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_output_suspended", "1 while the driver is released because all is off")};
+  Metrics::Histogram &resume_seconds_{Metrics::Instance().GetHistogram(
+      "ledcontrol_output_resume_seconds", "Time to initialize the driver and render a frame")};
+  Metrics::Gauge &current_gauge_{Metrics::Instance().GetGauge(
+      "ledcontrol_current_amperes", "Estimated supply current of the last frame")};
+  Metrics::Histogram &current_amperes_{Metrics::Instance().GetHistogram(
+      "ledcontrol_current_frame_amperes", "Estimated supply current per frame",
+      {0.5, 1, 2, 3, 4, 6, 8, 10, 15, 20, 30})};
+  Metrics::Gauge &current_scale_{Metrics::Instance().GetGauge(
+      "ledcontrol_current_limit_scale", "Brightness scale of the current limiter, 1 if idle")};
+  Metrics::Counter &current_limited_total_{Metrics::Instance().GetCounter(
+      "ledcontrol_current_limited_frames_total", "Frames dimmed by the current limiter")};
 };
 
 #endif // SRC_WS2811_CONTROL_HPP